@@ -1,12 +1,11 @@
-import js.Syntax;
 import haxe.Timer;
 import js.Browser;
 import js.html.DeviceMotionEvent;
 import js.html.InputElement;
+import js.html.MessageEvent;
+import js.html.Worker;
 import js.lib.Float32Array;
-import js.lib.Int32Array;
 import js.lib.Promise;
-import js.lib.WebAssembly;
 import muun.la.Mat2;
 import muun.la.Vec2;
 import pot.core.App;
@@ -42,14 +41,17 @@ private enum abstract CellField(Int) to Int {
 class Main extends App {
 	var g:Graphics;
 
-	static inline final MAX_PARTICLES:Int = 262144;
+	// initial capacities; the wasm storage grows beyond them on demand (see reserve)
+	static inline final INITIAL_PARTICLES:Int = 262144;
 
 	var numP:Int = 0;
 
-	static inline final MAX_CELLS:Int = 262144;
+	static inline final INITIAL_CELLS:Int = 262144;
 
-	var pdata:Float32Array = new Float32Array(MAX_PARTICLES * ParticleField.SIZE);
-	var cdata:Float32Array = new Float32Array(MAX_CELLS * CellField.SIZE);
+	// one plane of particleCapacity floats per ParticleField, views of the wasm memory once loaded
+	var pdata:Array<Float32Array> = [for (i in 0...ParticleField.SIZE) new Float32Array(INITIAL_PARTICLES)];
+	// the grid of the JS step, CellField.SIZE floats per cell. the engine keeps its own planes
+	var cdata:Float32Array = new Float32Array(INITIAL_CELLS * CellField.SIZE);
 
 	var scale:Float = 8.0;
 
@@ -76,8 +78,23 @@ class Main extends App {
 
 	var shader:Shader;
 
+	// the module of the page, which holds the particles of the JS step
 	var wasm:WasmLogic;
 
+	// steps the engine in wasm mode, with a module of its own, see Stepper
+	var stepper:Worker;
+	var stepperRun:Int = 0; // of the last "start"
+	var stepping:Bool = false; // the stepper has the particles
+	var awaitingState:Bool = false; // the JS step waits for the particles to come back
+	var inFlight:Int = 0; // inputs posted whose frames haven't come back yet
+	// the newest frame of the stepper, null before the first
+	var frameVertices:Float32Array = null;
+	var frameMs:Float = 0;
+
+	// inputs the stepper may have in hand: one it steps and one it starts on as soon as that's done.
+	// further ones are dropped rather than queued, so that the stepper never falls behind the page
+	static inline final MAX_IN_FLIGHT:Int = 2;
+
 	var useWasm:Bool = false;
 	var deviceMotionEnabled:Bool = false;
 
@@ -143,6 +160,14 @@ class Main extends App {
 
 		enableWasm.oninput = function() {
 			useWasm = enableWasm.checked;
+			if (wasm != null) {
+				// the stepper takes the particles in wasm mode and hands them back to the JS step
+				if (useWasm) {
+					startStepper();
+				} else {
+					stopStepper(true);
+				}
+			}
 		}
 
 		enableAcc.oninput = function() {
@@ -164,24 +189,13 @@ class Main extends App {
 			}
 		}
 
-		Browser.window.fetch("main.wasm").then(res -> WebAssembly.instantiateStreaming(res, {}).then((res) -> {
-			final exports = res.instance.exports;
+		stepper = new Worker("stepper.js");
+		stepper.onmessage = (e:MessageEvent) -> receive(e.data);
 
-			wasm = cast {
-			};
+		WasmLoader.load("main.wasm").then(wasm -> {
+			this.wasm = wasm;
 
-			// protect functions from closure compiler
-			Syntax.code("{0}.particles = {1}[\"particles\"];", wasm, exports);
-			Syntax.code("{0}.cells = {1}[\"cells\"];", wasm, exports);
-			Syntax.code("{0}.setGrid = {1}[\"setGrid\"];", wasm, exports);
-			Syntax.code("{0}.p2g = {1}[\"p2g\"];", wasm, exports);
-			Syntax.code("{0}.updateGrid = {1}[\"updateGrid\"];", wasm, exports);
-			Syntax.code("{0}.g2p = {1}[\"g2p\"];", wasm, exports);
-			Syntax.code("{0}.memory = {1}[\"memory\"];", wasm, exports);
-			Syntax.code("{0}.numP = {1}[\"numP\"];", wasm, exports);
-
-			pdata = new Float32Array(wasm.memory.buffer, wasm.particles());
-			cdata = new Float32Array(wasm.memory.buffer, wasm.cells());
+			reserve(INITIAL_PARTICLES, INITIAL_CELLS);
 
 			low.onclick = changeRes.bind(12);
 			medium.onclick = changeRes.bind(8);
@@ -189,92 +203,127 @@ class Main extends App {
 			sup.onclick = changeRes.bind(4);
 			medium.click();
 			pot.start();
-		}));
+		});
 	}
 
 	function initSimulation():Void {
+		// the particles of the stepper are dropped with the scene
+		stopStepper(false);
 		mesh.mode = Points;
 		mesh.writer.clear();
 		mesh.material.shader = shader;
 		numP = 0;
-		// spawnBox(pot.width * 0.5, 200, 200, 200);
-		// spawnBox(pot.width * 0.5, 110, 200, 200);
-		// spawnBox(pot.width * 0.5, pot.height - 160, pot.width - 50, 300);
+		// drop the storage grown for a previous, larger scene
+		reserve(INITIAL_PARTICLES, 0);
 		final isqrt2 = Math.sqrt(0.5);
 
-		spawnBox(pot.width * 0.5 / scale, pot.height * 0.5 / scale, pot.width / scale * isqrt2, pot.height / scale * isqrt2);
-
-		// addParticle(pot.width * 0.5 / SCALE, pot.height * 0.5 / SCALE);
-
-		// spawnBox(pot.width * 0.5 / SCALE, pot.height * 0.5 / SCALE, 200 / SCALE, 200 / SCALE);
-		// for (i in 0...5) {
-		// 	for (j in 0...3) {
-		// 		spawnBox(pot.width * 0.5 + (j - 1) * 180, 80 + i * 120, 150, 100);
-		// 	}
-		// }
+		// a box of water at rest, filled by the engine in one call
+		numP = wasm.emitBox(pot.width * 0.5 / scale, pot.height * 0.5 / scale, pot.width / scale * isqrt2 * 0.5,
+			pot.height / scale * isqrt2 * 0.5, PDELTA, 0, 0);
+		for (i in 0...numP)
+			mesh.writer.vertex(0, 0, 0);
 		mesh.writer.upload();
+		// the storage may have grown
+		bindViews();
 
-		// sync numP
-		new Int32Array(wasm.memory.buffer, wasm.numP.value)[0] = numP;
+		syncNumP();
+		wasm.resetIds();
 
 		trace("particles: " + numP);
+		if (useWasm)
+			startStepper();
 	}
 
-	function spawnBox(cx:Float, cy:Float, w:Float, h:Float):Void {
-		final y1 = cy - h * 0.5;
-		final y2 = cy + h * 0.5;
-		final x1 = cx - w * 0.5;
-		final x2 = cx + w * 0.5;
-
-		var y = y1;
-		while (y < y2) {
-			var x = x1;
-			while (x < x2) {
-				addParticle(x, y);
-				x += PDELTA;
-			}
-			y += PDELTA;
+	// hands the particles to the stepper, or lets it go on with those it has if they haven't come back
+	function startStepper():Void {
+		final message:StepperMessage = {
+			type: "start",
+			run: ++stepperRun
+		};
+		if (awaitingState) {
+			awaitingState = false;
+			stepper.postMessage(message);
+		} else {
+			message.numP = numP;
+			message.planes = [for (i in 0...ParticleField.SIZE) pdata[i].slice(0, numP)];
+			stepper.postMessage(message, [for (plane in message.planes) plane.buffer]);
 		}
+		stepping = true;
+		inFlight = 0;
+		// the vertices of an earlier run may be of a different scene
+		frameVertices = null;
+	}
+
+	// stops the stepper after the input in hand. keep has it send the particles back, which the JS
+	// step waits for
+	function stopStepper(keep:Bool):Void {
+		awaitingState = false;
+		if (!stepping)
+			return;
+		final message:StepperMessage = {
+			type: "stop",
+			run: stepperRun,
+			keep: keep
+		};
+		stepper.postMessage(message);
+		stepping = false;
+		awaitingState = keep;
 	}
 
-	function addParticle(x:Float, y:Float):Void {
-		if (numP == MAX_PARTICLES)
+	function receive(message:StepperMessage):Void {
+		if (message.run != stepperRun)
 			return;
-		var p = numP * ParticleField.SIZE;
-		pdata[p++] = 0;
-		pdata[p++] = x;
-		pdata[p++] = y;
-		pdata[p++] = 0;
-		pdata[p++] = 0;
-		pdata[p++] = 0;
-		pdata[p++] = 0;
-		pdata[p++] = 0;
-		pdata[p++] = 0;
-		pdata[p++] = 0;
-		numP++;
-		mesh.writer.vertex(0, 0, 0);
+		switch message.type {
+			case "frame":
+				if (!stepping)
+					return;
+				inFlight--;
+				frameVertices = message.vertices;
+				frameMs = message.ms;
+			case "state":
+				if (!awaitingState)
+					return;
+				awaitingState = false;
+				if (message.numP > wasm.particleCapacity())
+					reserve(message.numP, 0);
+				for (i in 0...ParticleField.SIZE)
+					pdata[i].set(message.planes[i]);
+				numP = message.numP;
+				syncNumP();
+		}
+	}
+
+	function syncNumP():Void {
+		wasm.setParticleCount(numP);
+	}
+
+	// (re)creates the views of the wasm storage, which moves on reserve and detaches when the memory grows
+	function bindViews():Void {
+		pdata = [
+			for (i in 0...ParticleField.SIZE)
+				new Float32Array(wasm.memory.buffer, wasm.particlePlane(i), wasm.particleCapacity())
+		];
+	}
+
+	function reserve(particles:Int, cells:Int):Bool {
+		syncNumP(); // the engine keeps its first numP particles
+		final ok = wasm.reserve(particles, cells) != 0;
+		bindViews();
+		return ok;
 	}
 
 	function updateMesh():Void {
-		final colorData = mesh.writer.colorWriter.data;
-		var p = 0;
-		var colIdx = 0;
-		final pixelScale = canvas.width / pot.width;
-		for (i in 0...numP) {
-			final px = pdata[p + ParticleField.POS_X];
-			final py = pdata[p + ParticleField.POS_Y];
-			final vx = pdata[p + ParticleField.VEL_X];
-			final vy = pdata[p + ParticleField.VEL_Y];
-			final d = pdata[p + ParticleField.DENSITY] * INV_DENSITY;
-			final pos = Vec2.of(px, py) * scale;
-			final s = scale * PDELTA * 0.85 * min(d + 0.5, 1.5) * 2 * pixelScale;
-			final t = clamp(pdata[p + ParticleField.AERATION], 0, 1);
-			colorData[colIdx++] = pos.x;
-			colorData[colIdx++] = pos.y;
-			colorData[colIdx++] = s;
-			colorData[colIdx++] = t;
-			p += ParticleField.SIZE;
+		// the engine lays out the vertices, which then go to the color buffer in one copy.
+		// in wasm mode they come from the newest frame the stepper has finished
+		var vertices:Float32Array = null;
+		if (useWasm) {
+			vertices = frameVertices;
+		} else {
+			syncNumP();
+			vertices = new Float32Array(wasm.memory.buffer, wasm.renderVertices(scale, canvas.width / pot.width), numP * 4);
 		}
+		if (vertices != null && vertices.length > 0)
+			mesh.writer.colorWriter.data.set(vertices);
 		mesh.writer.colorWriter.upload(true);
 	}
 
@@ -283,19 +332,21 @@ class Main extends App {
 		// 	initSimulation();
 
 		final st = Timer.stamp();
-		for (t in 0...SUBSTEP) {
-			if (useWasm)
-				stepWasm();
-			else
+		if (useWasm) {
+			stepWasm();
+		} else if (!awaitingState) {
+			for (t in 0...SUBSTEP)
 				step();
 		}
 		updateMesh();
+		// in wasm mode the page only posts the input; the time is that of the stepper's newest frame
 		final en = Timer.stamp();
+		final ms = useWasm ? frameMs : (en - st) * 1000;
 		static final info = Browser.document.getElementById("info");
 		info.innerHTML = "Particles: "
 			+ numP
 			+ "<br>Time: "
-			+ Math.round((en - st) * 1000 * 1000) / 1000
+			+ Math.round(ms * 1000) / 1000
 			+ "ms ("
 			+ (useWasm ? "WASM" : "JS")
 			+ ")";
@@ -305,6 +356,8 @@ class Main extends App {
 		gridW = Std.int(pot.width / scale) + 1;
 		gridH = Std.int(pot.height / scale) + 1;
 		numC = gridW * gridH;
+		if (numC * CellField.SIZE > cdata.length)
+			cdata = new Float32Array(numC * CellField.SIZE);
 		var p = 0;
 		for (y in 0...gridH) {
 			for (x in 0...gridW) {
@@ -366,23 +419,30 @@ class Main extends App {
 	function step():Void {
 		prepareGrid();
 
-		final pdata = this.pdata;
 		final cdata = this.cdata;
+		final aerations = pdata[ParticleField.AERATION];
+		final posXs = pdata[ParticleField.POS_X];
+		final posYs = pdata[ParticleField.POS_Y];
+		final velXs = pdata[ParticleField.VEL_X];
+		final velYs = pdata[ParticleField.VEL_Y];
+		final gvel00s = pdata[ParticleField.GVEL_00];
+		final gvel01s = pdata[ParticleField.GVEL_01];
+		final gvel10s = pdata[ParticleField.GVEL_10];
+		final gvel11s = pdata[ParticleField.GVEL_11];
+		final densities = pdata[ParticleField.DENSITY];
 
 		// mass and momentum transfer
 		final deltaIdxY = gridW * CellField.SIZE;
 		for (i in 0...numP) {
-			final off = i * ParticleField.SIZE;
-			var p = off;
-			final a = pdata[p++];
-			final px = pdata[p++];
-			final py = pdata[p++];
-			final vx = pdata[p++];
-			final vy = pdata[p++];
-			final gv00 = pdata[p++];
-			final gv01 = pdata[p++];
-			final gv10 = pdata[p++];
-			final gv11 = pdata[p++];
+			final a = aerations[i];
+			final px = posXs[i];
+			final py = posYs[i];
+			final vx = velXs[i];
+			final vy = velYs[i];
+			final gv00 = gvel00s[i];
+			final gv01 = gvel01s[i];
+			final gv10 = gvel10s[i];
+			final gv11 = gvel11s[i];
 			final gx = Std.int(px);
 			final gy = Std.int(py);
 			final cidx = ((gy - 1) * gridW + (gx - 1)) * CellField.SIZE;
@@ -493,10 +553,9 @@ class Main extends App {
 
 		// apply pressure
 		for (i in 0...numP) {
-			final off = i * ParticleField.SIZE;
-			final a = pdata[off + ParticleField.AERATION];
-			final px = pdata[off + ParticleField.POS_X];
-			final py = pdata[off + ParticleField.POS_Y];
+			final a = aerations[i];
+			final px = posXs[i];
+			final py = posYs[i];
 			final gx = Std.int(px);
 			final gy = Std.int(py);
 			final cidx = ((gy - 1) * gridW + (gx - 1)) * CellField.SIZE;
@@ -553,10 +612,10 @@ class Main extends App {
 			aeration += w22 * cdata[c22 + CellField.AERATION];
 
 			// set density
-			pdata[off + ParticleField.DENSITY] = density;
+			densities[i] = density;
 
 			// update aeration
-			pdata[off + ParticleField.AERATION] = AERATION_DAMP * (a + (aeration - a) * AERATION_BLUR);
+			aerations[i] = AERATION_DAMP * (a + (aeration - a) * AERATION_BLUR);
 
 			var pressure = (density / DENSITY - 1) * 5.0;
 			if (pressure < 0)
@@ -695,11 +754,10 @@ class Main extends App {
 
 		// grid to particle
 		for (i in 0...numP) {
-			final off = i * ParticleField.SIZE;
-			final px = pdata[off + ParticleField.POS_X];
-			final py = pdata[off + ParticleField.POS_Y];
-			final pvx = pdata[off + ParticleField.VEL_X];
-			final pvy = pdata[off + ParticleField.VEL_Y];
+			final px = posXs[i];
+			final py = posYs[i];
+			final pvx = velXs[i];
+			final pvy = velYs[i];
 			final gx = Std.int(px);
 			final gy = Std.int(py);
 			var cidx = ((gy - 1) * gridW + (gx - 1)) * CellField.SIZE;
@@ -820,20 +878,20 @@ class Main extends App {
 			final ax = vx - pvx;
 			final ay = vy - pvy;
 			final alen = Math.sqrt(ax * ax + ay * ay);
-			final densityRatio = pdata[off + ParticleField.DENSITY] / DENSITY;
+			final densityRatio = densities[i] / DENSITY;
 			if (densityRatio < AERATION_THRESHOLD) {
-				final a = pdata[off + ParticleField.AERATION] + alen * (1 - densityRatio / AERATION_THRESHOLD) * AERATION_COEFF;
-				pdata[off + ParticleField.AERATION] = min(1, a);
+				final a = aerations[i] + alen * (1 - densityRatio / AERATION_THRESHOLD) * AERATION_COEFF;
+				aerations[i] = min(1, a);
 			}
 
-			pdata[off + ParticleField.POS_X] = npx + rand.nextFloat(-1e-4, 1e-4);
-			pdata[off + ParticleField.POS_Y] = npy + rand.nextFloat(-1e-4, 1e-4);
-			pdata[off + ParticleField.VEL_X] = vx;
-			pdata[off + ParticleField.VEL_Y] = vy;
-			pdata[off + ParticleField.GVEL_00] = gv00;
-			pdata[off + ParticleField.GVEL_01] = gv01;
-			pdata[off + ParticleField.GVEL_10] = gv10;
-			pdata[off + ParticleField.GVEL_11] = gv11;
+			posXs[i] = npx + rand.nextFloat(-1e-4, 1e-4);
+			posYs[i] = npy + rand.nextFloat(-1e-4, 1e-4);
+			velXs[i] = vx;
+			velYs[i] = vy;
+			gvel00s[i] = gv00;
+			gvel01s[i] = gv01;
+			gvel10s[i] = gv10;
+			gvel11s[i] = gv11;
 		}
 	}
 
@@ -841,7 +899,6 @@ class Main extends App {
 		gridW = Std.int(pot.width / scale) + 1;
 		gridH = Std.int(pot.height / scale) + 1;
 		numC = gridW * gridH;
-		wasm.setGrid(gridW, gridH);
 
 		final touching = input.touches.length > 0;
 		final touch = touching ? input.touches[0] : null;
@@ -860,15 +917,32 @@ class Main extends App {
 		final gx = accX / 9.80665 * GRAVITY;
 		final gy = -accY / 9.80665 * GRAVITY;
 
-		wasm.p2g();
-		wasm.updateGrid(gx, gy, mouse.x, mouse.y, dmouse.x, dmouse.y, rad);
-		wasm.g2p();
-
-		// add randomness to avoid particle clustering
-		for (i in 0...numP) {
-			pdata[i * ParticleField.SIZE + ParticleField.POS_X] += rand.nextFloat(-1e-4, 1e-4);
-			pdata[i * ParticleField.SIZE + ParticleField.POS_Y] += rand.nextFloat(-1e-4, 1e-4);
-		}
+		if (inFlight >= MAX_IN_FLIGHT)
+			return;
+		// SUBSTEP base steps as one input, including the anti-clustering jitter. the engine splits
+		// them into substeps by the speed of the flow and steps the input when it's done with the
+		// previous ones
+		final message:StepperMessage = {
+			type: "input",
+			run: stepperRun,
+			input: {
+				gridW: gridW,
+				gridH: gridH,
+				substeps: SUBSTEP,
+				gravityX: gx,
+				gravityY: gy,
+				mouseX: mouse.x,
+				mouseY: mouse.y,
+				dmouseX: dmouse.x,
+				dmouseY: dmouse.y,
+				radius: rad,
+				jitter: 1e-4,
+				scale: scale,
+				pixelScale: canvas.width / pot.width
+			}
+		};
+		stepper.postMessage(message);
+		inFlight++;
 	}
 
 	override function draw():Void {
@@ -879,6 +953,8 @@ class Main extends App {
 	function renderScene():Void {
 		g.clear(0.1, 0.1, 0.1);
 
+		// the cell views read the grid of the page's module, which the stepper's module doesn't share:
+		// they show the commented-out cdata of the JS step instead once swapped back in
 		final drawCellColor = false;
 		final drawGrid = false;
 		final drawVel = false;
@@ -904,14 +980,14 @@ class Main extends App {
 				// 	}
 				// }
 
-				final wasmCs = new Float32Array(wasm.memory.buffer, wasm.cells());
-				var p = 0;
+				final wasmMass = new Float32Array(wasm.memory.buffer, wasm.cellPlane(CellField.MASS));
+				final stride = wasm.cellStride();
 				for (i in 0...gridH) {
 					for (j in 0...gridW) {
 						final x = (j + 0.5) * scale;
 						final y = (i + 0.5) * scale;
 						final d = 0.5 * scale;
-						var f = wasmCs[p + CellField.MASS] * INV_DENSITY;
+						var f = wasmMass[i * stride + j] * INV_DENSITY;
 						g.color(f, 0, 1 - f);
 						g.vertex(x - d, y - d);
 						g.vertex(x - d, y + d);
@@ -919,7 +995,6 @@ class Main extends App {
 						g.vertex(x - d, y - d);
 						g.vertex(x + d, y + d);
 						g.vertex(x + d, y - d);
-						p += CellField.SIZE;
 					}
 				}
 			});
@@ -959,17 +1034,17 @@ class Main extends App {
 				// 	}
 				// }
 
-				final wasmCs = new Float32Array(wasm.memory.buffer, wasm.cells());
-				var cidx = 0;
+				final wasmVelX = new Float32Array(wasm.memory.buffer, wasm.cellPlane(CellField.VEL_X));
+				final wasmVelY = new Float32Array(wasm.memory.buffer, wasm.cellPlane(CellField.VEL_Y));
+				final stride = wasm.cellStride();
 				for (i in 0...gridH) {
 					for (j in 0...gridW) {
 						final x = (j + 0.5) * scale;
 						final y = (i + 0.5) * scale;
-						final vx = wasmCs[cidx + CellField.VEL_X] * 2 * scale;
-						final vy = wasmCs[cidx + CellField.VEL_Y] * 2 * scale;
+						final vx = wasmVelX[i * stride + j] * 2 * scale;
+						final vy = wasmVelY[i * stride + j] * 2 * scale;
 						g.vertex(x, y);
 						g.vertex(x + vx, y + vy);
-						cidx += CellField.SIZE;
 					}
 				}
 			}
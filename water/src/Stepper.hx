@@ -0,0 +1,96 @@
+import StepperMessage.StepperInput;
+import haxe.Timer;
+import js.Lib;
+import js.html.DedicatedWorkerGlobalScope;
+import js.html.MessageEvent;
+import js.lib.Float32Array;
+
+// the engine in a Web Worker of its own, with a module of its own, so that the page never waits
+// for a step (see Main). it steps each input as it comes and posts the vertices back
+class Stepper {
+	static var scope:DedicatedWorkerGlobalScope;
+	static var wasm:WasmLogic;
+	static var run:Int = -1; // -1 while stopped
+	static var numPlanes:Int = 0;
+
+	static function main():Void {
+		scope = cast Lib.global;
+		final ready = WasmLoader.load("main.wasm").then(wasm -> {
+			Stepper.wasm = wasm;
+			// reorder particles by cell once they get mixed up
+			wasm.setSortPolicy(0, 0.5);
+			// the substeps of an input, which is as long as the pressure stands, and more where the flow
+			// is fast (up to 8, and 10 ms a frame). cfl 3 takes 2.0-2.2 a frame in water_bench's scenes,
+			// close to the cost of fixed stepping, spent where the water moves fastest
+			wasm.setAdaptiveSteps(3, 1, 8, 10);
+		});
+		// messages that come in while the module loads wait for it, in order
+		scope.onmessage = (e:MessageEvent) -> ready.then(_ -> receive(e.data));
+	}
+
+	static function receive(message:StepperMessage):Void {
+		switch message.type {
+			case "start":
+				if (message.planes != null)
+					load(message.numP, message.planes);
+				run = message.run;
+			case "input":
+				// inputs queued before a "stop" are dropped
+				if (message.run == run)
+					step(message.input);
+			case "stop":
+				if (message.run != run)
+					return;
+				run = -1;
+				if (message.keep)
+					postState(message.run);
+		}
+	}
+
+	static function load(numP:Int, planes:Array<Float32Array>):Void {
+		wasm.setParticleCount(0);
+		if (numP > wasm.particleCapacity())
+			wasm.reserve(numP, 0);
+		for (i in 0...planes.length)
+			new Float32Array(wasm.memory.buffer, wasm.particlePlane(i), numP).set(planes[i]);
+		wasm.setParticleCount(numP);
+		wasm.resetIds();
+		// the blocks the grid tracks belong to the particles of the last run
+		wasm.clearGrid();
+		numPlanes = planes.length;
+	}
+
+	static function step(input:StepperInput):Void {
+		final st = Timer.stamp();
+		wasm.setGrid(input.gridW, input.gridH);
+		wasm.step(input.substeps, input.gravityX, input.gravityY, input.mouseX, input.mouseY, input.dmouseX, input.dmouseY,
+			input.radius, input.jitter);
+		final numP = wasm.particleCount();
+		// a copy, handed over to the page with its buffer
+		final vertices = new Float32Array(wasm.memory.buffer, wasm.renderVertices(input.scale, input.pixelScale), numP * 4).slice(0);
+		final en = Timer.stamp();
+		final message:StepperMessage = {
+			type: "frame",
+			run: run,
+			numP: numP,
+			vertices: vertices,
+			ms: (en - st) * 1000
+		};
+		scope.postMessage(message, [vertices.buffer]);
+	}
+
+	static function postState(stopped:Int):Void {
+		final numP = wasm.particleCount();
+		final planes = [
+			for (i in 0...numPlanes)
+				new Float32Array(wasm.memory.buffer, wasm.particlePlane(i), numP).slice(0)
+		];
+		final message:StepperMessage = {
+			type: "state",
+			run: stopped,
+			numP: numP,
+			planes: planes
+		};
+		scope.postMessage(message, [for (plane in planes) plane.buffer]);
+	}
+}
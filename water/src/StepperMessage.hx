@@ -0,0 +1,32 @@
+import js.lib.Float32Array;
+
+// arguments of one step() and of the renderVertices() after it
+typedef StepperInput = {
+	var gridW:Int;
+	var gridH:Int;
+	var substeps:Int;
+	var gravityX:Float;
+	var gravityY:Float;
+	var mouseX:Float;
+	var mouseY:Float;
+	var dmouseX:Float;
+	var dmouseY:Float;
+	var radius:Float;
+	var jitter:Float;
+	var scale:Float;
+	var pixelScale:Float;
+}
+
+// between the page and the stepper. to the stepper: "start" (with the particles in planes, or none
+// to go on with those it has), "input" and "stop" (keep asks for the particles back). from it: a
+// "frame" of vertices for each input and the "state" of the particles
+typedef StepperMessage = {
+	var type:String;
+	var run:Int; // of the "start", so that the messages of earlier runs can be told apart
+	var ?numP:Int;
+	var ?planes:Array<Float32Array>; // numP floats per particle plane
+	var ?input:StepperInput;
+	var ?keep:Bool;
+	var ?vertices:Float32Array; // of renderVertices, 4 floats per particle
+	var ?ms:Float; // stepping and rendering the frame took
+}
@@ -0,0 +1,52 @@
+import js.Syntax;
+import js.lib.Promise;
+import js.lib.WebAssembly;
+
+class WasmLoader {
+	// instantiates the module at url, on the page (Main) or in the stepper's worker (Stepper)
+	public static function load(url:String):Promise<WasmLogic> {
+		// the global fetch, which workers have too. a promise of the response, which instantiateStreaming
+		// takes as well
+		final response:Dynamic = Syntax.code("fetch({0})", url);
+		return WebAssembly.instantiateStreaming(response, {}).then((res) -> {
+			final exports = res.instance.exports;
+
+			final wasm:WasmLogic = cast {
+			};
+
+			// protect functions from closure compiler
+			Syntax.code("{0}.reserve = {1}[\"reserve\"];", wasm, exports);
+			Syntax.code("{0}.particleCapacity = {1}[\"particleCapacity\"];", wasm, exports);
+			Syntax.code("{0}.cellCapacity = {1}[\"cellCapacity\"];", wasm, exports);
+			Syntax.code("{0}.particlePlane = {1}[\"particlePlane\"];", wasm, exports);
+			Syntax.code("{0}.cellPlane = {1}[\"cellPlane\"];", wasm, exports);
+			Syntax.code("{0}.cellStride = {1}[\"cellStride\"];", wasm, exports);
+			Syntax.code("{0}.setGrid = {1}[\"setGrid\"];", wasm, exports);
+			Syntax.code("{0}.clearGrid = {1}[\"clearGrid\"];", wasm, exports);
+			Syntax.code("{0}.emitBox = {1}[\"emitBox\"];", wasm, exports);
+			Syntax.code("{0}.particleIds = {1}[\"particleIds\"];", wasm, exports);
+			Syntax.code("{0}.resetIds = {1}[\"resetIds\"];", wasm, exports);
+			Syntax.code("{0}.setSortPolicy = {1}[\"setSortPolicy\"];", wasm, exports);
+			Syntax.code("{0}.setAdaptiveSteps = {1}[\"setAdaptiveSteps\"];", wasm, exports);
+			Syntax.code("{0}.setPressureSolver = {1}[\"setPressureSolver\"];", wasm, exports);
+			Syntax.code("{0}.pressureSolver = {1}[\"pressureSolver\"];", wasm, exports);
+			Syntax.code("{0}.step = {1}[\"step\"];", wasm, exports);
+			Syntax.code("{0}.renderVertices = {1}[\"renderVertices\"];", wasm, exports);
+			Syntax.code("{0}.densityTexture = {1}[\"densityTexture\"];", wasm, exports);
+			Syntax.code("{0}.asyncStart = {1}[\"asyncStart\"];", wasm, exports);
+			Syntax.code("{0}.asyncStop = {1}[\"asyncStop\"];", wasm, exports);
+			Syntax.code("{0}.asyncInput = {1}[\"asyncInput\"];", wasm, exports);
+			Syntax.code("{0}.asyncVertices = {1}[\"asyncVertices\"];", wasm, exports);
+			Syntax.code("{0}.asyncNumP = {1}[\"asyncNumP\"];", wasm, exports);
+			Syntax.code("{0}.stats = {1}[\"stats\"];", wasm, exports);
+			Syntax.code("{0}.traceStart = {1}[\"traceStart\"];", wasm, exports);
+			Syntax.code("{0}.traceStop = {1}[\"traceStop\"];", wasm, exports);
+			Syntax.code("{0}.traceJson = {1}[\"traceJson\"];", wasm, exports);
+			Syntax.code("{0}.traceJsonSize = {1}[\"traceJsonSize\"];", wasm, exports);
+			Syntax.code("{0}.memory = {1}[\"memory\"];", wasm, exports);
+			Syntax.code("{0}.particleCount = {1}[\"particleCount\"];", wasm, exports);
+			Syntax.code("{0}.setParticleCount = {1}[\"setParticleCount\"];", wasm, exports);
+			return wasm;
+		});
+	}
+}
@@ -1,13 +1,37 @@
-import js.lib.webassembly.Global;
 import js.lib.webassembly.Memory;
 
 typedef WasmLogic = {
-	function particles():Int;
-	function cells():Int;
+	function reserve(particles:Int, cells:Int):Int;
+	function particleCapacity():Int;
+	function cellCapacity():Int;
+	function particlePlane(field:Int):Int;
+	function cellPlane(field:Int):Int;
+	function cellStride():Int;
 	function setGrid(gw:Int, gh:Int):Void;
-	function p2g():Void;
-	function updateGrid(gravityX:Float, gravityY:Float, mouseX:Float, mouseY:Float, dmouseX:Float, dmouseY:Float, radius:Float):Void;
-	function g2p():Void;
+	function clearGrid():Void;
+	function emitBox(x:Float, y:Float, halfW:Float, halfH:Float, spacing:Float, vx:Float, vy:Float):Int;
+	function particleIds():Int;
+	function resetIds():Void;
+	function setSortPolicy(interval:Int, threshold:Float):Void;
+	function setAdaptiveSteps(maxCfl:Float, minCount:Int, maxCount:Int, frameBudgetMs:Float):Void;
+	function setPressureSolver(solver:Int, maxIterations:Int, tolerance:Float):Void;
+	function pressureSolver():Int;
+	function step(substeps:Int, gravityX:Float, gravityY:Float, mouseX:Float, mouseY:Float, dmouseX:Float, dmouseY:Float, radius:Float,
+		jitter:Float):Void;
+	function renderVertices(scale:Float, pixelScale:Float):Int;
+	function densityTexture(width:Int, height:Int, format:Int):Int;
+	function asyncStart():Int;
+	function asyncStop():Void;
+	function asyncInput(gridW:Int, gridH:Int, substeps:Int, gravityX:Float, gravityY:Float, mouseX:Float, mouseY:Float, dmouseX:Float,
+		dmouseY:Float, radius:Float, jitter:Float, scale:Float, pixelScale:Float):Int;
+	function asyncVertices():Int;
+	function asyncNumP():Int;
+	function stats():Int;
+	function traceStart(maxEvents:Int):Int;
+	function traceStop():Void;
+	function traceJson():Int;
+	function traceJsonSize():Int;
+	function particleCount():Int;
+	function setParticleCount(n:Int):Void;
 	final memory:Memory;
-	final numP:Global;
 }
@@ -0,0 +1,898 @@
+// headless scenario benchmark for the MPM core.
+// drives the engine the way Main.hx does and prints per-phase timings as JSON.
+//
+//   water_bench [--width W] [--height H] [--dpr R] [--frames N] [--warmup N]
+//               [--scene center|dambreak|stir|obstacles|flow|all] [--scale 12|8|6|4|all]
+//               [--threads N] [--sort-interval K] [--sort-threshold D] [--stencil cached|fused|all]
+//               [--isa simd128|avx2|avx512|all] [--record FILE]
+//               [--substeps fixed|adaptive|all] [--cfl C] [--min-substeps N] [--max-substeps N]
+//               [--budget MS] [--trace FILE] [--transfer scatter|gather|fixed|all]
+//               [--batch N] [--batch-threads N] [--aeration on|off|all] [--ranks N|all]
+//               [--texture PIXELS] [--pressure eos|project|all] [--frame-steps N]
+//
+// adaptive runs let the engine pick the substeps of each frame (setAdaptiveSteps), fixed ones
+// take one per base step. a frame is SUBSTEP base steps, or N with --frame-steps.
+// --record writes the measured frames of each run to FILE (replacing the last run's) and times
+// their replay
+// --trace writes the phases, substeps and frames of each run's measured frames to FILE as Chrome
+// trace JSON (replacing the last run's). builds without WATER_STATS have no trace nor "stats"
+// --aeration off runs the kernels without aeration (setFeatures)
+// --batch steps N copies of each scene, each a simulation of its own, together with stepBatch()
+// on --batch-threads threads and times whole frames only. the first copy reports the checksum
+// --ranks splits each scene into strips stepped by as many processes (Domain over ShmTransport),
+// timing whole frames of the slowest one; all is 1, 2 and 4. what Domain::ok() turns down (adaptive
+// substeps, the projection, the emitters of the flow scene) is skipped for more than one.
+// storageMBPerRank is the storageBytes() of the largest rank
+// --texture also fills an 8-bit densityTexture() of a texel per PIXELS pixels every frame, timed
+// as its own phase
+// --pressure picks the pressure solver (setPressureSolver); project runs time projectPressure() as
+// its own phase and are skipped for more than one rank. with longer --frame-steps and adaptive
+// substeps capped by --max-substeps, they show how long a substep each solver stands
+
+#include "domain.h"
+#include "water.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+	// driver constants, mirrored from Main.hx
+	constexpr f32 PDELTA = 0.5;
+	constexpr f32 GRAVITY = 0.0075;
+	constexpr i32 SUBSTEP = 2;
+	constexpr f32 MOUSE_RADIUS = 5;
+	constexpr f32 JITTER = 1e-4;
+	constexpr i32 CHUNK_FRAMES = 60; // one second per recording chunk
+	constexpr i32 TRACE_EVENTS_PER_SUBSTEP = 11;
+
+	enum Phase {
+		EMIT,
+		TRANSFER,
+		PRESSURE,
+		MIRROR,
+		UPDATE_GRID,
+		PROJECT,
+		G2P,
+		RENDER,
+		TEXTURE,
+		NUM_PHASES
+	};
+
+	const char* const PHASE_NAMES[NUM_PHASES] = {
+		"emit", "transfer", "pressure", "mirror", "updateGrid", "project", "g2p", "render", "texture"};
+
+	// indexed by KernelIsa
+	const char* const ISA_NAMES[] = {"simd128", "avx2", "avx512"};
+
+	// indexed by TransferMode
+	const char* const TRANSFER_NAMES[] = {"scatter", "gather", "fixed"};
+
+	// indexed by PressureSolver
+	const char* const PRESSURE_NAMES[] = {"eos", "project"};
+
+	using Clock = std::chrono::steady_clock;
+
+	f32* plane(i32 field) {
+		return (f32*) particlePlane(field);
+	}
+
+	struct Options {
+		i32 width = 1920;
+		i32 height = 1080;
+		f64 dpr = 1;
+		i32 frames = 300;
+		i32 warmup = 30;
+		i32 threads = 1;
+		i32 sortInterval = 0;
+		f32 sortThreshold = 0;
+		std::vector<std::string> scenes = {"center", "dambreak", "stir", "obstacles", "flow"};
+		std::vector<i32> scales = {12, 8, 6, 4};
+		std::vector<std::string> stencils = {"cached"};
+		std::vector<i32> transfers = {TRANSFER_SCATTER};
+		std::vector<i32> featureSets = {FEATURE_ALL};
+		std::vector<i32> isas = {kernelIsa()}; // the one picked at startup
+		std::string record;
+		std::string trace;
+		std::vector<std::string> substeps = {"fixed"};
+		f32 cfl = 3; // the page's
+		i32 minSubsteps = 1;
+		i32 maxSubsteps = 8;
+		f32 budgetMs = 0;
+		i32 batch = 1;
+		i32 batchThreads = 1;
+		std::vector<i32> ranks = {1};
+		i32 texturePixels = 0;
+		std::vector<i32> pressures = {PRESSURE_EOS};
+		i32 frameSteps = SUBSTEP;
+	};
+
+	struct Result {
+		i32 isa;
+		std::string substeps;
+		std::string stencil;
+		i32 transfer;
+		i32 features;
+		i32 pressure;
+		i32 ranks;
+		std::string scene;
+		i32 scale;
+		f64 cellSize;
+		i32 gridW;
+		i32 gridH;
+		i32 particles;
+		f64 phaseMs[NUM_PHASES];
+		f64 totalMs;
+		f64 checksum;
+		f32 disorder;
+		f32 activity;
+		i64 totalSubsteps;
+		f32 maxSpeed;
+		f64 recordMs;
+		f64 replayMs;
+		i64 recordBytes;
+		bool hasStats;
+		Stats stats;
+		f64 exchangeMs;
+		i64 migrated;
+		i64 exchangeBytes;
+		f64 storageBytes; // storageBytes() of the simulation, the most of any rank
+	};
+
+	struct Scene {
+		f64 cellSize;
+		f64 pixelScale;
+		i32 gridW;
+		i32 gridH;
+		i32 textureW; // 0 for none
+		i32 textureH;
+		i32 frameSteps; // base steps per frame
+
+		void addParticle(f32 x, f32 y) {
+			const i32 n = particleCount();
+			if (n == particleCapacity() && !reserve(n < 1024 ? 1024 : n * 2, 0))
+				return;
+			for (i32 f = 0; f < P_NUM_FIELDS; f++) {
+				plane(f)[n] = 0;
+			}
+			plane(P_POS_X)[n] = x;
+			plane(P_POS_Y)[n] = y;
+			setParticleCount(n + 1);
+		}
+
+		void spawnBox(f32 cx, f32 cy, f32 w, f32 h) {
+			const f32 y1 = cy - h * 0.5;
+			const f32 y2 = cy + h * 0.5;
+			const f32 x1 = cx - w * 0.5;
+			const f32 x2 = cx + w * 0.5;
+			for (f32 y = y1; y < y2; y += PDELTA) {
+				for (f32 x = x1; x < x2; x += PDELTA) {
+					addParticle(x, y);
+				}
+			}
+		}
+	};
+
+	// same as changeRes in Main.hx
+	f64 cellSizeOf(const Options& opt, i32 scale) {
+		f64 coeff = 1 / (1 + (opt.dpr - 1) * 0.5);
+		const f64 maxRes = 1000 * 1000;
+		const f64 res = (f64) opt.width * opt.height;
+		coeff *= std::sqrt(std::fmax(1, res / maxRes));
+		return scale * coeff;
+	}
+
+	void init(Scene& s, const std::string& name, const Options& opt, i32 scale) {
+		s.cellSize = cellSizeOf(opt, scale);
+		s.pixelScale = opt.dpr;
+		s.gridW = (i32) (opt.width / s.cellSize) + 1;
+		s.gridH = (i32) (opt.height / s.cellSize) + 1;
+		s.textureW = opt.texturePixels > 0 ? (opt.width + opt.texturePixels - 1) / opt.texturePixels : 0;
+		s.textureH = opt.texturePixels > 0 ? (opt.height + opt.texturePixels - 1) / opt.texturePixels : 0;
+		s.frameSteps = opt.frameSteps;
+		setParticleCount(0);
+		reserve(0, s.gridW * s.gridH); // start each run from right-sized storage
+		clearColliders();
+		clearEmitters();
+
+		const f32 w = opt.width / s.cellSize;
+		const f32 h = opt.height / s.cellSize;
+		if (name == "dambreak" || name == "obstacles") {
+			// a tall column against the left wall, clear of the boundary cells
+			s.spawnBox(1 + w * 0.2, h * 0.55 - 1, w * 0.4 - 2, h * 0.9 - 2);
+		} else if (name == "flow") {
+			// a shallow pool fed by a jet from the upper left and drained in the lower right corner,
+			// which levels off at as many particles as the drain takes
+			emitBox(w * 0.5, h * 0.9 - 1, w * 0.5 - 2, h * 0.1 - 1, PDELTA, 0, 0);
+			addEmitter(EMITTER_SOURCE, COLLIDER_BOX, w * 0.1, h * 0.2, 2, 2, 16, 0.3, 0);
+			addEmitter(EMITTER_SINK, COLLIDER_BOX, w - 6, h - 5, 4, 3, 0, 0, 0);
+		} else {
+			// "center" and "stir" start from the default fill of initSimulation
+			const f32 isqrt2 = std::sqrt(0.5);
+			s.spawnBox(w * 0.5, h * 0.5, w * isqrt2, h * isqrt2);
+		}
+		if (name == "obstacles") {
+			// a no-slip box and a circle in the way of the wave, and a paddle that sweeps the floor
+			addCollider(COLLIDER_BOX, w * 0.6, h * 0.8, w * 0.05, h * 0.1, COLLIDER_NO_SLIP);
+			addCollider(COLLIDER_CIRCLE, w * 0.8, h * 0.5, h * 0.08, 0, 0);
+			addCollider(COLLIDER_CIRCLE, w * 0.5, h * 0.3, h * 0.06, 0, COLLIDER_MOVING);
+		}
+		resetIds();
+		setJitterSeed(0);
+	}
+
+	// pointer position and motion per base step, off the grid unless stirring
+	struct Pointer {
+		f32 x = -256;
+		f32 y = -256;
+		f32 dx = 0;
+		f32 dy = 0;
+	};
+
+	// the pointer of a frame. also moves the paddle of the obstacles scene
+	Pointer drive(const Scene& s, const std::string& name, i32 frameIndex) {
+		Pointer p;
+		if (name == "stir") {
+			// drag the pointer around a circle, one turn every two seconds
+			const f64 r = std::fmin(s.gridW, s.gridH) * 0.25;
+			const f64 omega = 2 * M_PI / 120;
+			const f64 t = frameIndex * omega;
+			p.x = s.gridW * 0.5 + r * std::cos(t);
+			p.y = s.gridH * 0.5 + r * std::sin(t);
+			p.dx = -r * omega * std::sin(t) / s.frameSteps;
+			p.dy = r * omega * std::cos(t) / s.frameSteps;
+		} else if (name == "obstacles") {
+			// the paddle (collider 2) swings left and right, one period every four seconds
+			const f64 omega = 2 * M_PI / 240;
+			setColliderVelocity(2, s.gridW * 0.3 * omega * std::cos(frameIndex * omega) / s.frameSteps, 0);
+		}
+		return p;
+	}
+
+	// returns the number of substeps taken
+	i32 frame(Scene& s, const std::string& name, i32 frameIndex, f64* phaseMs) {
+		const Pointer p = drive(s, name, frameIndex);
+
+		// what step() does: frameSteps base steps of time, in as many substeps as the engine picks
+		const i32 substeps = beginFrame(s.frameSteps);
+		const f32 dt = substepDt();
+		const auto e0 = Clock::now();
+		updateEmitters(s.frameSteps);
+		if (phaseMs) {
+			phaseMs[EMIT] += std::chrono::duration<f64, std::milli>(Clock::now() - e0).count();
+		}
+		for (i32 t = 0; t < substeps; t++) {
+			setGrid(s.gridW, s.gridH);
+
+			auto t0 = Clock::now();
+			transferMass();
+			auto t1 = Clock::now();
+			mirrorMass();
+			auto t2 = Clock::now();
+			applyPressure();
+			auto t3 = Clock::now();
+			mirrorPressure();
+			auto t4 = Clock::now();
+			updateGrid(0, GRAVITY * dt * dt, p.x, p.y, p.dx * dt, p.dy * dt, MOUSE_RADIUS);
+			auto t5 = Clock::now();
+			projectPressure();
+			auto t6 = Clock::now();
+			g2p();
+			auto t7 = Clock::now();
+
+			if (phaseMs) {
+				using ms = std::chrono::duration<f64, std::milli>;
+				phaseMs[TRANSFER] += ms(t1 - t0).count();
+				phaseMs[MIRROR] += ms(t2 - t1).count() + ms(t4 - t3).count();
+				phaseMs[PRESSURE] += ms(t3 - t2).count();
+				phaseMs[UPDATE_GRID] += ms(t5 - t4).count();
+				phaseMs[PROJECT] += ms(t6 - t5).count();
+				phaseMs[G2P] += ms(t7 - t6).count();
+			}
+
+			// add randomness to avoid particle clustering, as step() does
+			jitter(JITTER * dt);
+		}
+		endFrame();
+
+		auto t0 = Clock::now();
+		renderVertices(s.cellSize, s.pixelScale);
+		auto t1 = Clock::now();
+		if (s.textureW > 0) {
+			densityTexture(s.textureW, s.textureH, TEXTURE_U8);
+		}
+		if (phaseMs) {
+			using ms = std::chrono::duration<f64, std::milli>;
+			phaseMs[RENDER] += ms(t1 - t0).count();
+			phaseMs[TEXTURE] += ms(Clock::now() - t1).count();
+		}
+		return substeps;
+	}
+
+	void writeTrace(const Options& opt) {
+		const char* json = (const char*) traceJson();
+		if (!json)
+			return;
+		FILE* file = fopen(opt.trace.c_str(), "wb");
+		if (!file) {
+			fprintf(stderr, "cannot write %s\n", opt.trace.c_str());
+			exit(1);
+		}
+		fwrite(json, 1, traceJsonSize(), file);
+		fclose(file);
+	}
+
+	// reads the recording back and decodes every frame in order
+	void replay(const Scene& s, const Options& opt, Result& r) {
+		FILE* file = fopen(opt.record.c_str(), "rb");
+		if (!file)
+			return;
+		fseek(file, 0, SEEK_END);
+		r.recordBytes = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		const size_t read = fread((void*) playerBuffer((i32) r.recordBytes), 1, r.recordBytes, file);
+		fclose(file);
+		if ((i64) read != r.recordBytes || playerOpen() != opt.frames) {
+			fprintf(stderr, "%s is not a complete recording\n", opt.record.c_str());
+			exit(1);
+		}
+		auto t0 = Clock::now();
+		for (i32 f = 0; f < opt.frames; f++) {
+			playerFrame(f, s.cellSize, s.pixelScale);
+		}
+		r.replayMs = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count();
+	}
+
+	// the settings of a run, for the current simulation
+	void configure(i32 isa, const std::string& substeps, const std::string& stencil, i32 transfer,
+		i32 features, i32 pressure, const Options& opt) {
+		setThreads(opt.threads);
+		setSortPolicy(opt.sortInterval, opt.sortThreshold);
+		setKernelIsa(isa);
+		if (substeps == "adaptive") {
+			setAdaptiveSteps(opt.cfl, opt.minSubsteps, opt.maxSubsteps, opt.budgetMs);
+		} else {
+			setAdaptiveSteps(0, 1, 1, 0);
+		}
+		setFusedStencil(stencil == "fused");
+		if (!setTransferMode(transfer)) {
+			fprintf(stderr, "out of memory for the %s transfer\n", TRANSFER_NAMES[transfer]);
+			exit(1);
+		}
+		setFeatures(features);
+		setPressureSolver(pressure, 40, 0.02);
+	}
+
+	// steps opt.batch copies of the scene s of the initial simulation, the others created here with
+	// the same settings. fills in the totals of r and the state of the first copy
+	void runBatch(i32 isa, const std::string& substeps, const std::string& stencil, i32 transfer,
+		i32 features, i32 pressure, const std::string& name, const Options& opt, i32 scale, const Scene& s,
+		Result& r) {
+		std::vector<iptr> sims = {0};
+		for (i32 k = 1; k < opt.batch; k++) {
+			const iptr sim = simulationCreate();
+			if (!sim) {
+				fprintf(stderr, "out of memory for a batch of %d\n", opt.batch);
+				exit(1);
+			}
+			simulationSelect(sim);
+			configure(isa, substeps, stencil, transfer, features, pressure, opt);
+			Scene copy;
+			init(copy, name, opt, scale);
+			sims.push_back(sim);
+		}
+
+		setBatchThreads(opt.batchThreads);
+		std::vector<BatchStep> steps(opt.batch);
+		for (i32 f = 0; f < opt.warmup + opt.frames; f++) {
+			for (i32 k = 0; k < opt.batch; k++) {
+				simulationSelect(sims[k]);
+				setGrid(s.gridW, s.gridH);
+				const Pointer p = drive(s, name, f);
+				steps[k] = {sims[k], s.frameSteps, 0, GRAVITY, p.x, p.y, p.dx, p.dy, MOUSE_RADIUS, JITTER};
+			}
+			auto t0 = Clock::now();
+			stepBatch(steps.data(), opt.batch);
+			if (f >= opt.warmup) {
+				r.totalMs += std::chrono::duration<f64, std::milli>(Clock::now() - t0).count();
+				simulationSelect(0);
+				r.totalSubsteps += std::lround(s.frameSteps / substepDt());
+			}
+		}
+		for (i32 k = 1; k < opt.batch; k++) {
+			simulationDestroy(sims[k]);
+		}
+		simulationSelect(0);
+		r.particles = particleCount() * opt.batch;
+	}
+
+	// the state at the end of a run
+	void checksum(Result& r) {
+		const f32* posx = plane(P_POS_X);
+		const f32* posy = plane(P_POS_Y);
+		const i32 n = particleCount();
+		for (i32 i = 0; i < n; i++) {
+			r.checksum += posx[i] + posy[i];
+		}
+		r.disorder = disorder();
+		r.activity = gridActivity();
+		r.maxSpeed = maxSpeed();
+	}
+
+	// what a rank of runRanks() hands back. the particles, checksum, disorder and activity are
+	// those of all ranks
+	struct RankReport {
+		bool ok;
+		f64 totalMs;
+		f64 exchangeMs;
+		i64 migrated;
+		i64 bytesSent;
+		i32 particles;
+		f64 checksum;
+		f32 disorder;
+		f32 activity;
+		f32 maxSpeed;
+		f64 storageBytes;
+	};
+
+	// one rank of runRanks(), in a child process. it sets up a simulation of its own, as the
+	// workers of the parent's don't survive the fork
+	RankReport stepRank(i32 isa, const std::string& substeps, const std::string& stencil, i32 transfer,
+		i32 features, i32 pressure, const std::string& name, const Options& opt, i32 scale, i32 rank,
+		i32 ranks, const char* shm) {
+		RankReport report = {};
+		simulationSelect(simulationCreate());
+		configure(isa, substeps, stencil, transfer, features, pressure, opt);
+		Scene s;
+		init(s, name, opt, scale);
+		ShmTransport transport(shm, rank, ranks);
+		Domain domain(transport, s.gridW, s.gridH);
+		if (!simulation() || !transport.ok() || !domain.ok())
+			return report;
+		domain.adopt();
+
+		for (i32 f = 0; f < opt.warmup + opt.frames; f++) {
+			if (f == opt.warmup) {
+				domain.exchangeMs = 0;
+				domain.bytesSent = 0;
+				domain.migrated = 0;
+			}
+			const Pointer p = drive(s, name, f);
+			auto t0 = Clock::now();
+			if (!domain.step(s.frameSteps, 0, GRAVITY, p.x, p.y, p.dx, p.dy, MOUSE_RADIUS, JITTER))
+				return report;
+			renderVertices(s.cellSize, s.pixelScale);
+			if (s.textureW > 0) {
+				densityTexture(s.textureW, s.textureH, TEXTURE_U8);
+			}
+			if (f >= opt.warmup) {
+				report.totalMs += std::chrono::duration<f64, std::milli>(Clock::now() - t0).count();
+			}
+		}
+
+		Result local = {};
+		checksum(local);
+		const i32 n = particleCount();
+		local.checksum += (f64) domain.rowOrigin() * n; // the positions are the strip's
+		f64 particles;
+		f64 disorder;
+		f64 activity;
+		if (!domain.sum(n, particles) || !domain.sum(local.checksum, report.checksum) ||
+			!domain.sum(local.disorder * n, disorder) || !domain.sum(local.activity, activity))
+			return report;
+		report.ok = true;
+		report.exchangeMs = domain.exchangeMs;
+		report.migrated = domain.migrated;
+		report.bytesSent = domain.bytesSent;
+		report.particles = (i32) particles;
+		report.disorder = (f32) (disorder / std::max(report.particles, 1));
+		report.activity = (f32) activity;
+		report.maxSpeed = local.maxSpeed;
+		report.storageBytes = storageBytes();
+		return report;
+	}
+
+	// steps the scene split into strips on ranks child processes and fills in the totals of r, the
+	// time being that of the slowest rank
+	void runRanks(i32 isa, const std::string& substeps, const std::string& stencil, i32 transfer,
+		i32 features, i32 pressure, const std::string& name, const Options& opt, i32 scale, i32 ranks,
+		Result& r) {
+		RankReport* reports = (RankReport*) mmap(nullptr, sizeof(RankReport) * ranks,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (reports == MAP_FAILED) {
+			fprintf(stderr, "out of memory for %d ranks\n", ranks);
+			exit(1);
+		}
+		const std::string shm = "/water_bench_" + std::to_string(getpid());
+		std::vector<pid_t> children;
+		for (i32 k = 0; k < ranks; k++) {
+			const pid_t pid = fork();
+			if (pid < 0) {
+				fprintf(stderr, "cannot start rank %d\n", k);
+				exit(1);
+			}
+			if (pid == 0) {
+				reports[k] = stepRank(isa, substeps, stencil, transfer, features, pressure, name, opt, scale,
+					k, ranks, shm.c_str());
+				_exit(0);
+			}
+			children.push_back(pid);
+		}
+		bool ok = true;
+		for (pid_t pid : children) {
+			int status;
+			ok &= waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		}
+		shm_unlink(shm.c_str());
+		for (i32 k = 0; k < ranks; k++) {
+			const RankReport& report = reports[k];
+			ok &= report.ok;
+			r.totalMs = std::max(r.totalMs, report.totalMs);
+			r.exchangeMs = std::max(r.exchangeMs, report.exchangeMs);
+			r.migrated += report.migrated;
+			r.exchangeBytes += report.bytesSent;
+			r.maxSpeed = std::max(r.maxSpeed, report.maxSpeed);
+			r.storageBytes = std::max(r.storageBytes, report.storageBytes);
+		}
+		if (!ok) {
+			fprintf(stderr, "a rank of %s failed with %d ranks\n", name.c_str(), ranks);
+			exit(1);
+		}
+		r.particles = reports[0].particles;
+		r.checksum = reports[0].checksum;
+		r.disorder = reports[0].disorder;
+		r.activity = reports[0].activity;
+		r.totalSubsteps = (i64) opt.frameSteps * opt.frames;
+		munmap(reports, sizeof(RankReport) * ranks);
+	}
+
+	Result run(i32 isa, const std::string& substeps, const std::string& stencil, i32 transfer,
+		i32 features, i32 pressure, const std::string& name, const Options& opt, i32 scale, i32 ranks) {
+		configure(isa, substeps, stencil, transfer, features, pressure, opt);
+		Scene s;
+		init(s, name, opt, scale);
+
+		Result r = {};
+		r.isa = isa;
+		r.substeps = substeps;
+		r.stencil = stencil;
+		r.transfer = transfer;
+		r.features = features;
+		r.pressure = pressure;
+		r.ranks = ranks;
+		r.scene = name;
+		r.scale = scale;
+		r.cellSize = s.cellSize;
+		r.gridW = s.gridW;
+		r.gridH = s.gridH;
+		if (ranks > 1) {
+			runRanks(isa, substeps, stencil, transfer, features, pressure, name, opt, scale, ranks, r);
+			return r;
+		}
+		if (opt.batch > 1) {
+			runBatch(isa, substeps, stencil, transfer, features, pressure, name, opt, scale, s, r);
+			checksum(r);
+			r.storageBytes = storageBytes();
+			return r;
+		}
+
+		i32 f = 0;
+		for (; f < opt.warmup; f++) {
+			frame(s, name, f, nullptr);
+		}
+		FILE* file = nullptr;
+		if (!opt.record.empty()) {
+			file = fopen(opt.record.c_str(), "wb");
+			if (!file) {
+				fprintf(stderr, "cannot write %s\n", opt.record.c_str());
+				exit(1);
+			}
+			recordStart(s.gridW, s.gridH, CHUNK_FRAMES);
+		}
+		if (!opt.trace.empty()) {
+			const i32 substeps = std::max(opt.maxSubsteps, opt.frameSteps);
+			traceStart(opt.frames * (substeps * TRACE_EVENTS_PER_SUBSTEP + 1));
+		}
+		for (; f < opt.warmup + opt.frames; f++) {
+			r.totalSubsteps += frame(s, name, f, r.phaseMs);
+			if (file) {
+				auto t0 = Clock::now();
+				if (recordFrame() > 0) {
+					fwrite((const void*) recordData(), 1, recordSize(), file);
+					recordDrain();
+				}
+				r.recordMs += std::chrono::duration<f64, std::milli>(Clock::now() - t0).count();
+			}
+		}
+		if (!opt.trace.empty()) {
+			traceStop();
+			writeTrace(opt);
+		}
+		if (const Stats* counters = (const Stats*) stats()) {
+			r.hasStats = true;
+			r.stats = *counters;
+		}
+		if (file) {
+			recordStop();
+			fwrite((const void*) recordData(), 1, recordSize(), file);
+			recordDrain();
+			fclose(file);
+			replay(s, opt, r);
+		}
+		for (f64 ms : r.phaseMs) {
+			r.totalMs += ms;
+		}
+
+		r.particles = particleCount();
+		r.transfer = transferMode(); // the scatter if the mode fell back
+		r.storageBytes = storageBytes();
+		checksum(r);
+		return r;
+	}
+
+	void printStats(const Stats& s) {
+		printf("      \"stats\": {\"activeCells\": %d, \"density\": [%.4f, %.4f], ", s.activeCells,
+			s.minDensity, s.maxDensity);
+		printf("\"solverIterations\": %d, \"solverResidual\": %.4f, \"unconvergedSolves\": %d, ",
+			s.solverIterations, s.solverResidual, s.unconvergedSolves);
+		printf("\"particlesPerCell\": [");
+		for (i32 b = 0; b < STAT_HISTOGRAM_BINS; b++) {
+			printf("%s%d", b == 0 ? "" : ", ", s.histogram[b]);
+		}
+		printf("]},\n");
+	}
+
+	void print(const Options& opt, const std::vector<Result>& results) {
+		printf("{\n");
+		printf("  \"width\": %d,\n", opt.width);
+		printf("  \"height\": %d,\n", opt.height);
+		printf("  \"dpr\": %g,\n", opt.dpr);
+		printf("  \"frames\": %d,\n", opt.frames);
+		printf("  \"frameSteps\": %d,\n", opt.frameSteps);
+		printf("  \"threads\": %d,\n", threads());
+		printf("  \"sortInterval\": %d,\n", opt.sortInterval);
+		printf("  \"sortThreshold\": %g,\n", opt.sortThreshold);
+		printf("  \"batch\": %d,\n", opt.batch);
+		printf("  \"batchThreads\": %d,\n", opt.batchThreads);
+		printf("  \"results\": [\n");
+		for (size_t i = 0; i < results.size(); i++) {
+			const Result& r = results[i];
+			const f64 steps = (f64) r.totalSubsteps;
+			printf("    {\n");
+			printf("      \"isa\": \"%s\",\n", ISA_NAMES[r.isa]);
+			printf("      \"substeps\": \"%s\",\n", r.substeps.c_str());
+			printf("      \"stencil\": \"%s\",\n", r.stencil.c_str());
+			printf("      \"transfer\": \"%s\",\n", TRANSFER_NAMES[r.transfer]);
+			printf("      \"aeration\": %s,\n", r.features & FEATURE_AERATION ? "true" : "false");
+			printf("      \"pressure\": \"%s\",\n", PRESSURE_NAMES[r.pressure]);
+			printf("      \"ranks\": %d,\n", r.ranks);
+			printf("      \"scene\": \"%s\",\n", r.scene.c_str());
+			printf("      \"scale\": %d,\n", r.scale);
+			printf("      \"cellSize\": %.4f,\n", r.cellSize);
+			printf("      \"grid\": [%d, %d],\n", r.gridW, r.gridH);
+			printf("      \"particles\": %d,\n", r.particles);
+			if (opt.batch == 1 && r.ranks == 1) {
+				printf("      \"phaseMsPerFrame\": {");
+				for (i32 p = 0; p < NUM_PHASES; p++) {
+					printf("%s\"%s\": %.4f", p == 0 ? "" : ", ", PHASE_NAMES[p], r.phaseMs[p] / opt.frames);
+				}
+				printf("},\n");
+			}
+			printf("      \"msPerFrame\": %.4f,\n", r.totalMs / opt.frames);
+			printf("      \"storageMBPerRank\": %.2f,\n", r.storageBytes / (1 << 20));
+			printf("      \"substepsPerFrame\": %.3f,\n", steps / opt.frames);
+			printf("      \"particlesPerSecond\": %.0f,\n", r.particles * steps / (r.totalMs * 1e-3));
+			printf("      \"maxSpeed\": %.4f,\n", r.maxSpeed);
+			printf("      \"disorder\": %.4f,\n", r.disorder);
+			printf("      \"activeBlocks\": %.4f,\n", r.activity);
+			if (r.ranks > 1) {
+				printf("      \"exchangeMsPerFrame\": %.4f,\n", r.exchangeMs / opt.frames);
+				printf("      \"exchangeBytesPerFrame\": %.0f,\n", (f64) r.exchangeBytes / opt.frames);
+				printf("      \"migratedPerFrame\": %.2f,\n", (f64) r.migrated / opt.frames);
+			}
+			if (!opt.record.empty()) {
+				printf("      \"recordMsPerFrame\": %.4f,\n", r.recordMs / opt.frames);
+				printf("      \"recordBytesPerFrame\": %.0f,\n", (f64) r.recordBytes / opt.frames);
+				printf("      \"replayMsPerFrame\": %.4f,\n", r.replayMs / opt.frames);
+			}
+			if (r.hasStats) {
+				printStats(r.stats);
+			}
+			printf("      \"checksum\": %.6f\n", r.checksum);
+			printf("    }%s\n", i + 1 < results.size() ? "," : "");
+		}
+		printf("  ]\n");
+		printf("}\n");
+	}
+
+	// whether Domain can split the scene set up with these settings (Domain::supported())
+	bool rankable(i32 isa, const std::string& substeps, const std::string& stencil, i32 transfer,
+		i32 features, i32 pressure, const std::string& scene, const Options& opt, i32 scale, i32 ranks) {
+		if (ranks == 1)
+			return true;
+		configure(isa, substeps, stencil, transfer, features, pressure, opt);
+		Scene s;
+		init(s, scene, opt, scale);
+		if (Domain::supported())
+			return true;
+		fprintf(stderr, "%s %s %s with %d ranks is not supported, skipped\n", substeps.c_str(),
+			PRESSURE_NAMES[pressure], scene.c_str(), ranks);
+		return false;
+	}
+
+	[[noreturn]] void usage() {
+		fprintf(stderr,
+			"usage: water_bench [--width W] [--height H] [--dpr R] [--frames N] [--warmup N]\n"
+			"                   [--scene center|dambreak|stir|obstacles|flow|all] [--scale 12|8|6|4|all]\n"
+			"                   [--threads N] [--sort-interval K] [--sort-threshold D]\n"
+			"                   [--stencil cached|fused|all] [--isa simd128|avx2|avx512|all]\n"
+			"                   [--record FILE] [--substeps fixed|adaptive|all] [--cfl C]\n"
+			"                   [--min-substeps N] [--max-substeps N] [--budget MS] [--trace FILE]\n"
+			"                   [--transfer scatter|gather|fixed|all] [--batch N] [--batch-threads N]\n"
+			"                   [--aeration on|off|all] [--ranks N|all] [--texture PIXELS]\n"
+			"                   [--pressure eos|project|all] [--frame-steps N]\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char** argv) {
+	Options opt;
+	for (i32 i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (i + 1 >= argc)
+			usage();
+		const char* val = argv[++i];
+		if (arg == "--width") {
+			opt.width = atoi(val);
+		} else if (arg == "--height") {
+			opt.height = atoi(val);
+		} else if (arg == "--dpr") {
+			opt.dpr = atof(val);
+		} else if (arg == "--frames") {
+			opt.frames = atoi(val);
+		} else if (arg == "--warmup") {
+			opt.warmup = atoi(val);
+		} else if (arg == "--threads") {
+			opt.threads = atoi(val);
+		} else if (arg == "--sort-interval") {
+			opt.sortInterval = atoi(val);
+		} else if (arg == "--sort-threshold") {
+			opt.sortThreshold = atof(val);
+		} else if (arg == "--stencil") {
+			if (strcmp(val, "all") == 0)
+				opt.stencils = {"cached", "fused"};
+			else
+				opt.stencils = {val};
+		} else if (arg == "--transfer") {
+			opt.transfers.clear();
+			for (i32 mode = TRANSFER_SCATTER; mode <= TRANSFER_FIXED; mode++) {
+				if (strcmp(val, "all") == 0 || strcmp(val, TRANSFER_NAMES[mode]) == 0) {
+					opt.transfers.push_back(mode);
+				}
+			}
+			if (opt.transfers.empty())
+				usage();
+		} else if (arg == "--aeration") {
+			if (strcmp(val, "on") == 0)
+				opt.featureSets = {FEATURE_ALL};
+			else if (strcmp(val, "off") == 0)
+				opt.featureSets = {FEATURE_ALL & ~FEATURE_AERATION};
+			else if (strcmp(val, "all") == 0)
+				opt.featureSets = {FEATURE_ALL, FEATURE_ALL & ~FEATURE_AERATION};
+			else
+				usage();
+		} else if (arg == "--isa") {
+			opt.isas.clear();
+			for (i32 isa = ISA_SIMD128; isa <= ISA_AVX512; isa++) {
+				if (strcmp(val, "all") == 0 || strcmp(val, ISA_NAMES[isa]) == 0) {
+					opt.isas.push_back(isa);
+				}
+			}
+			if (opt.isas.empty())
+				usage();
+		} else if (arg == "--substeps") {
+			if (strcmp(val, "all") == 0)
+				opt.substeps = {"fixed", "adaptive"};
+			else
+				opt.substeps = {val};
+		} else if (arg == "--cfl") {
+			opt.cfl = atof(val);
+		} else if (arg == "--min-substeps") {
+			opt.minSubsteps = atoi(val);
+		} else if (arg == "--max-substeps") {
+			opt.maxSubsteps = atoi(val);
+		} else if (arg == "--budget") {
+			opt.budgetMs = atof(val);
+		} else if (arg == "--batch") {
+			opt.batch = atoi(val);
+		} else if (arg == "--batch-threads") {
+			opt.batchThreads = atoi(val);
+		} else if (arg == "--ranks") {
+			if (strcmp(val, "all") == 0)
+				opt.ranks = {1, 2, 4};
+			else
+				opt.ranks = {atoi(val)};
+		} else if (arg == "--texture") {
+			opt.texturePixels = atoi(val);
+		} else if (arg == "--pressure") {
+			opt.pressures.clear();
+			for (i32 solver = PRESSURE_EOS; solver <= PRESSURE_PROJECT; solver++) {
+				if (strcmp(val, "all") == 0 || strcmp(val, PRESSURE_NAMES[solver]) == 0) {
+					opt.pressures.push_back(solver);
+				}
+			}
+			if (opt.pressures.empty())
+				usage();
+		} else if (arg == "--frame-steps") {
+			opt.frameSteps = atoi(val);
+		} else if (arg == "--record") {
+			opt.record = val;
+		} else if (arg == "--trace") {
+			opt.trace = val;
+		} else if (arg == "--scene") {
+			if (strcmp(val, "all") != 0)
+				opt.scenes = {val};
+		} else if (arg == "--scale") {
+			if (strcmp(val, "all") != 0)
+				opt.scales = {atoi(val)};
+		} else {
+			usage();
+		}
+	}
+	if (opt.width <= 0 || opt.height <= 0 || opt.frames <= 0 || opt.warmup < 0 || opt.threads <= 0 ||
+		opt.batch <= 0 || opt.batchThreads <= 0 || opt.texturePixels < 0 || opt.frameSteps <= 0 ||
+		*std::min_element(opt.ranks.begin(), opt.ranks.end()) <= 0)
+		usage();
+	// ranks only time whole frames
+	if (*std::max_element(opt.ranks.begin(), opt.ranks.end()) > 1 &&
+		(opt.batch > 1 || !opt.record.empty() || !opt.trace.empty()))
+		usage();
+	setThreads(opt.threads);
+
+	std::vector<Result> results;
+	for (i32 isa : opt.isas) {
+		if (setKernelIsa(isa) != isa) {
+			fprintf(stderr, "%s is not supported here, skipped\n", ISA_NAMES[isa]);
+			continue;
+		}
+		for (const std::string& substeps : opt.substeps) {
+			if (substeps != "fixed" && substeps != "adaptive")
+				usage();
+			for (const std::string& stencil : opt.stencils) {
+				if (stencil != "cached" && stencil != "fused")
+					usage();
+				for (i32 transfer : opt.transfers) {
+					for (i32 features : opt.featureSets) {
+						for (i32 pressure : opt.pressures) {
+							for (const std::string& scene : opt.scenes) {
+								if (scene != "center" && scene != "dambreak" && scene != "stir" &&
+									scene != "obstacles" && scene != "flow")
+									usage();
+								for (i32 scale : opt.scales) {
+									if (scale <= 0)
+										usage();
+									for (i32 ranks : opt.ranks) {
+										if (!rankable(isa, substeps, stencil, transfer, features, pressure,
+												scene, opt, scale, ranks))
+											continue;
+										results.push_back(run(isa, substeps, stencil, transfer, features,
+											pressure, scene, opt, scale, ranks));
+									}
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+	print(opt, results);
+	return 0;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "wasm.h"
+
+#ifdef __wasm__
+#include <stdlib.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// one contiguous block that buffers are carved out of. natively the block is an
+// anonymous mapping, so pages are only committed once touched; on wasm it comes from
+// the heap, which grows the linear memory (memory.grow) as needed
+class Arena {
+public:
+	static constexpr size_t ALIGN = 64;
+
+	Arena() = default;
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	~Arena() {
+		release();
+	}
+
+	// bytes taken by count Ts, including the padding to the next buffer
+	template <class T>
+	static size_t footprint(size_t count) {
+		return (count * sizeof(T) + ALIGN - 1) & ~(ALIGN - 1);
+	}
+
+	// replaces the block with an empty one of the given size, false if out of memory
+	bool init(size_t bytes) {
+		release();
+		if (bytes == 0)
+			return true;
+#ifdef __wasm__
+		void* p = aligned_alloc(ALIGN, bytes);
+		if (!p)
+			return false;
+#else
+		void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return false;
+#endif
+		base = (u8*) p;
+		size = bytes;
+		return true;
+	}
+
+	void release() {
+		if (!base)
+			return;
+#ifdef __wasm__
+		free(base);
+#else
+		munmap(base, size);
+#endif
+		base = nullptr;
+		size = 0;
+		used = 0;
+	}
+
+	// the size of the block
+	size_t bytes() const {
+		return size;
+	}
+
+	void swap(Arena& a) {
+		u8* b = base;
+		size_t s = size;
+		size_t u = used;
+		base = a.base;
+		size = a.size;
+		used = a.used;
+		a.base = b;
+		a.size = s;
+		a.used = u;
+	}
+
+	// the next count Ts of the block; the caller sized the block with footprint()
+	template <class T>
+	T* take(size_t count) {
+		T* p = (T*) (base + used);
+		used += footprint<T>(count);
+		return p;
+	}
+
+private:
+	u8* base = nullptr;
+	size_t size = 0;
+	size_t used = 0;
+};
@@ -0,0 +1,262 @@
+// stepping on a thread of its own, one per simulation. the host queues one input per frame and
+// takes the newest finished frame from a triple buffer of vertex snapshots, so neither side waits
+// for the other.
+// without WATER_THREADS the inputs are stepped in the call that queues them, and the vertices
+// aren't copied
+#include "water.h"
+#include "arena.h"
+#include <atomic>
+#include <cstring>
+#include <new>
+
+#ifdef WATER_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace {
+	// arguments of one step() call and of the renderVertices() after it
+	struct Input {
+		i32 gridW;
+		i32 gridH;
+		i32 substeps;
+		f32 gravityX;
+		f32 gravityY;
+		f32 mouseX;
+		f32 mouseY;
+		f32 dmouseX;
+		f32 dmouseY;
+		f32 radius;
+		f32 jitter;
+		f32 scale;
+		f32 pixelScale;
+	};
+
+	constexpr u32 QUEUE_SIZE = 8; // a power of two
+
+	// single producer (the host) and single consumer (the stepping thread)
+	struct InputQueue {
+		Input slots[QUEUE_SIZE];
+		std::atomic<u32> head{0}; // next to pop, written by the consumer
+		std::atomic<u32> tail{0}; // next to push, written by the producer
+
+		bool push(const Input& in) {
+			const u32 t = tail.load(std::memory_order_relaxed);
+			if (t - head.load(std::memory_order_acquire) == QUEUE_SIZE)
+				return false;
+			slots[t & (QUEUE_SIZE - 1)] = in;
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool pop(Input& out) {
+			const u32 h = head.load(std::memory_order_relaxed);
+			if (h == tail.load(std::memory_order_acquire))
+				return false;
+			out = slots[h & (QUEUE_SIZE - 1)];
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+
+		i32 size() const {
+			return (i32) (tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire));
+		}
+	};
+
+	struct Snapshot {
+		Arena arena;
+		f32* vertices = nullptr;
+		i32 cap = 0;
+		i32 numP = 0;
+		i32 frame = 0;
+	};
+
+	// the writer fills back and swaps it with middle; the reader swaps front with middle
+	// whenever middle holds a frame it hasn't seen. each snapshot has one owner at a time
+	struct TripleBuffer {
+		static constexpr i32 FRESH = 4; // set in middle by the writer, cleared by the reader
+
+		Snapshot snapshots[3];
+		i32 back = 0; // owned by the writer
+		i32 front = 1; // owned by the reader
+		std::atomic<i32> middle{2};
+
+		void publish() {
+			back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & 3;
+		}
+
+		Snapshot& latest() {
+			if (middle.load(std::memory_order_relaxed) & FRESH) {
+				front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+			}
+			return snapshots[front];
+		}
+	};
+
+	// the state of one simulation between asyncStart() and asyncStop(), so that simulations step
+	// asynchronously side by side
+	struct Async {
+		InputQueue queue;
+		TripleBuffer buffer;
+		i32 frames = 0; // stepped since asyncStart()
+		iptr owner = 0; // the simulation current in asyncStart()
+		Async* next = nullptr;
+#ifdef WATER_THREADS
+		std::thread stepper;
+		std::mutex mutex; // only guards the sleep of the stepper, never the data
+		std::condition_variable wake;
+		std::atomic<bool> quit{false}; // checked before every input, so asyncStop() drops the queued ones
+#endif
+	};
+
+	Async* running = nullptr; // a list of them, one per owner
+#ifdef WATER_THREADS
+	std::mutex runningMutex; // guards the list, which hosts on different threads may change
+#endif
+
+	// the state of the current simulation, null if it isn't running; unlinks it with unlink set
+	Async* find(bool unlink) {
+		const iptr owner = simulation();
+#ifdef WATER_THREADS
+		std::lock_guard<std::mutex> lock(runningMutex);
+#endif
+		for (Async** a = &running; *a; a = &(*a)->next) {
+			Async* const found = *a;
+			if (found->owner != owner)
+				continue;
+			if (unlink) {
+				*a = found->next;
+			}
+			return found;
+		}
+		return nullptr;
+	}
+
+	void advance(Async& a, const Input& in) {
+		setGrid(in.gridW, in.gridH);
+		step(in.substeps, in.gravityX, in.gravityY, in.mouseX, in.mouseY, in.dmouseX, in.dmouseY, in.radius,
+			in.jitter);
+		a.frames++;
+
+		f32* vertices = (f32*) renderVertices(in.scale, in.pixelScale);
+		const i32 numP = particleCount();
+#ifndef WATER_THREADS
+		// stepped inline: the host reads these before it queues the next frame, so it can have the
+		// vertices of renderVertices itself
+		Snapshot& front = a.buffer.snapshots[a.buffer.front];
+		front.vertices = vertices;
+		front.numP = numP;
+		front.frame = a.frames;
+#else
+		Snapshot& s = a.buffer.snapshots[a.buffer.back];
+		if (numP > s.cap) {
+			const i32 cap = numP + (numP >> 1);
+			if (!s.arena.init(Arena::footprint<f32>(4 * cap)))
+				return;
+			s.vertices = s.arena.take<f32>(4 * cap);
+			s.cap = cap;
+		}
+		if (numP > 0) {
+			memcpy(s.vertices, vertices, 4 * numP * sizeof(f32));
+		}
+		s.numP = numP;
+		s.frame = a.frames;
+		a.buffer.publish();
+#endif
+	}
+
+#ifdef WATER_THREADS
+	void work(Async* a) {
+		simulationSelect(a->owner);
+		Input in;
+		while (!a->quit.load(std::memory_order_acquire)) {
+			if (a->queue.pop(in)) {
+				advance(*a, in);
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(a->mutex);
+			a->wake.wait(lock, [a] {
+				return a->quit.load(std::memory_order_relaxed) || a->queue.size() > 0;
+			});
+		}
+	}
+#endif
+}
+
+WASM_EXPORT i32 asyncStart() {
+	if (find(false))
+		return 1;
+	Async* const a = new (std::nothrow) Async();
+	if (!a)
+		return -1;
+	a->owner = simulation();
+#ifdef WATER_THREADS
+	a->stepper = std::thread(work, a);
+#endif
+	{
+#ifdef WATER_THREADS
+		std::lock_guard<std::mutex> lock(runningMutex);
+#endif
+		a->next = running;
+		running = a;
+	}
+#ifdef WATER_THREADS
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+WASM_EXPORT void asyncStop() {
+	Async* const a = find(true);
+	if (!a)
+		return;
+#ifdef WATER_THREADS
+	{
+		std::lock_guard<std::mutex> lock(a->mutex);
+		a->quit.store(true, std::memory_order_release);
+	}
+	a->wake.notify_one();
+	a->stepper.join();
+#endif
+	delete a;
+}
+
+WASM_EXPORT i32 asyncInput(i32 gridW, i32 gridH, i32 substeps, f32 gravityX, f32 gravityY, f32 mouseX,
+	f32 mouseY, f32 dmouseX, f32 dmouseY, f32 radius, f32 jitter, f32 scale, f32 pixelScale) {
+	Async* const a = find(false);
+	if (!a)
+		return -1;
+	const Input in = {
+		gridW, gridH, substeps, gravityX, gravityY, mouseX, mouseY, dmouseX, dmouseY, radius, jitter, scale,
+		pixelScale};
+#ifdef WATER_THREADS
+	if (!a->queue.push(in))
+		return -1;
+	{
+		// pairs with the check in work(), so the wakeup can't fall between it and the wait
+		std::lock_guard<std::mutex> lock(a->mutex);
+	}
+	a->wake.notify_one();
+	return a->queue.size();
+#else
+	advance(*a, in);
+	return 0;
+#endif
+}
+
+WASM_EXPORT iptr asyncVertices() {
+	Async* const a = find(false);
+	return a ? ptr(a->buffer.latest().vertices) : 0;
+}
+
+WASM_EXPORT i32 asyncNumP() {
+	Async* const a = find(false);
+	return a ? a->buffer.snapshots[a->buffer.front].numP : 0;
+}
+
+WASM_EXPORT i32 asyncFrame() {
+	Async* const a = find(false);
+	return a ? a->buffer.snapshots[a->buffer.front].frame : 0;
+}
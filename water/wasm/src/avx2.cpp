@@ -0,0 +1,166 @@
+// 8-lane kernels, built with -mavx2 and only called when the CPU has it
+#include "wide.h"
+#include <immintrin.h>
+
+namespace {
+	struct Avx2 {
+		static constexpr i32 LANES = 8;
+		using F = __m256;
+		using I = __m256i;
+		using M = __m256; // all ones in the true lanes
+
+		static F load(const f32* p) {
+			return _mm256_loadu_ps(p);
+		}
+
+		static void store(f32* p, F a) {
+			_mm256_storeu_ps(p, a);
+		}
+
+		static void storei(i32* p, I a) {
+			_mm256_storeu_si256((I*) p, a);
+		}
+
+		static F splat(f32 a) {
+			return _mm256_set1_ps(a);
+		}
+
+		static I splati(i32 a) {
+			return _mm256_set1_epi32(a);
+		}
+
+		static I iota() {
+			return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		}
+
+		static F add(F a, F b) {
+			return _mm256_add_ps(a, b);
+		}
+
+		static F sub(F a, F b) {
+			return _mm256_sub_ps(a, b);
+		}
+
+		static F mul(F a, F b) {
+			return _mm256_mul_ps(a, b);
+		}
+
+		static F div(F a, F b) {
+			return _mm256_div_ps(a, b);
+		}
+
+		static F min(F a, F b) {
+			return _mm256_min_ps(a, b);
+		}
+
+		static F max(F a, F b) {
+			return _mm256_max_ps(a, b);
+		}
+
+		static F sqrt(F a) {
+			return _mm256_sqrt_ps(a);
+		}
+
+		static F floor(F a) {
+			return _mm256_floor_ps(a);
+		}
+
+		static F neg(F a) {
+			return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f));
+		}
+
+		static I trunc(F a) {
+			return _mm256_cvttps_epi32(a);
+		}
+
+		static F convert(I a) {
+			return _mm256_cvtepi32_ps(a);
+		}
+
+		static I iadd(I a, I b) {
+			return _mm256_add_epi32(a, b);
+		}
+
+		static I isub(I a, I b) {
+			return _mm256_sub_epi32(a, b);
+		}
+
+		static I imul(I a, I b) {
+			return _mm256_mullo_epi32(a, b);
+		}
+
+		static I iand(I a, I b) {
+			return _mm256_and_si256(a, b);
+		}
+
+		static I ishr(I a, i32 b) {
+			return _mm256_srai_epi32(a, b);
+		}
+
+		static M gt(F a, F b) {
+			return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+		}
+
+		static M lt(F a, F b) {
+			return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+		}
+
+		static M ilt(I a, I b) {
+			return _mm256_castsi256_ps(_mm256_cmpgt_epi32(b, a));
+		}
+
+		// a in the true lanes, zero elsewhere
+		static F select(F a, M m) {
+			return _mm256_and_ps(a, m);
+		}
+
+		static F gather(const f32* base, I idx) {
+			return _mm256_i32gather_ps(base, idx, 4);
+		}
+
+		// one block row
+		static F loadRows(const f32* p, i32, i32) {
+			return _mm256_load_ps(p);
+		}
+
+		static void storeRows(f32* p, i32, i32, F a) {
+			_mm256_store_ps(p, a);
+		}
+
+		// the sums go through memory one lane at a time, quad by quad in the order of the 4-lane
+		// kernels, so lanes sharing cells need no care and the results match those kernels exactly
+		template <i32 N>
+		struct Scatter {
+			Scatter(f32* const* planes, I c00, const i32* offsets) : planes(planes), offsets(offsets) {
+				_mm256_store_si256((I*) cells, c00);
+			}
+
+			void add(i32 k, const F* fields) {
+				for (i32 f = 0; f < N; f++) {
+					_mm256_store_ps(values[k][f], fields[f]);
+				}
+			}
+
+			void flush() {
+				for (i32 q = 0; q < LANES; q += 4) {
+					for (i32 k = 0; k < 9; k++) {
+						for (i32 l = q; l < q + 4; l++) {
+							const i32 c = cells[l] + offsets[k];
+							for (i32 f = 0; f < N; f++) {
+								planes[f][c] += values[k][f][l];
+							}
+						}
+					}
+				}
+			}
+
+			f32* const* planes;
+			const i32* offsets;
+			alignas(32) i32 cells[LANES]; // c00
+			alignas(32) f32 values[9][N][LANES];
+		};
+	};
+}
+
+extern const WideKernels avx2Kernels[NUM_FEATURE_SETS] = {
+	wideKernels<Avx2, 0>(), wideKernels<Avx2, FEATURE_AERATION>()};
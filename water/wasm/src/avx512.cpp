@@ -0,0 +1,187 @@
+// 16-lane kernels, built with -mavx512f -mavx512cd and only called when the CPU has both
+#include "wide.h"
+#include <immintrin.h>
+
+namespace {
+	struct Avx512 {
+		static constexpr i32 LANES = 16;
+		using F = __m512;
+		using I = __m512i;
+		using M = __mmask16;
+
+		static F load(const f32* p) {
+			return _mm512_loadu_ps(p);
+		}
+
+		static void store(f32* p, F a) {
+			_mm512_storeu_ps(p, a);
+		}
+
+		static void storei(i32* p, I a) {
+			_mm512_storeu_si512(p, a);
+		}
+
+		static F splat(f32 a) {
+			return _mm512_set1_ps(a);
+		}
+
+		static I splati(i32 a) {
+			return _mm512_set1_epi32(a);
+		}
+
+		static I iota() {
+			return _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		}
+
+		static F add(F a, F b) {
+			return _mm512_add_ps(a, b);
+		}
+
+		static F sub(F a, F b) {
+			return _mm512_sub_ps(a, b);
+		}
+
+		static F mul(F a, F b) {
+			return _mm512_mul_ps(a, b);
+		}
+
+		static F div(F a, F b) {
+			return _mm512_div_ps(a, b);
+		}
+
+		static F min(F a, F b) {
+			return _mm512_min_ps(a, b);
+		}
+
+		static F max(F a, F b) {
+			return _mm512_max_ps(a, b);
+		}
+
+		static F sqrt(F a) {
+			return _mm512_sqrt_ps(a);
+		}
+
+		static F floor(F a) {
+			return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+		}
+
+		static F neg(F a) {
+			return _mm512_castsi512_ps(
+				_mm512_xor_si512(_mm512_castps_si512(a), _mm512_set1_epi32(0x80000000)));
+		}
+
+		static I trunc(F a) {
+			return _mm512_cvttps_epi32(a);
+		}
+
+		static F convert(I a) {
+			return _mm512_cvtepi32_ps(a);
+		}
+
+		static I iadd(I a, I b) {
+			return _mm512_add_epi32(a, b);
+		}
+
+		static I isub(I a, I b) {
+			return _mm512_sub_epi32(a, b);
+		}
+
+		static I imul(I a, I b) {
+			return _mm512_mullo_epi32(a, b);
+		}
+
+		static I iand(I a, I b) {
+			return _mm512_and_si512(a, b);
+		}
+
+		static I ishr(I a, i32 b) {
+			return _mm512_srai_epi32(a, b);
+		}
+
+		static M gt(F a, F b) {
+			return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ);
+		}
+
+		static M lt(F a, F b) {
+			return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ);
+		}
+
+		static M ilt(I a, I b) {
+			return _mm512_cmplt_epi32_mask(a, b);
+		}
+
+		// a in the true lanes, zero elsewhere
+		static F select(F a, M m) {
+			return _mm512_maskz_mov_ps(m, a);
+		}
+
+		static F gather(const f32* base, I idx) {
+			return _mm512_i32gather_ps(idx, base, 4);
+		}
+
+		// two block rows a stride apart, the first one twice if rows is 1
+		static F loadRows(const f32* p, i32 stride, i32 rows) {
+			const __m256d lo = _mm256_castps_pd(_mm256_load_ps(p));
+			const __m256d hi = _mm256_castps_pd(_mm256_load_ps(rows > 1 ? p + stride : p));
+			return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(lo), hi, 1));
+		}
+
+		static void storeRows(f32* p, i32 stride, i32 rows, F a) {
+			_mm256_store_ps(p, _mm512_castps512_ps256(a));
+			if (rows > 1) {
+				_mm256_store_ps(p + stride, _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1)));
+			}
+		}
+
+		// lanes with the same top-left cell share all nine cells. their values are summed into
+		// the last of them by pointer jumping along the chains of vpconflictd, which leaves
+		// those lanes with distinct cells for one gather and scatter per offset and field
+		template <i32 N>
+		struct Scatter {
+			Scatter(f32* const* planes, I c00, const i32* offsets) : planes(planes), offsets(offsets) {
+				cells = c00;
+				const I conflicts = _mm512_conflict_epi32(c00);
+				// no later lane has the same cell
+				last = (M) ~_mm512_reduce_or_epi32(conflicts);
+				// the nearest earlier lane with the same cell, while there is one
+				I prev = _mm512_sub_epi32(_mm512_set1_epi32(31), _mm512_lzcnt_epi32(conflicts));
+				M chain = _mm512_test_epi32_mask(conflicts, conflicts);
+				numJumps = 0;
+				while (chain) {
+					prevs[numJumps] = prev;
+					chains[numJumps++] = chain;
+					const I linked = _mm512_maskz_set1_epi32(chain, -1);
+					chain &= _mm512_test_epi32_mask(
+						_mm512_permutexvar_epi32(prev, linked), _mm512_permutexvar_epi32(prev, linked));
+					prev = _mm512_mask_permutexvar_epi32(prev, chain, prev, prev);
+				}
+			}
+
+			void add(i32 k, const F* fields) {
+				const I ci = _mm512_add_epi32(cells, _mm512_set1_epi32(offsets[k]));
+				for (i32 f = 0; f < N; f++) {
+					F sum = fields[f];
+					for (i32 j = 0; j < numJumps; j++) {
+						sum = _mm512_mask_add_ps(sum, chains[j], sum, _mm512_permutexvar_ps(prevs[j], sum));
+					}
+					const F old = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), last, ci, planes[f], 4);
+					_mm512_mask_i32scatter_ps(planes[f], last, ci, _mm512_add_ps(old, sum), 4);
+				}
+			}
+
+			void flush() {
+			}
+
+			f32* const* planes;
+			const i32* offsets;
+			I cells; // c00
+			M last;
+			i32 numJumps;
+			I prevs[4];
+			M chains[4];
+		};
+	};
+}
+
+extern const WideKernels avx512Kernels[NUM_FEATURE_SETS] = {
+	wideKernels<Avx512, 0>(), wideKernels<Avx512, FEATURE_AERATION>()};
@@ -0,0 +1,360 @@
+// strips of a simulation on separate processes, see domain.h
+#include "domain.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	f64 msSince(Clock::time_point start) {
+		return std::chrono::duration<f64, std::milli>(Clock::now() - start).count();
+	}
+
+	// the rows on either side of a boundary, which the particles of both neighbours scatter into
+	constexpr i32 SHARED_ROWS = 2;
+	// polls of an exchange without progress before the rank gives up its core for a while, and how
+	// long it waits for a neighbour in all before taking it for dead
+	constexpr i32 SPINS = 64;
+	constexpr f64 TIMEOUT_MS = 30000;
+}
+
+// single producer and single consumer, counting bytes since the start
+struct ShmTransport::Ring {
+	alignas(64) std::atomic<u32> head; // read, written by the receiver
+	alignas(64) std::atomic<u32> tail; // written, by the sender
+	alignas(64) u8 data[RING_BYTES];
+};
+
+static_assert(std::atomic<u32>::is_always_lock_free, "the rings are shared between processes");
+
+ShmTransport::ShmTransport(const char* name, i32 rank, i32 ranks) : self(rank), count(ranks) {
+	// from rank r down to r + 1 at 2r, back up at 2r + 1
+	const size_t bytes = sizeof(Ring) * (ranks > 1 ? 2 * (ranks - 1) : 1);
+	const int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+	if (fd < 0)
+		return;
+	// every rank sizes it the same, the first one gets the zeros
+	if (ftruncate(fd, bytes) == 0) {
+		void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p != MAP_FAILED) {
+			rings = (Ring*) p;
+			mappedBytes = bytes;
+		}
+	}
+	close(fd);
+}
+
+ShmTransport::~ShmTransport() {
+	if (rings) {
+		munmap(rings, mappedBytes);
+	}
+}
+
+bool ShmTransport::exchange(i32 peer, const void* out, i32 bytes, std::vector<u8>& in) {
+	if (!rings || (peer != self - 1 && peer != self + 1) || peer < 0 || peer >= count)
+		return false;
+	const i32 link = self < peer ? self : peer;
+	Ring& tx = rings[2 * link + (self > peer)];
+	Ring& rx = rings[2 * link + (peer > self)];
+
+	// a message is its size followed by its bytes
+	u8 outSize[4];
+	u8 inSize[4];
+	memcpy(outSize, &bytes, 4);
+	const u32 outTotal = 4 + (u32) bytes;
+	u32 inTotal = 4; // until the size is in
+	u32 sent = 0;
+	u32 received = 0;
+
+	i32 idle = 0;
+	Clock::time_point idleSince;
+	while (sent < outTotal || received < inTotal) {
+		bool moved = false;
+		if (sent < outTotal) {
+			const u32 t = tx.tail.load(std::memory_order_relaxed);
+			const u32 room = RING_BYTES - (t - tx.head.load(std::memory_order_acquire));
+			const u32 n = room < outTotal - sent ? room : outTotal - sent;
+			for (u32 k = 0; k < n;) {
+				const u32 at = sent + k;
+				const u32 pos = (t + k) & (RING_BYTES - 1);
+				const u8* src = at < 4 ? outSize + at : (const u8*) out + (at - 4);
+				u32 len = (at < 4 ? 4 : outTotal) - at;
+				len = len < n - k ? len : n - k;
+				len = len < RING_BYTES - pos ? len : RING_BYTES - pos;
+				memcpy(tx.data + pos, src, len);
+				k += len;
+			}
+			tx.tail.store(t + n, std::memory_order_release);
+			sent += n;
+			moved |= n > 0;
+		}
+		if (received < inTotal) {
+			const u32 h = rx.head.load(std::memory_order_relaxed);
+			const u32 ready = rx.tail.load(std::memory_order_acquire) - h;
+			const u32 n = ready < inTotal - received ? ready : inTotal - received;
+			for (u32 k = 0; k < n;) {
+				const u32 at = received + k;
+				const u32 pos = (h + k) & (RING_BYTES - 1);
+				u8* dst = at < 4 ? inSize + at : in.data() + (at - 4);
+				u32 len = (at < 4 ? 4 : inTotal) - at;
+				len = len < n - k ? len : n - k;
+				len = len < RING_BYTES - pos ? len : RING_BYTES - pos;
+				memcpy(dst, rx.data + pos, len);
+				k += len;
+			}
+			rx.head.store(h + n, std::memory_order_release);
+			received += n;
+			moved |= n > 0;
+			if (inTotal == 4 && received == 4) {
+				i32 size;
+				memcpy(&size, inSize, 4);
+				in.resize(size);
+				inTotal += size;
+			}
+		}
+
+		if (moved) {
+			idle = 0;
+		} else if (++idle == SPINS) {
+			idleSince = Clock::now();
+		} else if (idle > SPINS) {
+			if (msSince(idleSince) > TIMEOUT_MS)
+				return false;
+			sched_yield();
+		}
+	}
+	return true;
+}
+
+Domain::Domain(Transport& transport, i32 gridW, i32 gridH)
+	: transport(transport), gridW(gridW), gridH(gridH) {
+	stripBegin = (i32) ((i64) gridH * transport.rank() / transport.ranks());
+	stripEnd = (i32) ((i64) gridH * (transport.rank() + 1) / transport.ranks());
+	origin = stripBegin > HALO ? stripBegin - HALO : 0;
+	rows = (stripEnd + HALO < gridH ? stripEnd + HALO : gridH) - origin;
+	walls = (stripBegin == 0 ? WALL_TOP : 0) | (stripEnd == gridH ? WALL_BOTTOM : 0);
+}
+
+bool Domain::supported() {
+	return pressureSolver() == PRESSURE_EOS && adaptiveCfl() == 0 && emitterCount() == 0;
+}
+
+i32 Domain::peers(i32* out) const {
+	const i32 r = transport.rank();
+	const i32 first = r & 1 ? r + 1 : r - 1;
+	const i32 second = r & 1 ? r - 1 : r + 1;
+	i32 n = 0;
+	for (i32 p : {first, second}) {
+		if (p >= 0 && p < transport.ranks()) {
+			out[n++] = p;
+		}
+	}
+	return n;
+}
+
+void Domain::adopt() {
+	const i32 n = particleCount();
+	const f32* posy = (const f32*) particlePlane(P_POS_Y);
+	keep.resize(n);
+	for (i32 i = 0; i < n; i++) {
+		keep[i] = posy[i] >= stripBegin && posy[i] < stripEnd;
+	}
+	removeParticles(keep.data());
+
+	f32* y = (f32*) particlePlane(P_POS_Y);
+	for (i32 i = 0, m = particleCount(); i < m; i++) {
+		y[i] -= origin;
+	}
+	setGridWindow(origin, walls);
+	setGrid(gridW, rows);
+	// down to the particles and cells of the strip, from those of the whole tank
+	reserve(particleCount(), 0);
+}
+
+// sums the shared rows of the mass (with aeration weighted by it) and momentum planes, or of the
+// momentum change planes, with each neighbour. only the cells of active blocks take the sums:
+// the others are read by no particle of this rank and would not be cleared
+bool Domain::exchangeRows(bool pressure) {
+	static const i32 MASS_FIELDS[] = {G_MASS, G_AERATION, G_VEL_X, G_VEL_Y};
+	static const i32 PRESSURE_FIELDS[] = {G_DVEL_X, G_DVEL_Y};
+	const i32* fields = pressure ? PRESSURE_FIELDS : MASS_FIELDS;
+	const i32 numFields = pressure ? 2 : 4;
+	f32* planes[4];
+	for (i32 f = 0; f < numFields; f++) {
+		planes[f] = (f32*) cellPlane(fields[f]);
+	}
+	const i32 stride = cellStride();
+	const bool aerated = features() & FEATURE_AERATION;
+
+	i32 list[2];
+	const i32 n = peers(list);
+	for (i32 k = 0; k < n; k++) {
+		const i32 peer = list[k];
+		const i32 row0 = (peer < transport.rank() ? stripBegin : stripEnd) - 1 - origin;
+		const i32 values = numFields * SHARED_ROWS * gridW;
+		outRows.resize(values);
+		for (i32 f = 0; f < numFields; f++) {
+			for (i32 r = 0; r < SHARED_ROWS; r++) {
+				memcpy(outRows.data() + (f * SHARED_ROWS + r) * gridW, planes[f] + (row0 + r) * stride,
+					gridW * sizeof(f32));
+			}
+		}
+		const auto start = Clock::now();
+		const bool ok = transport.exchange(peer, outRows.data(), values * sizeof(f32), inBytes);
+		exchangeMs += msSince(start);
+		bytesSent += values * sizeof(f32);
+		if (!ok || inBytes.size() != values * sizeof(f32))
+			return false;
+
+		// both sides add the same two numbers, so they end up with the same sums
+		const f32* in = (const f32*) inBytes.data();
+		for (i32 r = 0; r < SHARED_ROWS; r++) {
+			const i32 y = row0 + r;
+			const f32* theirs[4];
+			for (i32 f = 0; f < numFields; f++) {
+				theirs[f] = in + (f * SHARED_ROWS + r) * gridW;
+			}
+			for (i32 x = 0; x < gridW; x++) {
+				if (!cellActive(x, y))
+					continue;
+				const i32 c = y * stride + x;
+				if (pressure) {
+					planes[0][c] += theirs[0][x];
+					planes[1][c] += theirs[1][x];
+					continue;
+				}
+				const f32 m1 = planes[0][c];
+				const f32 m2 = theirs[0][x];
+				const f32 m = m1 + m2;
+				if (aerated) {
+					planes[1][c] = m > 0 ? (planes[1][c] * m1 + theirs[1][x] * m2) / m : 0;
+				}
+				planes[0][c] = m;
+				planes[2][c] += theirs[2][x];
+				planes[3][c] += theirs[3][x];
+			}
+		}
+	}
+	return true;
+}
+
+// hands the particles that left the strip to the neighbour on that side and takes in theirs
+bool Domain::migrate() {
+	const i32 last = transport.ranks() - 1;
+	const i32 count = particleCount();
+	const f32* posy = (const f32*) particlePlane(P_POS_Y);
+	const f32 begin = (f32) (stripBegin - origin);
+	const f32 end = (f32) (stripEnd - origin);
+	const f32* planes[P_NUM_FIELDS];
+	for (i32 f = 0; f < P_NUM_FIELDS; f++) {
+		planes[f] = (const f32*) particlePlane(f);
+	}
+	keep.resize(count);
+	outParticles[0].clear();
+	outParticles[1].clear();
+	i32 leaving = 0;
+	for (i32 i = 0; i < count; i++) {
+		const i32 side = posy[i] < begin && transport.rank() > 0 ? 0
+			: posy[i] >= end && transport.rank() < last      ? 1
+															   : -1;
+		keep[i] = side < 0;
+		if (side < 0)
+			continue;
+		// positions travel in the coordinates of the tank
+		for (i32 f = 0; f < P_NUM_FIELDS; f++) {
+			outParticles[side].push_back(planes[f][i] + (f == P_POS_Y ? origin : 0));
+		}
+		leaving++;
+	}
+	if (leaving > 0) {
+		removeParticles(keep.data());
+		migrated += leaving;
+	}
+
+	i32 list[2];
+	const i32 n = peers(list);
+	for (i32 k = 0; k < n; k++) {
+		const std::vector<f32>& out = outParticles[list[k] < transport.rank() ? 0 : 1];
+		const i32 bytes = (i32) (out.size() * sizeof(f32));
+		const auto start = Clock::now();
+		const bool ok = transport.exchange(list[k], out.data(), bytes, inBytes);
+		exchangeMs += msSince(start);
+		bytesSent += bytes;
+		if (!ok)
+			return false;
+
+		const i32 arriving = (i32) (inBytes.size() / (P_NUM_FIELDS * sizeof(f32)));
+		if (arriving == 0)
+			continue;
+		const i32 have = particleCount();
+		const i32 need = have + arriving;
+		const i32 grown = particleCapacity() + (particleCapacity() >> 1);
+		if (need > particleCapacity() && !reserve(need > grown ? need : grown, 0))
+			return false;
+		const f32* in = (const f32*) inBytes.data();
+		for (i32 f = 0; f < P_NUM_FIELDS; f++) {
+			f32* plane = (f32*) particlePlane(f);
+			const f32 shift = f == P_POS_Y ? (f32) origin : 0;
+			for (i32 j = 0; j < arriving; j++) {
+				plane[have + j] = in[j * P_NUM_FIELDS + f] - shift;
+			}
+		}
+		setParticleCount(have + arriving);
+	}
+	return true;
+}
+
+bool Domain::step(i32 substeps, f32 gravityX, f32 gravityY, f32 mouseX, f32 mouseY, f32 dmouseX,
+	f32 dmouseY, f32 radius, f32 jitterAmount) {
+	if (!ok())
+		return false;
+	setGridWindow(origin, walls);
+	setGrid(gridW, rows);
+	const i32 n = beginFrame(substeps);
+	const f32 dt = substepDt();
+	bool ok = true;
+	for (i32 i = 0; i < n && ok; i++) {
+		transferMass();
+		ok = exchangeRows(false);
+		mirrorMass();
+		applyPressure();
+		ok = ok && exchangeRows(true);
+		mirrorPressure();
+		updateGrid(
+			gravityX * dt * dt, gravityY * dt * dt, mouseX, mouseY, dmouseX * dt, dmouseY * dt, radius);
+		g2p();
+		jitter(jitterAmount * dt);
+		ok = ok && migrate();
+	}
+	endFrame();
+	return ok;
+}
+
+bool Domain::sum(f64 value, f64& total) {
+	// prefix sums down the chain of ranks, then the total back up
+	const i32 r = transport.rank();
+	const i32 last = transport.ranks() - 1;
+	total = value;
+	if (r > 0) {
+		if (!transport.exchange(r - 1, nullptr, 0, inBytes) || inBytes.size() != sizeof(f64))
+			return false;
+		f64 prefix;
+		memcpy(&prefix, inBytes.data(), sizeof(f64));
+		total = prefix + value;
+	}
+	if (r < last) {
+		if (!transport.exchange(r + 1, &total, sizeof(f64), inBytes))
+			return false;
+		if (!transport.exchange(r + 1, nullptr, 0, inBytes) || inBytes.size() != sizeof(f64))
+			return false;
+		memcpy(&total, inBytes.data(), sizeof(f64));
+	}
+	if (r > 0 && !transport.exchange(r - 1, &total, sizeof(f64), inBytes))
+		return false;
+	return true;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include "water.h"
+#include <vector>
+
+// a simulation split into horizontal strips of the grid, one per process (a rank). every rank runs
+// the engine on its strip and HALO rows on either side only (setGridWindow), open where the strip
+// borders another, and holds the particles of its rows, so ranks divide the grid memory along with
+// the particles and the work. native only
+
+// moves messages between ranks. exchange() sends and receives at once, so that two ranks sending
+// to each other can't both wait for the other to receive
+class Transport {
+public:
+	virtual ~Transport() = default;
+
+	virtual i32 rank() const = 0;
+	virtual i32 ranks() const = 0;
+	// sends bytes of out to peer and receives the message peer sends back into in. both call it for
+	// each other, in the same order. returns false if the peer can't be reached
+	virtual bool exchange(i32 peer, const void* out, i32 bytes, std::vector<u8>& in) = 0;
+};
+
+// rings in a POSIX shared memory object, one per direction between neighbours, for ranks on one
+// machine. every rank opens the same name; the object starts out zeroed, which is empty rings,
+// so no rank has to set it up first. the name stays until shm_unlink()
+class ShmTransport : public Transport {
+public:
+	static constexpr u32 RING_BYTES = 1 << 20; // a power of two
+
+	ShmTransport(const char* name, i32 rank, i32 ranks);
+	~ShmTransport() override;
+	ShmTransport(const ShmTransport&) = delete;
+	ShmTransport& operator=(const ShmTransport&) = delete;
+
+	// false if the object couldn't be mapped
+	bool ok() const {
+		return rings != nullptr;
+	}
+
+	i32 rank() const override {
+		return self;
+	}
+
+	i32 ranks() const override {
+		return count;
+	}
+
+	bool exchange(i32 peer, const void* out, i32 bytes, std::vector<u8>& in) override;
+
+private:
+	struct Ring;
+
+	Ring* rings = nullptr;
+	size_t mappedBytes = 0;
+	i32 self;
+	i32 count;
+};
+
+// one rank of a decomposed simulation, driving the current simulation of the calling thread.
+// the rows are split evenly; a particle in rows [rowBegin(), rowEnd()) belongs to this rank.
+// neighbours both scatter into the two rows around their boundary, which are summed across them
+// after the mass and the pressure transfers. that leaves both with the same grid there, so the
+// velocities updateGrid computes agree and g2p needs no exchange of its own. particles that left
+// the strip move to the neighbour after every substep.
+// the engine's grid is rows [rowOrigin(), rowOrigin() + gridH) of the tank and particle positions
+// are relative to it; walls, colliders and the pointer stay in the coordinates of the tank
+class Domain {
+public:
+	// strips need at least this many rows, so that the shared rows of both boundaries are apart
+	static constexpr i32 MIN_ROWS = 4;
+	// rows of grid past an open edge of the strip: the shared row, and one for particles that
+	// left the strip in the last substep to scatter into before they migrate
+	static constexpr i32 HALO = 2;
+
+	Domain(Transport& transport, i32 gridW, i32 gridH);
+
+	// false if the grid has too few rows for the ranks, or the simulation is set up for what the
+	// strips can't run: the projection of PRESSURE_PROJECT, which is a solve over the whole grid,
+	// adaptive substeps, which the ranks would pick apart, or emitters
+	bool ok() const {
+		return stripEnd - stripBegin >= MIN_ROWS && supported();
+	}
+
+	// the settings part of ok(), for the current simulation
+	static bool supported();
+
+	i32 rowBegin() const {
+		return stripBegin;
+	}
+
+	i32 rowEnd() const {
+		return stripEnd;
+	}
+
+	// the row of the tank at row 0 of the engine's grid
+	i32 rowOrigin() const {
+		return origin;
+	}
+
+	// drops the particles outside the strip, for scenes that every rank set up in full, and
+	// shrinks the engine's grid to the strip and its halo
+	void adopt();
+
+	// step() of the whole simulation, called by every rank with the same arguments after adopt().
+	// returns false if an exchange failed or ok() is not
+	bool step(i32 substeps, f32 gravityX, f32 gravityY, f32 mouseX, f32 mouseY, f32 dmouseX, f32 dmouseY,
+		f32 radius, f32 jitter);
+
+	// the sum of value over all ranks into total, on every rank. false if an exchange failed
+	bool sum(f64 value, f64& total);
+
+	// totals since construction
+	f64 exchangeMs = 0; // spent in exchanges, including the wait for the neighbours
+	i64 bytesSent = 0;
+	i64 migrated = 0; // particles sent to a neighbour
+
+private:
+	// the neighbours in the order of the exchanges, the one across the boundary with an even index
+	// (rank r is between boundaries r and r + 1) first, so that all pairs of a round meet at once
+	i32 peers(i32* out) const;
+	bool exchangeRows(bool pressure);
+	bool migrate();
+
+	Transport& transport;
+	i32 gridW;
+	i32 gridH;
+	i32 stripBegin;
+	i32 stripEnd;
+	i32 origin; // the window of setGridWindow()
+	i32 rows;
+	i32 walls;
+	std::vector<f32> outRows;
+	std::vector<u8> inBytes;
+	std::vector<f32> outParticles[2]; // up, down
+	std::vector<u8> keep;
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include "water.h"
+
+// definitions shared by the 4-lane kernels in main.cpp and the native wide kernels
+
+// defaults of FluidParams
+constexpr f32 STIFFNESS = 5;
+constexpr f32 AERATION_THRESHOLD = 0.7;
+constexpr f32 AERATION_COEFF = 20.0;
+constexpr f32 AERATION_BLUR = 0.01;
+constexpr f32 AERATION_DAMP = 0.992;
+
+constexpr f32 PDELTA = 0.5;
+constexpr f32 DENSITY = 1 / (PDELTA * PDELTA);
+constexpr f32 INV_DENSITY = 1 / DENSITY;
+
+// sparse grid. cells are grouped into blocks of BLOCK_SIZE^2, and only the blocks near
+// particles are cleared, reduced and updated. cells of inactive blocks stay zero
+constexpr i32 BLOCK_SHIFT = 3;
+constexpr i32 BLOCK_SIZE = 1 << BLOCK_SHIFT;
+
+// rows of the grid planes are padded to a multiple of this many cells (a cache line), so every
+// row of a block is BLOCK_SIZE cells of whole, aligned vectors. padding cells hold no mass
+constexpr i32 GRID_ROW_ALIGN = 16;
+
+// material constants of a simulation, see setFluidParams()
+struct FluidParams {
+	f32 stiffness = STIFFNESS; // pressure per density above the rest density, relative to it
+	f32 aerationThreshold = AERATION_THRESHOLD; // density ratio under which motion aerates
+	f32 aerationCoeff = AERATION_COEFF;
+	f32 aerationBlur = AERATION_BLUR; // share taken from the cells around per step
+	f32 aerationDamp = AERATION_DAMP; // share kept per step
+};
+
+// factors of the per-step terms for a substep of dt base steps, see stepScales() in main.cpp.
+// velocities are in cells per substep, so forces scale with dt^2 and rates with dt
+struct StepScales {
+	f32 pressure; // -4 dt^2, 0 when projectPressure() takes the place of the scatter
+	f32 stiffness;
+	f32 aerationDamp; // aerationDamp^dt
+	f32 aerationBlur; // 1 - (1 - aerationBlur)^dt
+	f32 aerationCoeff; // aerationCoeff / dt
+	f32 invAerationThreshold;
+	f32 driftGain; // 1 - (1 - DRIFT_GAIN)^dt, see projectPressure() in main.cpp
+};
+
+// every combination of StepFeature bits. the step kernels are instantiated for each, so the
+// parts of a disabled feature are not computed at all
+constexpr i32 NUM_FEATURE_SETS = FEATURE_ALL + 1;
+
+// what the wide kernels see of the engine
+struct KernelState {
+	f32* const* planes; // indexed by ParticleField, padded to whole groups of lanes
+	f32* const* grid; // indexed by GridField
+	i32 gridW;
+	i32 gridH;
+	i32 gridStride; // cells per row of a grid plane
+	i32 numP; // lanes at or past it are padding and get zero weights
+	StepScales scales;
+};
+
+// external forces of updateGrid
+struct GridForces {
+	f32 gravityX;
+	f32 gravityY;
+	f32 mouseX;
+	f32 mouseY;
+	f32 dmouseX;
+	f32 dmouseY;
+	f32 radius;
+};
+
+// the kernels of one wide instruction set and feature set. particle ranges are multiples of
+// lanes, and the stencils are always recomputed (the 4-lane cache layout doesn't fit them)
+struct WideKernels {
+	i32 lanes;
+	// mass and momentum into the planes of grid, returns the number of disordered quads
+	i32 (*transfer)(const KernelState& s, f32* const* grid, i32 begin, i32 end);
+	// density and aeration from s.grid, pressure into grid
+	void (*pressure)(const KernelState& s, f32* const* grid, i32 begin, i32 end);
+	// without the collider projection. returns the largest squared particle velocity
+	f32 (*g2p)(const KernelState& s, i32 begin, i32 end);
+	// momentum to velocity in the blocks [begin, end) of the list, returns the largest squared
+	// grid velocity
+	f32 (*velocity)(
+		const KernelState& s, const i32* blocks, i32 begin, i32 end, i32 blocksW, const GridForces& f);
+};
+
+#ifdef WATER_WIDE
+// indexed by feature set
+extern const WideKernels avx2Kernels[NUM_FEATURE_SETS];
+extern const WideKernels avx512Kernels[NUM_FEATURE_SETS];
+#endif
@@ -1,41 +1,21 @@
-#include "wasm.h"
-#include "wasm_simd128.h"
+#include "water.h"
+#include "arena.h"
+#include "kernels.h"
+#include "pool.h"
+#include <atomic>
+#include <cmath>
 #include <cstring>
-
-constexpr f32 AERATION_THRESHOLD = 0.7;
-constexpr f32 AERATION_COEFF = 20.0;
-constexpr f32 AERATION_BLUR = 0.01;
-constexpr f32 AERATION_DAMP = 0.992;
-
-constexpr f32 PDELTA = 0.5;
-constexpr f32 DENSITY = 1 / (PDELTA * PDELTA);
-constexpr f32 INV_DENSITY = 1 / DENSITY;
-
-struct Particle {
-	f32 aeration;
-	f32 posx;
-	f32 posy;
-	f32 velx;
-	f32 vely;
-	f32 gvel00;
-	f32 gvel01;
-	f32 gvel10;
-	f32 gvel11;
-	f32 dens;
-};
-
+#include <new>
+#ifndef __EMSCRIPTEN__
+#include <chrono>
+#endif
+#ifdef WATER_STATS
+#include <cstdio>
+#endif
+
+// per-quad stencil. computed in transferMass and cached for applyPressure and g2p, or
+// recomputed from the positions by each pass in the fused stencil mode
 struct VectorizedParticle {
-	v128 aeration;
-	v128 density;
-	v128 posx;
-	v128 posy;
-	v128 velx;
-	v128 vely;
-	v128 gvel00;
-	v128 gvel01;
-	v128 gvel10;
-	v128 gvel11;
-
 	v128 dx;
 	v128 dy;
 
@@ -60,131 +40,622 @@ struct VectorizedParticle {
 	v128 c22;
 };
 
-struct Cell {
-	f32 mass;
+// a particle as the gather transfer reads it, stored in the bin of its cell
+struct BinnedParticle {
+	f32 x;
+	f32 y;
 	f32 aeration;
 	f32 velx;
 	f32 vely;
-	f32 dvelx;
-	f32 dvely;
+	f32 gvel00;
+	f32 gvel01;
+	f32 gvel10;
+	f32 gvel11;
+	f32 coeff; // pressure over density, set by applyPressure
+};
+
+constexpr i32 MAX_CAPACITY = 1 << 28; // particles or cells, see reserve()
+
+// fixed point transfer, see setTransferMode(). sums of 32.32 fixed point are exact, so they do
+// not depend on the order the particles are added in
+enum Accumulation : i32 {
+	ACC_FLOAT, // into the float planes, a grid per thread
+	ACC_FIXED, // into fixedGrid
+	ACC_ATOMIC // into fixedGrid with atomic adds, when threaded
+};
+
+constexpr f32 FIXED_ONE = 4294967296.0f;
+constexpr f64 FIXED_INV = 1 / 4294967296.0;
+
+// kernel instruction set, see setKernelIsa()
+i32 bestIsa() {
+#ifdef WATER_WIDE
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd"))
+		return ISA_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return ISA_AVX2;
+#endif
+	return ISA_SIMD128;
+}
+
+const i32 supportedIsa = bestIsa();
+
+constexpr i32 BLOCK_MARGIN = 2; // the 3x3 stencil plus the cell it is mirrored into
+
+// colliders. static ones are baked into an SDF grid of the cell centres, moving ones are
+// evaluated analytically every step
+constexpr i32 MAX_COLLIDERS = 64;
+constexpr f32 COLLIDER_BAND = 1; // cells whose centre is closer than this to a solid are projected
+constexpr f32 FAR = 1e6; // distance of cells with no solid nearby
+
+struct Collider {
+	i32 shape; // ColliderShape, -1 for a free slot
+	i32 flags;
+	f32 x;
+	f32 y;
+	f32 sizeX;
+	f32 sizeY;
+	f32 vx;
+	f32 vy;
 };
 
-constexpr i32 MAX_PARTICLES = 262144;
-constexpr i32 MAX_CELLS = 262144;
+// particle sources and sinks, see addEmitter()
+constexpr i32 MAX_EMITTERS = 64;
+
+struct Emitter {
+	i32 kind; // EmitterKind, -1 for a free slot
+	i32 shape; // ColliderShape
+	f32 x;
+	f32 y;
+	f32 sizeX;
+	f32 sizeY;
+	f32 rate; // particles per base step
+	f32 vx; // cells per base step
+	f32 vy;
+	f32 owed; // the fraction of a particle left over from the last update
+};
+
+// byte shuffles that move the lanes of a quad whose bits are set in the index (lane 0 in bit 0)
+// to the front, in order
+struct CompactShuffles {
+	u8 bytes[16][16];
+};
+
+constexpr CompactShuffles compactShuffles() {
+	CompactShuffles s = {};
+	for (i32 lanes = 0; lanes < 16; lanes++) {
+		i32 n = 0;
+		for (i32 l = 0; l < 4; l++) {
+			if (lanes >> l & 1) {
+				for (i32 b = 0; b < 4; b++) {
+					s.bytes[lanes][n * 4 + b] = (u8) (l * 4 + b);
+				}
+				n++;
+			}
+		}
+	}
+	return s;
+}
+
+alignas(16) constexpr CompactShuffles COMPACT_SHUFFLES = compactShuffles();
+
+// fraction of the density error projectPressure() corrects per base step, a substep of dt base
+// steps taking 1 - (1 - DRIFT_GAIN)^dt of it like the other rates. correcting all of it at once
+// overshoots, as the velocities that correct it carry on into the next substeps. 0.3 is picked by
+// hand, not derived; being per base step, the correction over a frame does not depend on dt
+constexpr f32 DRIFT_GAIN = 0.3;
+
+// step factors for a substep of dt base steps. dt = 1 keeps the constants as they are, so fixed
+// stepping rounds exactly as before
+StepScales stepScales(f32 dt, const FluidParams& p, i32 solver) {
+	const f32 invThreshold = (f32) (1.0 / p.aerationThreshold);
+	const f32 pressure = solver == PRESSURE_EOS ? -4 * dt * dt : 0;
+	if (dt == 1)
+		return {
+			pressure, p.stiffness, p.aerationDamp, p.aerationBlur, p.aerationCoeff, invThreshold, DRIFT_GAIN};
+	return {pressure, p.stiffness, powf(p.aerationDamp, dt), 1 - powf(1 - p.aerationBlur, dt),
+		p.aerationCoeff / dt, invThreshold, 1 - powf(1 - DRIFT_GAIN, dt)};
+}
+
+constexpr f32 CFL_OVERLOAD = 2;
 
-Particle ps[MAX_PARTICLES];
-VectorizedParticle vps[MAX_PARTICLES >> 2];
+// the longest substep the equation of state stands at the default stiffness, in base steps. its
+// pressure impulse grows with stiffness * dt^2 like that of an explicitly integrated spring, so
+// the limit goes with 1 / sqrt(stiffness); past it compressed water rebounds further every substep
+constexpr f32 EOS_MAX_DT = 1;
 
-WASM_EXPORT i32 numP = 0;
+#ifdef WATER_STATS
+// the trace, named by StatPhase and the two below
+enum TraceName : i32 { TRACE_SUBSTEP = STAT_NUM_PHASES, TRACE_FRAME, TRACE_NUM_NAMES };
+const char* const TRACE_NAMES[TRACE_NUM_NAMES] = {"sortParticles", "transferMass", "mirrorMass",
+	"applyPressure", "mirrorPressure", "updateGrid", "projectPressure", "g2p", "jitter", "updateEmitters",
+	"substep", "frame"};
 
-Cell cs[MAX_CELLS];
-i32 gridW = 0;
-i32 gridH = 0;
-i32 numC = 0;
+struct TraceEvent {
+	f64 start;
+	f32 duration;
+	i32 name;
+};
+
+#endif
 
 inline v128 f32x4_pow2(v128 x) {
 	return wasm_f32x4_mul(x, x);
 }
 
-inline void mirror(i32 c1, i32 c2) {
-	const f32 m = cs[c1].mass + cs[c2].mass;
-	const f32 mx = cs[c1].velx + cs[c2].velx;
-	const f32 my = cs[c1].vely + cs[c2].vely;
-	cs[c1].mass = m;
-	cs[c2].mass = m;
-	cs[c1].velx = mx;
-	cs[c2].velx = mx;
-	cs[c1].vely = my;
-	cs[c2].vely = my;
+inline f32 f32x4_max_lane(v128 a) {
+	const f32 m01 = fmaxf(wasm_f32x4_extract_lane(a, 0), wasm_f32x4_extract_lane(a, 1));
+	const f32 m23 = fmaxf(wasm_f32x4_extract_lane(a, 2), wasm_f32x4_extract_lane(a, 3));
+	return fmaxf(m01, m23);
 }
 
-inline void mirror2(i32 c1, i32 c2, bool flipx, bool flipy) {
-	if (flipx) {
-		const f32 subx = cs[c1].dvelx - cs[c2].dvelx;
-		cs[c1].dvelx = subx;
-		cs[c2].dvelx = -subx;
-	} else {
-		const f32 sumx = cs[c1].dvelx + cs[c2].dvelx;
-		cs[c1].dvelx = sumx;
-		cs[c2].dvelx = sumx;
-	}
-	if (flipy) {
-		const f32 suby = cs[c1].dvely - cs[c2].dvely;
-		cs[c1].dvely = suby;
-		cs[c2].dvely = -suby;
-	} else {
-		const f32 sumy = cs[c1].dvely + cs[c2].dvely;
-		cs[c1].dvely = sumy;
-		cs[c2].dvely = sumy;
+inline f64 f32x4_sum_lanes(v128 a) {
+	const f64 s01 = (f64) wasm_f32x4_extract_lane(a, 0) + wasm_f32x4_extract_lane(a, 1);
+	const f64 s23 = (f64) wasm_f32x4_extract_lane(a, 2) + wasm_f32x4_extract_lane(a, 3);
+	return s01 + s23;
+}
+
+// lowbias32 integer hash by Chris Wellons
+inline u32 hash32(u32 x) {
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+inline v128 u32x4_hash(v128 x) {
+	x = wasm_v128_xor(x, wasm_u32x4_shr(x, 16));
+	x = wasm_i32x4_mul(x, wasm_i32x4_const_splat(0x7feb352d));
+	x = wasm_v128_xor(x, wasm_u32x4_shr(x, 15));
+	x = wasm_i32x4_mul(x, wasm_i32x4_const_splat((i32) 0x846ca68b));
+	x = wasm_v128_xor(x, wasm_u32x4_shr(x, 16));
+	return x;
+}
+
+// uniform in [-1, 1) from the top 24 bits of a hash
+inline v128 f32x4_signed_unit(v128 h) {
+	const v128 u = wasm_f32x4_convert_i32x4(wasm_u32x4_shr(h, 8));
+	return wasm_f32x4_sub(
+		wasm_f32x4_mul(u, wasm_f32x4_const_splat(2.0 / 16777216.0)), wasm_f32x4_const_splat(1));
+}
+
+// lanes in [0, 65504] as half floats in the low 16 bits, rounded to nearest with ties up. those
+// below the smallest normal half are flushed to zero
+inline v128 f32x4_to_f16(v128 a) {
+	const v128 bits = wasm_f32x4_min(a, wasm_f32x4_const_splat(65504));
+	const v128 h = wasm_u32x4_shr(
+		wasm_i32x4_add(bits, wasm_i32x4_const_splat(0x1000 - ((127 - 15) << 23))), 13);
+	return wasm_v128_andnot(h, wasm_f32x4_lt(a, wasm_f32x4_const_splat(6.1035156e-5f)));
+}
+
+// lanes clamped to [0, 1] as bytes in the low 8 bits, rounded to nearest
+inline v128 f32x4_to_unorm8(v128 a) {
+	const v128 c = wasm_f32x4_min(wasm_f32x4_max(a, wasm_f32x4_const_splat(0)), wasm_f32x4_const_splat(1));
+	return wasm_i32x4_trunc_sat_f32x4(
+		wasm_f32x4_add(wasm_f32x4_mul(c, wasm_f32x4_const_splat(255)), wasm_f32x4_const_splat(0.5)));
+}
+
+inline f32 signedUnit(u32 h) {
+	return (f32) (h >> 8) * (f32) (2.0 / 16777216.0) - 1;
+}
+
+inline i32 mini(i32 a, i32 b) {
+	return a < b ? a : b;
+}
+
+inline i32 maxi(i32 a, i32 b) {
+	return a > b ? a : b;
+}
+
+constexpr i32 MAX_TEXTURE_SIZE = 8192; // texels on a side, see densityTexture()
+
+// taps of a tent filter resampling cells to texels, at least a cell wide on each side and
+// normalized so that a uniform grid gives a uniform texture. tap k of texel x is at
+// x * texelStep + k * tapStep; taps off the grid weigh nothing
+void tentTaps(i32 texels, i32 cells, i32 taps, i32 texelStep, i32 tapStep, i32* index, f32* weight) {
+	const f32 scale = (f32) cells / texels;
+	const f32 radius = fmaxf(scale, 1);
+	for (i32 x = 0; x < texels; x++) {
+		// in cell indices, cell i being centred on i + 0.5
+		const f32 centre = (x + 0.5f) * scale - 0.5f;
+		const i32 first = (i32) floorf(centre - radius) + 1;
+		f32 sum = 0;
+		for (i32 k = 0; k < taps; k++) {
+			const i32 i = first + k;
+			const f32 w = i >= 0 && i < cells ? fmaxf(0, 1 - fabsf(i - centre) / radius) : 0;
+			index[x * texelStep + k * tapStep] = mini(maxi(i, 0), cells - 1);
+			weight[x * texelStep + k * tapStep] = w;
+			sum += w;
+		}
+		for (i32 k = 0; k < taps && sum > 0; k++) {
+			weight[x * texelStep + k * tapStep] /= sum;
+		}
 	}
 }
 
-WASM_EXPORT i32 particles() {
-	return ptr(ps);
+inline f64 nowMs() {
+#ifdef __EMSCRIPTEN__
+	return emscripten_get_now();
+#else
+	using namespace std::chrono;
+	return duration<f64, std::milli>(steady_clock::now().time_since_epoch()).count();
+#endif
 }
 
-WASM_EXPORT i32 cells() {
-	return ptr(cs);
+// signed distance of four points to a collider and the outward normal there
+inline void colliderSdf(const Collider& c, v128 px, v128 py, v128& dist, v128& nx, v128& ny) {
+	const v128 zeros = wasm_f32x4_const_splat(0);
+	const v128 tiny = wasm_f32x4_const_splat(1e-6);
+	const v128 dx = wasm_f32x4_sub(px, wasm_f32x4_splat(c.x));
+	const v128 dy = wasm_f32x4_sub(py, wasm_f32x4_splat(c.y));
+	if (c.shape == COLLIDER_CIRCLE) {
+		const v128 r = wasm_f32x4_sqrt(wasm_f32x4_add(f32x4_pow2(dx), f32x4_pow2(dy)));
+		const v128 invR = wasm_f32x4_div(wasm_f32x4_const_splat(1), wasm_f32x4_max(r, tiny));
+		dist = wasm_f32x4_sub(r, wasm_f32x4_splat(c.sizeX));
+		nx = wasm_f32x4_mul(dx, invR);
+		ny = wasm_f32x4_mul(dy, invR);
+		return;
+	}
+	// box: distance to the nearest side inside, to the nearest point of the box outside
+	const v128 signs = wasm_f32x4_const_splat(-0.0);
+	const v128 sx = wasm_v128_or(wasm_v128_and(dx, signs), wasm_f32x4_const_splat(1));
+	const v128 sy = wasm_v128_or(wasm_v128_and(dy, signs), wasm_f32x4_const_splat(1));
+	const v128 qx = wasm_f32x4_sub(wasm_f32x4_abs(dx), wasm_f32x4_splat(c.sizeX));
+	const v128 qy = wasm_f32x4_sub(wasm_f32x4_abs(dy), wasm_f32x4_splat(c.sizeY));
+	const v128 ox = wasm_f32x4_max(qx, zeros);
+	const v128 oy = wasm_f32x4_max(qy, zeros);
+	const v128 outLen = wasm_f32x4_sqrt(wasm_f32x4_add(f32x4_pow2(ox), f32x4_pow2(oy)));
+	const v128 invLen = wasm_f32x4_div(wasm_f32x4_const_splat(1), wasm_f32x4_max(outLen, tiny));
+	const v128 outside = wasm_f32x4_gt(outLen, zeros);
+	const v128 xSide = wasm_f32x4_gt(qx, qy);
+	dist = wasm_f32x4_add(outLen, wasm_f32x4_min(wasm_f32x4_max(qx, qy), zeros));
+	nx = wasm_v128_bitselect(
+		wasm_f32x4_mul(wasm_f32x4_mul(ox, invLen), sx), wasm_v128_and(sx, xSide), outside);
+	ny = wasm_v128_bitselect(
+		wasm_f32x4_mul(wasm_f32x4_mul(oy, invLen), sy), wasm_v128_andnot(sy, xSide), outside);
 }
 
-WASM_EXPORT void setGrid(i32 gw, i32 gh) {
-	gridW = gw;
-	gridH = gh;
+// the four cells of idx, as a vector
+inline v128 f32x4_gather(const f32* base, v128 idx) {
+	return wasm_f32x4_make(base[wasm_i32x4_extract_lane(idx, 0)], base[wasm_i32x4_extract_lane(idx, 1)],
+		base[wasm_i32x4_extract_lane(idx, 2)], base[wasm_i32x4_extract_lane(idx, 3)]);
 }
 
-WASM_EXPORT void p2g() {
-	numC = gridW * gridH;
-	memset(cs, 0, numC * sizeof(Cell));
-
-	int origNumP = numP;
-	int numP = origNumP;
-
-	// pad to multiple of 4
-	while (numP & 3) {
-		// copy the last particle to pad
-		ps[numP] = ps[numP - 1];
-		numP++;
-	}
-
-	const v128 igridWs = wasm_i32x4_splat(gridW);
-	const v128 f1s = wasm_f32x4_const_splat(1);
-	const v128 f05s = wasm_f32x4_const_splat(0.5);
-	const v128 f75s = wasm_f32x4_const_splat(0.75);
-	const v128 f0s = wasm_f32x4_const_splat(0);
-	const v128 i1s = wasm_i32x4_const_splat(1);
-	const v128 i0s = wasm_i32x4_const_splat(0);
-
-	// mass and momentum transfer
-	for (i32 i = 0; i < numP; i += 4) {
-		i32 i1 = i;
-		i32 i2 = i + 1;
-		i32 i3 = i + 2;
-		i32 i4 = i + 3;
-		const Particle& p1 = ps[i1];
-		const Particle& p2 = ps[i2];
-		const Particle& p3 = ps[i3];
-		const Particle& p4 = ps[i4];
-		VectorizedParticle& vp = vps[i >> 2];
-		const v128 wmask =
-			wasm_i32x4_make(-1, -(i2 < origNumP), -(i3 < origNumP), -(i4 < origNumP)); // mask out padding
-		vp.aeration = wasm_f32x4_make(p1.aeration, p2.aeration, p3.aeration, p4.aeration);
-		vp.posx = wasm_f32x4_make(p1.posx, p2.posx, p3.posx, p4.posx);
-		vp.posy = wasm_f32x4_make(p1.posy, p2.posy, p3.posy, p4.posy);
-		vp.velx = wasm_f32x4_make(p1.velx, p2.velx, p3.velx, p4.velx);
-		vp.vely = wasm_f32x4_make(p1.vely, p2.vely, p3.vely, p4.vely);
-		vp.gvel00 = wasm_f32x4_make(p1.gvel00, p2.gvel00, p3.gvel00, p4.gvel00);
-		vp.gvel01 = wasm_f32x4_make(p1.gvel01, p2.gvel01, p3.gvel01, p4.gvel01);
-		vp.gvel10 = wasm_f32x4_make(p1.gvel10, p2.gvel10, p3.gvel10, p4.gvel10);
-		vp.gvel11 = wasm_f32x4_make(p1.gvel11, p2.gvel11, p3.gvel11, p4.gvel11);
-		const v128 gx = wasm_f32x4_floor(vp.posx);
-		const v128 gy = wasm_f32x4_floor(vp.posy);
+// adds (subtracts) the lanes of v to the four cells of idx, in lane order so that lanes sharing
+// a cell add up
+inline void f32x4_scatter_add(f32* base, v128 idx, v128 v) {
+	base[wasm_i32x4_extract_lane(idx, 0)] += wasm_f32x4_extract_lane(v, 0);
+	base[wasm_i32x4_extract_lane(idx, 1)] += wasm_f32x4_extract_lane(v, 1);
+	base[wasm_i32x4_extract_lane(idx, 2)] += wasm_f32x4_extract_lane(v, 2);
+	base[wasm_i32x4_extract_lane(idx, 3)] += wasm_f32x4_extract_lane(v, 3);
+}
+
+inline void f32x4_scatter_sub(f32* base, v128 idx, v128 v) {
+	base[wasm_i32x4_extract_lane(idx, 0)] -= wasm_f32x4_extract_lane(v, 0);
+	base[wasm_i32x4_extract_lane(idx, 1)] -= wasm_f32x4_extract_lane(v, 1);
+	base[wasm_i32x4_extract_lane(idx, 2)] -= wasm_f32x4_extract_lane(v, 2);
+	base[wasm_i32x4_extract_lane(idx, 3)] -= wasm_f32x4_extract_lane(v, 3);
+}
+
+inline i64 toFixed(f32 v) {
+	return (i64) (v * FIXED_ONE);
+}
+
+inline void atomicAdd(i64* p, i64 d) {
+#ifdef WATER_THREADS
+	__atomic_fetch_add(p, d, __ATOMIC_RELAXED);
+#else
+	*p += d;
+#endif
+}
+
+// adds (subtracts) the lanes of v to the four cells of idx, into base or, accumulating in fixed
+// point, into fixed
+template <i32 ACC>
+inline void scatterAdd(f32* base, i64* fixed, v128 idx, v128 v) {
+	if (ACC == ACC_FLOAT) {
+		f32x4_scatter_add(base, idx, v);
+		return;
+	}
+	const i32 c[4] = {wasm_i32x4_extract_lane(idx, 0), wasm_i32x4_extract_lane(idx, 1),
+		wasm_i32x4_extract_lane(idx, 2), wasm_i32x4_extract_lane(idx, 3)};
+	i64 d[4] = {toFixed(wasm_f32x4_extract_lane(v, 0)), toFixed(wasm_f32x4_extract_lane(v, 1)),
+		toFixed(wasm_f32x4_extract_lane(v, 2)), toFixed(wasm_f32x4_extract_lane(v, 3))};
+	if (ACC == ACC_FIXED) {
+		for (i32 l = 0; l < 4; l++) {
+			fixed[c[l]] += d[l];
+		}
+		return;
+	}
+	// neighbours in a sorted quad often share cells, and their sums are exact too
+	for (i32 l = 0; l < 3; l++) {
+		if (c[l] == c[l + 1]) {
+			d[l + 1] += d[l];
+		} else {
+			atomicAdd(fixed + c[l], d[l]);
+		}
+	}
+	atomicAdd(fixed + c[3], d[3]);
+}
+
+template <i32 ACC>
+inline void scatterSub(f32* base, i64* fixed, v128 idx, v128 v) {
+	if (ACC == ACC_FLOAT) {
+		f32x4_scatter_sub(base, idx, v);
+	} else {
+		scatterAdd<ACC>(base, fixed, idx, wasm_f32x4_sub(wasm_f32x4_const_splat(0), v));
+	}
+}
+
+// quadratic B-spline weight of a cell at distance r from a particle, |r| <= 1.5
+inline f32 bspline(f32 r) {
+	const f32 a = fabsf(r);
+	const f32 t = 1.5f - a;
+	return a < 0.5f ? 0.75f - a * a : 0.5f * t * t;
+}
+
+// the same for four cells at any distance, zero from 1.5 on
+inline v128 f32x4_bspline(v128 r) {
+	const v128 a = wasm_f32x4_abs(r);
+	const v128 t = wasm_f32x4_max(wasm_f32x4_const_splat(0), wasm_f32x4_sub(wasm_f32x4_const_splat(1.5), a));
+	const v128 inner = wasm_f32x4_sub(wasm_f32x4_const_splat(0.75), wasm_f32x4_mul(a, a));
+	const v128 outer = wasm_f32x4_mul(wasm_f32x4_const_splat(0.5), wasm_f32x4_mul(t, t));
+	return wasm_v128_bitselect(inner, outer, wasm_f32x4_lt(a, wasm_f32x4_const_splat(0.5)));
+}
+
+// one simulation: its storage, settings and phases. the exports further down forward to the
+// current simulation of the calling thread
+struct Simulation {
+	// storage, see reserve()
+	Arena particleArena; // planes, ids, sort buffers and vertices
+	Arena cellArena; // grid planes, cellStarts and binStarts
+	Arena stencilArena; // vps
+	Arena binArena; // bins
+	Arena privateArenas[WorkerPool::MAX_THREADS];
+	i32 capP = 0; // a multiple of 16, so the padding to whole groups of lanes always fits
+	i32 capC = 0;
+
+	// one plane per particle field, see particlePlane()
+	f32* pdata[P_NUM_FIELDS];
+	f32* paeration;
+	f32* pposx;
+	f32* pposy;
+	f32* pvelx;
+	f32* pvely;
+	f32* pgvel00;
+	f32* pgvel01;
+	f32* pgvel10;
+	f32* pgvel11;
+	f32* pdens;
+	f32* vertices; // 4 floats per particle, see renderVertices()
+
+	// one plane per grid field, see cellPlane()
+	f32* gdata[G_NUM_FIELDS];
+	f32* gmass;
+	f32* gaeration;
+	f32* gvelx;
+	f32* gvely;
+	f32* gdvelx;
+	f32* gdvely;
+
+	VectorizedParticle* vps = nullptr; // stencil cache, not allocated in the fused stencil mode
+	bool fusedStencil = false;
+
+	// gather transfer, see setTransferMode()
+	i32 transferMode = TRANSFER_SCATTER;
+	bool gathering = false; // the mode of the current step, set by transferMass
+
+	// fixed point transfer, see Accumulation
+	Arena fixedArena;
+	i64* fixedGrid[G_NUM_FIELDS]; // all zero between phases, null until the first fixed point step
+	i32 accumulation = ACC_FLOAT; // of the current step, set by transferMass
+	BinnedParticle* bins = nullptr; // the particles by cell, rebuilt by every gather transferMass
+	i32* binStarts; // capC + 2 entries, cell c holds bins [binStarts[c], binStarts[c + 1])
+
+	// kernel instruction set, see setKernelIsa()
+	i32 isa = supportedIsa;
+	const WideKernels* wide = nullptr; // the kernels of the current step, null for the 4-lane ones
+
+	i32 numP = 0; // see particleCount()
+
+	i32 gridW = 0;
+	i32 gridH = 0;
+	i32 gridStride = 0; // gridW padded to GRID_ROW_ALIGN
+	i32 numC = 0; // gridStride * gridH
+	i32 gridOriginY = 0; // see setGridWindow()
+	i32 gridWalls = WALL_ALL;
+
+	WorkerPool pool;
+	// per-thread scatter targets, thread 0 uses gdata
+	f32* privateGrids[WorkerPool::MAX_THREADS][G_NUM_FIELDS];
+
+	// sparse grid, see kernels.h
+	Arena blockArena;
+	i32 capB = 0;
+	u8* blockMarks; // MAX_THREADS planes of capB, blocks marked by each thread
+	u8* blockActive; // 1 if the block was active in the last step
+	i32* activeBlocks;
+	i32* clearBlocks; // active in this or the last step
+	i32 blocksW = 0;
+	i32 blocksH = 0;
+	i32 numActive = 0;
+	i32 numClear = 0;
+	bool gridDirty = true; // clear every block on the next step
+
+	// colliders, see addCollider()
+	Collider colliders[MAX_COLLIDERS];
+	i32 numColliders = 0; // slots [0, numColliders) may be in use
+	i32 numStatic = 0;
+	i32 numMoving = 0;
+	Arena sdfArena;
+	f32* sdfDist; // signed distance to the nearest static collider
+	f32* sdfNormalX; // its outward normal
+	f32* sdfNormalY;
+	f32* sdfSlip; // 1 to keep the tangential velocity, 0 for no-slip
+	u8* blockNearStatic; // capB, blocks with a cell in the band of a static collider
+	bool sdfDirty = true;
+
+	// sources and sinks, see addEmitter()
+	Emitter emitters[MAX_EMITTERS];
+	i32 numEmitters = 0; // slots [0, numEmitters) may be in use
+	i32 numSinks = 0;
+	u32 emitCalls = 0; // keys the positions of each emission, reset with the jitter seed
+
+	// surface texture, see densityTexture(). the filter taps are kept for the grid and texture size
+	Arena textureArena;
+	u8* texture = nullptr;
+	i32 textureW = 0;
+	i32 textureH = 0;
+	i32 textureFormat = -1;
+	i32 textureGridW = 0;
+	i32 textureGridH = 0;
+	i32 textureThreads = 0;
+	i32 columnTapCount = 0;
+	i32 rowTapCount = 0;
+	i32 tapStride = 0; // textureW padded to 8
+	i32* columnTaps; // cell of tap k of texel column x at [k * tapStride + x]
+	f32* columnWeights;
+	i32* rowTaps; // row of tap k of texel row y at [y * rowTapCount + k]
+	f32* rowWeights;
+	f32* textureRows[WorkerPool::MAX_THREADS]; // mass and mass times aeration, two rows of gridStride
+
+	// spatial sorting
+	i32* pids; // stable particle ids, moved along with the particles
+	i32* perm; // perm[new index] = old index, of the last sort
+	i32* sortDst;
+	i32* sortBuf;
+	i32* cellStarts; // capC + 1 entries
+	i32 numIds = 0; // particles [0, numIds) have been given an id
+	i32 nextId = 0;
+	i32 sortInterval = 0; // sort every this many steps, 0 to disable
+	f32 sortThreshold = 0; // sort when disorder exceeds this, 0 to disable
+	i32 stepsSinceSort = 0;
+	f32 lastDisorder = 0; // fraction of quads whose stencils lie more than two rows apart
+	i32 disorderedQuads[WorkerPool::MAX_THREADS];
+
+	// anti-clustering jitter, a hash of (seed, call, particle index) so it does not depend on threads
+	u32 jitterSeed = 0;
+	u32 jitterCalls = 0;
+
+	// step kernels, see setFeatures()
+	i32 stepFeatures = FEATURE_ALL;
+	FluidParams params;
+
+	// adaptive substeps, see beginFrame(). particle and grid velocities are in cells per substep
+	f32 stepDt = 1; // base steps per substep
+	StepScales scales = stepScales(1, params, PRESSURE_EOS);
+	f32 cfl = 0; // cells a substep may move, 0 for fixed substeps
+	i32 minSubsteps = 1;
+	i32 maxSubsteps = 1;
+	f32 budgetMs = 0; // wall time the substeps of a frame may take, 0 for no limit
+	f32 substepMs = 0; // running average of the wall time of a substep
+	f64 frameStart = 0;
+	i32 frameSubsteps = 0;
+	f32 particleSpeed2 = 0; // largest squared velocities of the last g2p and updateGrid
+	f32 gridSpeed2 = 0;
+	f32 threadSpeed2[WorkerPool::MAX_THREADS];
+
+	// pressure projection, see setPressureSolver() and projectPressure(). the planes are zero outside
+	// the active blocks, so the neighbours of the unknowns need no bounds checks
+	i32 solver = PRESSURE_EOS;
+	i32 solverMaxIterations = 40;
+	f32 solverTolerance = 0.02;
+	Arena solverArena;
+	f32* spres = nullptr; // the pressure, the initial guess of the next solve
+	f32* sres; // residual
+	f32* sdir; // search direction
+	f32* sadir; // the operator applied to it
+	f32* sdiag; // neighbours of the unknown cells that are not walls, 0 in other cells
+	f32* sinvDiag; // the Jacobi preconditioner, 0 in other cells
+	i32 solverW = 0; // grid of the last solve
+	i32 solverH = 0;
+	u32 gridSteps = 0; // transferMass calls
+	u32 solvedStep = 0; // gridSteps at the last solve
+	i32 solverIterations = 0; // since beginFrame
+	f32 solverResidual = 0; // of the last solve
+	i32 unconvergedSolves = 0; // since setPressureSolver, see Stats
+	f64 threadSums[WorkerPool::MAX_THREADS][2];
+
+#ifdef WATER_STATS
+	// published by endFrame() from the times summed up during the frame
+	Stats frameStats;
+	f64 phaseMs[STAT_NUM_PHASES];
+
+	Arena traceArena;
+	TraceEvent* traceEvents = nullptr;
+	i32 traceCap = 0;
+	i32 traceCount = 0;
+	bool tracing = false;
+	f64 substepStart = 0;
+	Arena traceTextArena;
+	char* traceText = nullptr;
+	i32 traceTextSize = 0;
+
+	// full buffers drop the rest of the events
+	inline void traceEvent(i32 name, f64 start, f64 end) {
+		if (tracing && traceCount < traceCap) {
+			traceEvents[traceCount++] = {start, (f32) (end - start), name};
+		}
+	}
+
+	// times the export it is declared in, from there to its return. a substep spans transferMass()
+	// to the end of g2p()
+	class PhaseTimer {
+	public:
+		PhaseTimer(Simulation& sim, StatPhase phase) : sim(sim), phase(phase), start(nowMs()) {}
+
+		~PhaseTimer() {
+			const f64 end = nowMs();
+			sim.phaseMs[phase] += end - start;
+			sim.traceEvent(phase, start, end);
+			if (phase == STAT_G2P) {
+				sim.traceEvent(TRACE_SUBSTEP, sim.substepStart, end);
+			}
+		}
+
+	private:
+		Simulation& sim;
+		StatPhase phase;
+		f64 start;
+	};
+
+#define STAT_PHASE(phase) PhaseTimer phaseTimer(*this, phase)
+#define STAT_SUBSTEP_BEGIN() (substepStart = nowMs())
+#else
+#define STAT_PHASE(phase)
+#define STAT_SUBSTEP_BEGIN()
+#endif
+
+	// the largest of the per-thread maxima
+	inline f32 maxOverThreads(const f32* values) {
+		f32 m = 0;
+		for (i32 t = 0; t < pool.size(); t++) {
+			m = fmaxf(m, values[t]);
+		}
+		return m;
+	}
+
+	// quadratic B-spline weights and cell indices of the quad starting at particle i.
+	// lanes at or past numP are padding and get zero weights
+	inline void computeStencil(VectorizedParticle& vp, i32 i, i32 numP) {
+		const v128 igridWs = wasm_i32x4_splat(gridStride);
+		const v128 f05s = wasm_f32x4_const_splat(0.5);
+		const v128 f75s = wasm_f32x4_const_splat(0.75);
+		const v128 i1s = wasm_i32x4_const_splat(1);
+
+		const v128 wmask = wasm_i32x4_make(-1, -(i + 1 < numP), -(i + 2 < numP), -(i + 3 < numP));
+		const v128 posx = wasm_v128_load(pposx + i);
+		const v128 posy = wasm_v128_load(pposy + i);
+		const v128 gx = wasm_f32x4_floor(posx);
+		const v128 gy = wasm_f32x4_floor(posy);
 		const v128 igx = wasm_i32x4_trunc_sat_f32x4(gx);
 		const v128 igy = wasm_i32x4_trunc_sat_f32x4(gy);
-		const v128 cidx =
-			wasm_i32x4_add(wasm_i32x4_mul(wasm_i32x4_sub(igy, i1s), igridWs), wasm_i32x4_sub(igx, i1s));
 
-		vp.dx = wasm_f32x4_sub(wasm_f32x4_add(gx, f05s), vp.posx);
-		vp.dy = wasm_f32x4_sub(wasm_f32x4_add(gy, f05s), vp.posy);
+		vp.dx = wasm_f32x4_sub(wasm_f32x4_add(gx, f05s), posx);
+		vp.dy = wasm_f32x4_sub(wasm_f32x4_add(gy, f05s), posy);
 		const v128 wx0 = wasm_v128_and(wasm_f32x4_mul(f32x4_pow2(wasm_f32x4_add(vp.dx, f05s)), f05s), wmask);
 		const v128 wx1 = wasm_v128_and(wasm_f32x4_sub(f75s, f32x4_pow2(vp.dx)), wmask);
 		const v128 wx2 = wasm_v128_and(wasm_f32x4_mul(f32x4_pow2(wasm_f32x4_sub(vp.dx, f05s)), f05s), wmask);
@@ -201,7 +672,7 @@ WASM_EXPORT void p2g() {
 		vp.w21 = wasm_f32x4_mul(wy2, wx1);
 		vp.w22 = wasm_f32x4_mul(wy2, wx2);
 
-		vp.c00 = cidx;
+		vp.c00 = wasm_i32x4_add(wasm_i32x4_mul(wasm_i32x4_sub(igy, i1s), igridWs), wasm_i32x4_sub(igx, i1s));
 		vp.c01 = wasm_i32x4_add(vp.c00, i1s);
 		vp.c02 = wasm_i32x4_add(vp.c01, i1s);
 		vp.c10 = wasm_i32x4_add(vp.c00, igridWs);
@@ -210,637 +681,3156 @@ WASM_EXPORT void p2g() {
 		vp.c20 = wasm_i32x4_add(vp.c10, igridWs);
 		vp.c21 = wasm_i32x4_add(vp.c11, igridWs);
 		vp.c22 = wasm_i32x4_add(vp.c12, igridWs);
+	}
 
-		const v128 gv00x = wasm_f32x4_mul(vp.gvel00, vp.dx);
-		const v128 gv01y = wasm_f32x4_mul(vp.gvel01, vp.dy);
-		const v128 gv10x = wasm_f32x4_mul(vp.gvel10, vp.dx);
-		const v128 gv11y = wasm_f32x4_mul(vp.gvel11, vp.dy);
-
-		const v128 cvx = wasm_f32x4_add(vp.velx, wasm_f32x4_add(gv00x, gv01y));
-		const v128 cvy = wasm_f32x4_add(vp.vely, wasm_f32x4_add(gv10x, gv11y));
-
-		v128 ci;
-		v128 w;
-		v128 wvx;
-		v128 wvy;
-
-#define VISIT_CELL()                                   \
-	{                                                  \
-		v128 wa = wasm_f32x4_mul(w, vp.aeration);      \
-		Cell& c0 = cs[wasm_i32x4_extract_lane(ci, 0)]; \
-		Cell& c1 = cs[wasm_i32x4_extract_lane(ci, 1)]; \
-		Cell& c2 = cs[wasm_i32x4_extract_lane(ci, 2)]; \
-		Cell& c3 = cs[wasm_i32x4_extract_lane(ci, 3)]; \
-		c0.mass += wasm_f32x4_extract_lane(w, 0);      \
-		c1.mass += wasm_f32x4_extract_lane(w, 1);      \
-		c2.mass += wasm_f32x4_extract_lane(w, 2);      \
-		c3.mass += wasm_f32x4_extract_lane(w, 3);      \
-		c0.aeration += wasm_f32x4_extract_lane(wa, 0); \
-		c1.aeration += wasm_f32x4_extract_lane(wa, 1); \
-		c2.aeration += wasm_f32x4_extract_lane(wa, 2); \
-		c3.aeration += wasm_f32x4_extract_lane(wa, 3); \
-		c0.velx += wasm_f32x4_extract_lane(wvx, 0);    \
-		c1.velx += wasm_f32x4_extract_lane(wvx, 1);    \
-		c2.velx += wasm_f32x4_extract_lane(wvx, 2);    \
-		c3.velx += wasm_f32x4_extract_lane(wvx, 3);    \
-		c0.vely += wasm_f32x4_extract_lane(wvy, 0);    \
-		c1.vely += wasm_f32x4_extract_lane(wvy, 1);    \
-		c2.vely += wasm_f32x4_extract_lane(wvy, 2);    \
-		c3.vely += wasm_f32x4_extract_lane(wvy, 3);    \
-	}
-
-		ci = vp.c00;
-		w = vp.w00;
-		wvx = wasm_f32x4_mul(w, wasm_f32x4_sub(wasm_f32x4_sub(cvx, vp.gvel00), vp.gvel01));
-		wvy = wasm_f32x4_mul(w, wasm_f32x4_sub(wasm_f32x4_sub(cvy, vp.gvel10), vp.gvel11));
-		VISIT_CELL();
-
-		ci = vp.c01;
-		w = vp.w01;
-		wvx = wasm_f32x4_mul(w, wasm_f32x4_sub(cvx, vp.gvel01));
-		wvy = wasm_f32x4_mul(w, wasm_f32x4_sub(cvy, vp.gvel11));
-		VISIT_CELL();
-
-		ci = vp.c02;
-		w = vp.w02;
-		wvx = wasm_f32x4_mul(w, wasm_f32x4_sub(wasm_f32x4_add(cvx, vp.gvel00), vp.gvel01));
-		wvy = wasm_f32x4_mul(w, wasm_f32x4_sub(wasm_f32x4_add(cvy, vp.gvel10), vp.gvel11));
-		VISIT_CELL();
-
-		ci = vp.c10;
-		w = vp.w10;
-		wvx = wasm_f32x4_mul(w, wasm_f32x4_sub(cvx, vp.gvel00));
-		wvy = wasm_f32x4_mul(w, wasm_f32x4_sub(cvy, vp.gvel10));
-		VISIT_CELL();
-
-		ci = vp.c11;
-		w = vp.w11;
-		wvx = wasm_f32x4_mul(w, cvx);
-		wvy = wasm_f32x4_mul(w, cvy);
-		VISIT_CELL();
-
-		ci = vp.c12;
-		w = vp.w12;
-		wvx = wasm_f32x4_mul(w, wasm_f32x4_add(cvx, vp.gvel00));
-		wvy = wasm_f32x4_mul(w, wasm_f32x4_add(cvy, vp.gvel10));
-		VISIT_CELL();
-
-		ci = vp.c20;
-		w = vp.w20;
-		wvx = wasm_f32x4_mul(w, wasm_f32x4_add(wasm_f32x4_sub(cvx, vp.gvel00), vp.gvel01));
-		wvy = wasm_f32x4_mul(w, wasm_f32x4_add(wasm_f32x4_sub(cvy, vp.gvel10), vp.gvel11));
-		VISIT_CELL();
-
-		ci = vp.c21;
-		w = vp.w21;
-		wvx = wasm_f32x4_mul(w, wasm_f32x4_add(cvx, vp.gvel01));
-		wvy = wasm_f32x4_mul(w, wasm_f32x4_add(cvy, vp.gvel11));
-		VISIT_CELL();
-
-		ci = vp.c22;
-		w = vp.w22;
-		wvx = wasm_f32x4_mul(w, wasm_f32x4_add(wasm_f32x4_add(cvx, vp.gvel00), vp.gvel01));
-		wvy = wasm_f32x4_mul(w, wasm_f32x4_add(wasm_f32x4_add(cvy, vp.gvel10), vp.gvel11));
-		VISIT_CELL();
+	// calls f(y, x0, x1) for every row y of block b, whose cells are [x0, x1) of that row. the planes
+	// hold BLOCK_SIZE cells from x0 on in any case, so vector loops may run over all of them
+	template <class F>
+	inline void forBlockRows(i32 b, F&& f) {
+		const i32 x0 = (b % blocksW) << BLOCK_SHIFT;
+		const i32 y0 = (b / blocksW) << BLOCK_SHIFT;
+		const i32 x1 = mini(x0 + BLOCK_SIZE, gridW);
+		const i32 y1 = mini(y0 + BLOCK_SIZE, gridH);
+		for (i32 y = y0; y < y1; y++) {
+			f(y, x0, x1);
+		}
+	}
 
-#undef VISIT_CELL
+	inline bool onBorder(i32 b) {
+		const i32 bx = b % blocksW;
+		const i32 by = b / blocksW;
+		return bx == 0 || bx == blocksW - 1 || by == 0 || by == blocksH - 1;
 	}
 
-	// normalize aeration
-	for (i32 i = 0; i < numC; i++) {
-		Cell& c = cs[i];
-		if (c.mass > 0) {
-			c.aeration /= c.mass;
-		}
-	}
-
-	// symmetric boundary condition
-	for (i32 i = 0; i < gridH; i++) {
-		i32 n = gridW - 1;
-		i32 off = i * gridW;
-		mirror(off, off + 1);
-		mirror(off + n, off + n - 1);
-	}
-	for (i32 j = 0; j < gridW; j++) {
-		i32 n = gridH - 1;
-		mirror(j, j + gridW);
-		mirror(j + n * gridW, j + (n - 1) * gridW);
-	}
-
-	// apply pressure
-	for (i32 i = 0; i < numP; i += 4) {
-		i32 i1 = i;
-		i32 i2 = i + 1;
-		i32 i3 = i + 2;
-		i32 i4 = i + 3;
-		Particle& p1 = ps[i1];
-		Particle& p2 = ps[i2];
-		Particle& p3 = ps[i3];
-		Particle& p4 = ps[i4];
-		VectorizedParticle& vp = vps[i >> 2];
-
-		v128 density = wasm_f32x4_const_splat(0);
-		v128 aeration = wasm_f32x4_const_splat(0);
-
-		Cell& c000 = cs[wasm_i32x4_extract_lane(vp.c00, 0)];
-		Cell& c001 = cs[wasm_i32x4_extract_lane(vp.c00, 1)];
-		Cell& c002 = cs[wasm_i32x4_extract_lane(vp.c00, 2)];
-		Cell& c003 = cs[wasm_i32x4_extract_lane(vp.c00, 3)];
-		Cell& c010 = cs[wasm_i32x4_extract_lane(vp.c01, 0)];
-		Cell& c011 = cs[wasm_i32x4_extract_lane(vp.c01, 1)];
-		Cell& c012 = cs[wasm_i32x4_extract_lane(vp.c01, 2)];
-		Cell& c013 = cs[wasm_i32x4_extract_lane(vp.c01, 3)];
-		Cell& c020 = cs[wasm_i32x4_extract_lane(vp.c02, 0)];
-		Cell& c021 = cs[wasm_i32x4_extract_lane(vp.c02, 1)];
-		Cell& c022 = cs[wasm_i32x4_extract_lane(vp.c02, 2)];
-		Cell& c023 = cs[wasm_i32x4_extract_lane(vp.c02, 3)];
-		Cell& c100 = cs[wasm_i32x4_extract_lane(vp.c10, 0)];
-		Cell& c101 = cs[wasm_i32x4_extract_lane(vp.c10, 1)];
-		Cell& c102 = cs[wasm_i32x4_extract_lane(vp.c10, 2)];
-		Cell& c103 = cs[wasm_i32x4_extract_lane(vp.c10, 3)];
-		Cell& c110 = cs[wasm_i32x4_extract_lane(vp.c11, 0)];
-		Cell& c111 = cs[wasm_i32x4_extract_lane(vp.c11, 1)];
-		Cell& c112 = cs[wasm_i32x4_extract_lane(vp.c11, 2)];
-		Cell& c113 = cs[wasm_i32x4_extract_lane(vp.c11, 3)];
-		Cell& c120 = cs[wasm_i32x4_extract_lane(vp.c12, 0)];
-		Cell& c121 = cs[wasm_i32x4_extract_lane(vp.c12, 1)];
-		Cell& c122 = cs[wasm_i32x4_extract_lane(vp.c12, 2)];
-		Cell& c123 = cs[wasm_i32x4_extract_lane(vp.c12, 3)];
-		Cell& c200 = cs[wasm_i32x4_extract_lane(vp.c20, 0)];
-		Cell& c201 = cs[wasm_i32x4_extract_lane(vp.c20, 1)];
-		Cell& c202 = cs[wasm_i32x4_extract_lane(vp.c20, 2)];
-		Cell& c203 = cs[wasm_i32x4_extract_lane(vp.c20, 3)];
-		Cell& c210 = cs[wasm_i32x4_extract_lane(vp.c21, 0)];
-		Cell& c211 = cs[wasm_i32x4_extract_lane(vp.c21, 1)];
-		Cell& c212 = cs[wasm_i32x4_extract_lane(vp.c21, 2)];
-		Cell& c213 = cs[wasm_i32x4_extract_lane(vp.c21, 3)];
-		Cell& c220 = cs[wasm_i32x4_extract_lane(vp.c22, 0)];
-		Cell& c221 = cs[wasm_i32x4_extract_lane(vp.c22, 1)];
-		Cell& c222 = cs[wasm_i32x4_extract_lane(vp.c22, 2)];
-		Cell& c223 = cs[wasm_i32x4_extract_lane(vp.c22, 3)];
-
-		density = wasm_f32x4_add(
-			density, wasm_f32x4_mul(vp.w00, wasm_f32x4_make(c000.mass, c001.mass, c002.mass, c003.mass)));
-		density = wasm_f32x4_add(
-			density, wasm_f32x4_mul(vp.w01, wasm_f32x4_make(c010.mass, c011.mass, c012.mass, c013.mass)));
-		density = wasm_f32x4_add(
-			density, wasm_f32x4_mul(vp.w02, wasm_f32x4_make(c020.mass, c021.mass, c022.mass, c023.mass)));
-		density = wasm_f32x4_add(
-			density, wasm_f32x4_mul(vp.w10, wasm_f32x4_make(c100.mass, c101.mass, c102.mass, c103.mass)));
-		density = wasm_f32x4_add(
-			density, wasm_f32x4_mul(vp.w11, wasm_f32x4_make(c110.mass, c111.mass, c112.mass, c113.mass)));
-		density = wasm_f32x4_add(
-			density, wasm_f32x4_mul(vp.w12, wasm_f32x4_make(c120.mass, c121.mass, c122.mass, c123.mass)));
-		density = wasm_f32x4_add(
-			density, wasm_f32x4_mul(vp.w20, wasm_f32x4_make(c200.mass, c201.mass, c202.mass, c203.mass)));
-		density = wasm_f32x4_add(
-			density, wasm_f32x4_mul(vp.w21, wasm_f32x4_make(c210.mass, c211.mass, c212.mass, c213.mass)));
-		density = wasm_f32x4_add(
-			density, wasm_f32x4_mul(vp.w22, wasm_f32x4_make(c220.mass, c221.mass, c222.mass, c223.mass)));
-		aeration = wasm_f32x4_add(aeration,
-			wasm_f32x4_mul(
-				vp.w00, wasm_f32x4_make(c000.aeration, c001.aeration, c002.aeration, c003.aeration)));
-		aeration = wasm_f32x4_add(aeration,
-			wasm_f32x4_mul(
-				vp.w01, wasm_f32x4_make(c010.aeration, c011.aeration, c012.aeration, c013.aeration)));
-		aeration = wasm_f32x4_add(aeration,
-			wasm_f32x4_mul(
-				vp.w02, wasm_f32x4_make(c020.aeration, c021.aeration, c022.aeration, c023.aeration)));
-		aeration = wasm_f32x4_add(aeration,
-			wasm_f32x4_mul(
-				vp.w10, wasm_f32x4_make(c100.aeration, c101.aeration, c102.aeration, c103.aeration)));
-		aeration = wasm_f32x4_add(aeration,
-			wasm_f32x4_mul(
-				vp.w11, wasm_f32x4_make(c110.aeration, c111.aeration, c112.aeration, c113.aeration)));
-		aeration = wasm_f32x4_add(aeration,
-			wasm_f32x4_mul(
-				vp.w12, wasm_f32x4_make(c120.aeration, c121.aeration, c122.aeration, c123.aeration)));
-		aeration = wasm_f32x4_add(aeration,
-			wasm_f32x4_mul(
-				vp.w20, wasm_f32x4_make(c200.aeration, c201.aeration, c202.aeration, c203.aeration)));
-		aeration = wasm_f32x4_add(aeration,
-			wasm_f32x4_mul(
-				vp.w21, wasm_f32x4_make(c210.aeration, c211.aeration, c212.aeration, c213.aeration)));
-		aeration = wasm_f32x4_add(aeration,
-			wasm_f32x4_mul(
-				vp.w22, wasm_f32x4_make(c220.aeration, c221.aeration, c222.aeration, c223.aeration)));
-		vp.density = density;
-
-		p1.dens = wasm_f32x4_extract_lane(density, 0);
-		p2.dens = wasm_f32x4_extract_lane(density, 1);
-		p3.dens = wasm_f32x4_extract_lane(density, 2);
-		p4.dens = wasm_f32x4_extract_lane(density, 3);
-
-		const v128 newAeration = wasm_f32x4_mul(wasm_f32x4_const_splat(AERATION_DAMP),
-			wasm_f32x4_add(vp.aeration,
-				wasm_f32x4_mul(
-					wasm_f32x4_sub(aeration, vp.aeration), wasm_f32x4_const_splat(AERATION_BLUR))));
-		vp.aeration = newAeration;
-
-		v128 pressure =
-			wasm_f32x4_mul(wasm_f32x4_sub(wasm_f32x4_mul(density, wasm_f32x4_const_splat(INV_DENSITY)),
-							   wasm_f32x4_const_splat(1)),
-				wasm_f32x4_const_splat(5));
-		pressure = wasm_f32x4_max(wasm_f32x4_const_splat(0), pressure);
-
-		v128 volume = wasm_f32x4_div(wasm_f32x4_const_splat(1), density);
-		volume = wasm_v128_and(volume, wasm_f32x4_gt(density, wasm_f32x4_const_splat(0)));
-		v128 coeff = wasm_f32x4_mul(volume, wasm_f32x4_mul(wasm_f32x4_const_splat(-4), pressure));
-		v128 coeffx = wasm_f32x4_mul(coeff, vp.dx);
-		v128 coeffy = wasm_f32x4_mul(coeff, vp.dy);
-
-		v128 coeffx0 = wasm_f32x4_sub(coeffx, coeff);
-		v128 coeffx1 = coeffx;
-		v128 coeffx2 = wasm_f32x4_add(coeffx, coeff);
-		v128 coeffy0 = wasm_f32x4_sub(coeffy, coeff);
-		v128 coeffy1 = coeffy;
-		v128 coeffy2 = wasm_f32x4_add(coeffy, coeff);
-
-		v128 dvx;
-		v128 dvy;
-
-		dvx = wasm_f32x4_mul(vp.w00, coeffx0);
-		dvy = wasm_f32x4_mul(vp.w00, coeffy0);
-		c000.dvelx -= wasm_f32x4_extract_lane(dvx, 0);
-		c000.dvely -= wasm_f32x4_extract_lane(dvy, 0);
-		c001.dvelx -= wasm_f32x4_extract_lane(dvx, 1);
-		c001.dvely -= wasm_f32x4_extract_lane(dvy, 1);
-		c002.dvelx -= wasm_f32x4_extract_lane(dvx, 2);
-		c002.dvely -= wasm_f32x4_extract_lane(dvy, 2);
-		c003.dvelx -= wasm_f32x4_extract_lane(dvx, 3);
-		c003.dvely -= wasm_f32x4_extract_lane(dvy, 3);
-
-		dvx = wasm_f32x4_mul(vp.w01, coeffx1);
-		dvy = wasm_f32x4_mul(vp.w01, coeffy0);
-		c010.dvelx -= wasm_f32x4_extract_lane(dvx, 0);
-		c010.dvely -= wasm_f32x4_extract_lane(dvy, 0);
-		c011.dvelx -= wasm_f32x4_extract_lane(dvx, 1);
-		c011.dvely -= wasm_f32x4_extract_lane(dvy, 1);
-		c012.dvelx -= wasm_f32x4_extract_lane(dvx, 2);
-		c012.dvely -= wasm_f32x4_extract_lane(dvy, 2);
-		c013.dvelx -= wasm_f32x4_extract_lane(dvx, 3);
-		c013.dvely -= wasm_f32x4_extract_lane(dvy, 3);
-
-		dvx = wasm_f32x4_mul(vp.w02, coeffx2);
-		dvy = wasm_f32x4_mul(vp.w02, coeffy0);
-		c020.dvelx -= wasm_f32x4_extract_lane(dvx, 0);
-		c020.dvely -= wasm_f32x4_extract_lane(dvy, 0);
-		c021.dvelx -= wasm_f32x4_extract_lane(dvx, 1);
-		c021.dvely -= wasm_f32x4_extract_lane(dvy, 1);
-		c022.dvelx -= wasm_f32x4_extract_lane(dvx, 2);
-		c022.dvely -= wasm_f32x4_extract_lane(dvy, 2);
-		c023.dvelx -= wasm_f32x4_extract_lane(dvx, 3);
-		c023.dvely -= wasm_f32x4_extract_lane(dvy, 3);
-
-		dvx = wasm_f32x4_mul(vp.w10, coeffx0);
-		dvy = wasm_f32x4_mul(vp.w10, coeffy1);
-		c100.dvelx -= wasm_f32x4_extract_lane(dvx, 0);
-		c100.dvely -= wasm_f32x4_extract_lane(dvy, 0);
-		c101.dvelx -= wasm_f32x4_extract_lane(dvx, 1);
-		c101.dvely -= wasm_f32x4_extract_lane(dvy, 1);
-		c102.dvelx -= wasm_f32x4_extract_lane(dvx, 2);
-		c102.dvely -= wasm_f32x4_extract_lane(dvy, 2);
-		c103.dvelx -= wasm_f32x4_extract_lane(dvx, 3);
-		c103.dvely -= wasm_f32x4_extract_lane(dvy, 3);
-
-		dvx = wasm_f32x4_mul(vp.w11, coeffx1);
-		dvy = wasm_f32x4_mul(vp.w11, coeffy1);
-		c110.dvelx -= wasm_f32x4_extract_lane(dvx, 0);
-		c110.dvely -= wasm_f32x4_extract_lane(dvy, 0);
-		c111.dvelx -= wasm_f32x4_extract_lane(dvx, 1);
-		c111.dvely -= wasm_f32x4_extract_lane(dvy, 1);
-		c112.dvelx -= wasm_f32x4_extract_lane(dvx, 2);
-		c112.dvely -= wasm_f32x4_extract_lane(dvy, 2);
-		c113.dvelx -= wasm_f32x4_extract_lane(dvx, 3);
-		c113.dvely -= wasm_f32x4_extract_lane(dvy, 3);
-
-		dvx = wasm_f32x4_mul(vp.w12, coeffx2);
-		dvy = wasm_f32x4_mul(vp.w12, coeffy1);
-		c120.dvelx -= wasm_f32x4_extract_lane(dvx, 0);
-		c120.dvely -= wasm_f32x4_extract_lane(dvy, 0);
-		c121.dvelx -= wasm_f32x4_extract_lane(dvx, 1);
-		c121.dvely -= wasm_f32x4_extract_lane(dvy, 1);
-		c122.dvelx -= wasm_f32x4_extract_lane(dvx, 2);
-		c122.dvely -= wasm_f32x4_extract_lane(dvy, 2);
-		c123.dvelx -= wasm_f32x4_extract_lane(dvx, 3);
-		c123.dvely -= wasm_f32x4_extract_lane(dvy, 3);
-
-		dvx = wasm_f32x4_mul(vp.w20, coeffx0);
-		dvy = wasm_f32x4_mul(vp.w20, coeffy2);
-		c200.dvelx -= wasm_f32x4_extract_lane(dvx, 0);
-		c200.dvely -= wasm_f32x4_extract_lane(dvy, 0);
-		c201.dvelx -= wasm_f32x4_extract_lane(dvx, 1);
-		c201.dvely -= wasm_f32x4_extract_lane(dvy, 1);
-		c202.dvelx -= wasm_f32x4_extract_lane(dvx, 2);
-		c202.dvely -= wasm_f32x4_extract_lane(dvy, 2);
-		c203.dvelx -= wasm_f32x4_extract_lane(dvx, 3);
-		c203.dvely -= wasm_f32x4_extract_lane(dvy, 3);
-
-		dvx = wasm_f32x4_mul(vp.w21, coeffx1);
-		dvy = wasm_f32x4_mul(vp.w21, coeffy2);
-		c210.dvelx -= wasm_f32x4_extract_lane(dvx, 0);
-		c210.dvely -= wasm_f32x4_extract_lane(dvy, 0);
-		c211.dvelx -= wasm_f32x4_extract_lane(dvx, 1);
-		c211.dvely -= wasm_f32x4_extract_lane(dvy, 1);
-		c212.dvelx -= wasm_f32x4_extract_lane(dvx, 2);
-		c212.dvely -= wasm_f32x4_extract_lane(dvy, 2);
-		c213.dvelx -= wasm_f32x4_extract_lane(dvx, 3);
-		c213.dvely -= wasm_f32x4_extract_lane(dvy, 3);
-
-		dvx = wasm_f32x4_mul(vp.w22, coeffx2);
-		dvy = wasm_f32x4_mul(vp.w22, coeffy2);
-		c220.dvelx -= wasm_f32x4_extract_lane(dvx, 0);
-		c220.dvely -= wasm_f32x4_extract_lane(dvy, 0);
-		c221.dvelx -= wasm_f32x4_extract_lane(dvx, 1);
-		c221.dvely -= wasm_f32x4_extract_lane(dvy, 1);
-		c222.dvelx -= wasm_f32x4_extract_lane(dvx, 2);
-		c222.dvely -= wasm_f32x4_extract_lane(dvy, 2);
-		c223.dvelx -= wasm_f32x4_extract_lane(dvx, 3);
-		c223.dvely -= wasm_f32x4_extract_lane(dvy, 3);
-	}
-
-	// symmetric boundary condition
-	for (i32 i = 0; i < gridH; i++) {
-		i32 n = gridW - 1;
-		i32 off = i * gridW;
-		mirror2(off, off + 1, true, false);
-		mirror2(off + n, off + n - 1, true, false);
-	}
-	for (i32 j = 0; j < gridW; j++) {
-		i32 n = gridH - 1;
-		mirror2(j, j + gridW, false, true);
-		mirror2(j + n * gridW, j + (n - 1) * gridW, false, true);
+	inline void mirror(i32 c1, i32 c2) {
+		const f32 m = gmass[c1] + gmass[c2];
+		const f32 mx = gvelx[c1] + gvelx[c2];
+		const f32 my = gvely[c1] + gvely[c2];
+		gmass[c1] = m;
+		gmass[c2] = m;
+		gvelx[c1] = mx;
+		gvelx[c2] = mx;
+		gvely[c1] = my;
+		gvely[c2] = my;
 	}
-}
 
-WASM_EXPORT void updateGrid(
-	f32 gravityX, f32 gravityY, f32 mouseX, f32 mouseY, f32 dmouseX, f32 dmouseY, f32 radius) {
-	v128 gravityXs = wasm_f32x4_splat(gravityX);
-	v128 gravityYs = wasm_f32x4_splat(gravityY);
-	v128 mouseXs = wasm_f32x4_splat(mouseX);
-	v128 mouseYs = wasm_f32x4_splat(mouseY);
-	v128 dmouseXs = wasm_f32x4_splat(dmouseX);
-	v128 dmouseYs = wasm_f32x4_splat(dmouseY);
-	v128 rad2s = wasm_f32x4_splat(radius * radius);
-	v128 invRs = wasm_f32x4_splat(1 / radius);
-
-	// momentum to velocity
-	{
-		for (i32 i = 0; i < gridH; i++) {
-			i32 idx = i * gridW;
-			for (i32 j = 0; j < gridW; j += 4) {
-				Cell& c1 = cs[idx++];
-				Cell& c2 = cs[idx++];
-				Cell& c3 = cs[idx++];
-				Cell& c4 = cs[idx++];
-				v128 mass = wasm_f32x4_make(c1.mass, c2.mass, c3.mass, c4.mass);
-				v128 mask = wasm_f32x4_gt(mass, wasm_f32x4_const_splat(0));
-				v128 invM = wasm_f32x4_div(wasm_f32x4_const_splat(1), mass);
-				v128 mx = wasm_f32x4_add(wasm_f32x4_make(c1.velx, c2.velx, c3.velx, c4.velx),
-					wasm_f32x4_make(c1.dvelx, c2.dvelx, c3.dvelx, c4.dvelx));
-				v128 my = wasm_f32x4_add(wasm_f32x4_make(c1.vely, c2.vely, c3.vely, c4.vely),
-					wasm_f32x4_make(c1.dvely, c2.dvely, c3.dvely, c4.dvely));
-				v128 vx = wasm_f32x4_add(wasm_f32x4_mul(mx, invM), gravityXs);
-				v128 vy = wasm_f32x4_add(wasm_f32x4_mul(my, invM), gravityYs);
-
-				// mouse interaction
-				v128 dx = wasm_f32x4_sub(mouseXs, wasm_f32x4_make(j + 0.5, j + 1.5, j + 2.5, j + 3.5));
-				v128 dy = wasm_f32x4_sub(mouseYs, wasm_f32x4_make(i + 0.5, i + 0.5, i + 0.5, i + 0.5));
-				v128 r2 = wasm_f32x4_add(f32x4_pow2(dx), f32x4_pow2(dy));
-				v128 mask2 = wasm_f32x4_lt(r2, rad2s);
-				v128 r = wasm_f32x4_sqrt(r2);
-				v128 coeff = wasm_f32x4_min(wasm_f32x4_const_splat(1),
-					wasm_f32x4_sub(wasm_f32x4_const_splat(2), wasm_f32x4_mul(r, invRs)));
-				coeff = wasm_v128_and(coeff, mask2);
-				vx = wasm_f32x4_add(vx, wasm_f32x4_mul(coeff, wasm_f32x4_sub(dmouseXs, vx)));
-				vy = wasm_f32x4_add(vy, wasm_f32x4_mul(coeff, wasm_f32x4_sub(dmouseYs, vy)));
-
-				vx = wasm_v128_and(vx, mask);
-				vy = wasm_v128_and(vy, mask);
-
-				c1.velx = wasm_f32x4_extract_lane(vx, 0);
-				c1.vely = wasm_f32x4_extract_lane(vy, 0);
-				if (j + 1 < gridW) {
-					c2.velx = wasm_f32x4_extract_lane(vx, 1);
-					c2.vely = wasm_f32x4_extract_lane(vy, 1);
-					if (j + 2 < gridW) {
-						c3.velx = wasm_f32x4_extract_lane(vx, 2);
-						c3.vely = wasm_f32x4_extract_lane(vy, 2);
-						if (j + 3 < gridW) {
-							c4.velx = wasm_f32x4_extract_lane(vx, 3);
-							c4.vely = wasm_f32x4_extract_lane(vy, 3);
-						}
-					}
+	inline void mirror2(i32 c1, i32 c2, bool flipx, bool flipy) {
+		if (flipx) {
+			const f32 subx = gdvelx[c1] - gdvelx[c2];
+			gdvelx[c1] = subx;
+			gdvelx[c2] = -subx;
+		} else {
+			const f32 sumx = gdvelx[c1] + gdvelx[c2];
+			gdvelx[c1] = sumx;
+			gdvelx[c2] = sumx;
+		}
+		if (flipy) {
+			const f32 suby = gdvely[c1] - gdvely[c2];
+			gdvely[c1] = suby;
+			gdvely[c2] = -suby;
+		} else {
+			const f32 sumy = gdvely[c1] + gdvely[c2];
+			gdvely[c1] = sumy;
+			gdvely[c2] = sumy;
+		}
+	}
+
+	// moves the fixed point sums of the fields [f0, f1) in the BLOCK_SIZE cells from c on into the
+	// float planes, leaving zeros behind
+	inline void convertFixedRow(i32 c, i32 f0, i32 f1) {
+		for (i32 f = f0; f < f1; f++) {
+			if (f == G_AERATION && !(stepFeatures & FEATURE_AERATION))
+				continue;
+			for (i32 i = c; i < c + BLOCK_SIZE; i++) {
+				gdata[f][i] = (f32) (fixedGrid[f][i] * FIXED_INV);
+				fixedGrid[f][i] = 0;
+			}
+		}
+	}
+
+	// zeroes the BLOCK_SIZE cells from c on in every plane of grid the step writes
+	inline void clearBlockRow(f32* const* grid, i32 c) {
+		const v128 zeros = wasm_f32x4_const_splat(0);
+		for (i32 f = 0; f < G_NUM_FIELDS; f++) {
+			if (f == G_AERATION && !(stepFeatures & FEATURE_AERATION))
+				continue;
+			for (i32 k = 0; k < BLOCK_SIZE; k += 4) {
+				wasm_v128_store(grid[f] + c + k, zeros);
+			}
+		}
+	}
+
+	// clears thread t's share of the blocks to clear that are not active, for the transfers that
+	// write every cell of the active blocks into gdata
+	void clearStaleBlocks(i32 t) {
+		i32 begin;
+		i32 end;
+		split(numClear, t, pool.size(), begin, end);
+		for (i32 k = begin; k < end; k++) {
+			if (!blockActive[clearBlocks[k]]) {
+				forBlockRows(clearBlocks[k], [&](i32 y, i32 x0, i32) {
+					clearBlockRow(gdata, y * gridStride + x0);
+				});
+			}
+		}
+	}
+
+	// calls f(p, rx, ry, w) for the particles binned in the 3x3 cells around each of the four cells
+	// from x on row y, whose centres are cx. rx and ry are the distances of those cells to p, w their
+	// weights (zero for the cells p does not reach)
+	template <class F>
+	inline void forBinnedNear(i32 y, i32 x, v128 cx, F&& f) {
+		const f32 cy = y + 0.5f;
+		const i32 x0 = maxi(x - 1, 0);
+		const i32 x1 = mini(x + 5, gridW);
+		for (i32 yy = maxi(y - 1, 0); yy <= mini(y + 1, gridH - 1); yy++) {
+			const i32 row = yy * gridStride;
+			const i32 end = binStarts[row + x1];
+			for (i32 k = binStarts[row + x0]; k < end; k++) {
+				const BinnedParticle& p = bins[k];
+				const f32 ry = cy - p.y;
+				const v128 rx = wasm_f32x4_sub(cx, wasm_f32x4_splat(p.x));
+				const v128 w = wasm_f32x4_mul(f32x4_bspline(rx), wasm_f32x4_splat(bspline(ry)));
+				f(p, rx, ry, w);
+			}
+		}
+	}
+
+	iptr particlePlane(i32 field) {
+		return ptr(pdata[field]);
+	}
+
+	iptr cellPlane(i32 field) {
+		return ptr(gdata[field]);
+	}
+
+	i32 cellStride() {
+		return gridStride;
+	}
+
+	// grids of capC cells for threads [1, n), false if out of memory
+	bool allocPrivateGrids(i32 n) {
+		for (i32 t = 1; t < WorkerPool::MAX_THREADS; t++) {
+			f32** grid = privateGrids[t];
+			if (t < n && !grid[0]) {
+				if (!privateArenas[t].init(G_NUM_FIELDS * Arena::footprint<f32>(capC)))
+					return false;
+				for (i32 f = 0; f < G_NUM_FIELDS; f++) {
+					grid[f] = privateArenas[t].take<f32>(capC);
+				}
+			} else if (t >= n && grid[0]) {
+				privateArenas[t].release();
+				for (i32 f = 0; f < G_NUM_FIELDS; f++) {
+					grid[f] = nullptr;
 				}
 			}
 		}
+		return true;
 	}
 
-	// boundary condition
-	{
-		i32 idx = 0;
-		for (i32 i = 0; i < gridH; i++) {
-			for (i32 j = 0; j < gridW; j++) {
-				Cell& c = cs[idx++];
-				if (j == 0)
-					c.velx = -cs[idx + 1].velx;
-				if (j == gridW - 1)
-					c.velx = -cs[idx - 1].velx;
-				if (i == 0)
-					c.vely = -cs[idx + gridW].vely;
-				if (i == gridH - 1)
-					c.vely = -cs[idx - gridW].vely;
-				if (j == 0 && c.velx < 0)
-					c.velx *= -1;
-				if (j == gridW - 1 && c.velx > 0)
-					c.velx *= -1;
-				if (i == 0 && c.vely < 0)
-					c.vely *= -1;
-				if (i == gridH - 1 && c.vely > 0)
-					c.vely *= -1;
+	void setThreads(i32 n) {
+		pool.resize(n);
+		if (!allocPrivateGrids(pool.size())) {
+			pool.resize(1);
+			allocPrivateGrids(1);
+		}
+		gridDirty = true;
+	}
+
+	i32 threads() {
+		return pool.size();
+	}
+
+	bool reserveParticles(i32 n) {
+		Arena a;
+		if (!a.init((P_NUM_FIELDS + 4) * Arena::footprint<f32>(n) + 4 * Arena::footprint<i32>(n)))
+			return false;
+		const i32 keep = mini(mini(numP, capP), n);
+		for (i32 f = 0; f < P_NUM_FIELDS; f++) {
+			f32* plane = a.take<f32>(n);
+			if (keep > 0) {
+				memcpy(plane, pdata[f], keep * sizeof(f32));
 			}
+			pdata[f] = plane;
 		}
+		i32* ids = a.take<i32>(n);
+		i32* p = a.take<i32>(n);
+		numIds = mini(numIds, keep);
+		if (keep > 0) {
+			memcpy(ids, pids, numIds * sizeof(i32));
+			memcpy(p, perm, keep * sizeof(i32));
+		}
+		pids = ids;
+		perm = p;
+		sortDst = a.take<i32>(n);
+		sortBuf = a.take<i32>(n);
+		vertices = a.take<f32>(4 * n);
+		particleArena.swap(a);
+
+		paeration = pdata[P_AERATION];
+		pposx = pdata[P_POS_X];
+		pposy = pdata[P_POS_Y];
+		pvelx = pdata[P_VEL_X];
+		pvely = pdata[P_VEL_Y];
+		pgvel00 = pdata[P_GVEL_00];
+		pgvel01 = pdata[P_GVEL_01];
+		pgvel10 = pdata[P_GVEL_10];
+		pgvel11 = pdata[P_GVEL_11];
+		pdens = pdata[P_DENSITY];
+
+		// the stencil cache and the bins are reallocated for the new capacity on the next step
+		stencilArena.release();
+		vps = nullptr;
+		binArena.release();
+		bins = nullptr;
+		capP = n;
+		return true;
 	}
-}
 
-WASM_EXPORT void g2p() {
-	const f32 ONE = 1 + 1e-3;
-	const v128 minPosX = wasm_f32x4_const_splat(ONE);
-	const v128 maxPosX = wasm_f32x4_splat(gridW - ONE);
-	const v128 minPosY = wasm_f32x4_const_splat(ONE);
-	const v128 maxPosY = wasm_f32x4_splat(gridH - ONE);
-
-	// grid to particle
-	for (i32 i = 0; i < numP; i += 4) {
-		i32 i1 = i;
-		i32 i2 = i + 1;
-		i32 i3 = i + 2;
-		i32 i4 = i + 3;
-		Particle& p1 = ps[i1];
-		Particle& p2 = ps[i2];
-		Particle& p3 = ps[i3];
-		Particle& p4 = ps[i4];
-		const VectorizedParticle& vp = vps[i >> 2];
-
-		v128 vx = wasm_f32x4_const_splat(0);
-		v128 vy = wasm_f32x4_const_splat(0);
-		v128 gv00 = wasm_f32x4_const_splat(0);
-		v128 gv01 = wasm_f32x4_const_splat(0);
-		v128 gv10 = wasm_f32x4_const_splat(0);
-		v128 gv11 = wasm_f32x4_const_splat(0);
-
-		v128 w;
-		v128 ci;
-		v128 wvx;
-		v128 wvy;
-
-#define VISIT_CELL()                                                                  \
-	{                                                                                 \
-		Cell& c1 = cs[wasm_i32x4_extract_lane(ci, 0)];                                \
-		Cell& c2 = cs[wasm_i32x4_extract_lane(ci, 1)];                                \
-		Cell& c3 = cs[wasm_i32x4_extract_lane(ci, 2)];                                \
-		Cell& c4 = cs[wasm_i32x4_extract_lane(ci, 3)];                                \
-		wvx = wasm_f32x4_mul(w, wasm_f32x4_make(c1.velx, c2.velx, c3.velx, c4.velx)); \
-		wvy = wasm_f32x4_mul(w, wasm_f32x4_make(c1.vely, c2.vely, c3.vely, c4.vely)); \
-	}
-
-		w = vp.w00;
-		ci = vp.c00;
-		VISIT_CELL();
-		vx = wasm_f32x4_add(vx, wvx);
-		vy = wasm_f32x4_add(vy, wvy);
-		gv00 = wasm_f32x4_sub(gv00, wvx);
-		gv01 = wasm_f32x4_sub(gv01, wvx);
-		gv10 = wasm_f32x4_sub(gv10, wvy);
-		gv11 = wasm_f32x4_sub(gv11, wvy);
-
-		w = vp.w01;
-		ci = vp.c01;
-		VISIT_CELL();
-		vx = wasm_f32x4_add(vx, wvx);
-		vy = wasm_f32x4_add(vy, wvy);
-		gv01 = wasm_f32x4_sub(gv01, wvx);
-		gv11 = wasm_f32x4_sub(gv11, wvy);
-
-		w = vp.w02;
-		ci = vp.c02;
-		VISIT_CELL();
-		vx = wasm_f32x4_add(vx, wvx);
-		vy = wasm_f32x4_add(vy, wvy);
-		gv00 = wasm_f32x4_add(gv00, wvx);
-		gv01 = wasm_f32x4_sub(gv01, wvx);
-		gv10 = wasm_f32x4_add(gv10, wvy);
-		gv11 = wasm_f32x4_sub(gv11, wvy);
-
-		w = vp.w10;
-		ci = vp.c10;
-		VISIT_CELL();
-		vx = wasm_f32x4_add(vx, wvx);
-		vy = wasm_f32x4_add(vy, wvy);
-		gv00 = wasm_f32x4_sub(gv00, wvx);
-		gv10 = wasm_f32x4_sub(gv10, wvy);
-
-		w = vp.w11;
-		ci = vp.c11;
-		VISIT_CELL();
-		vx = wasm_f32x4_add(vx, wvx);
-		vy = wasm_f32x4_add(vy, wvy);
-
-		w = vp.w12;
-		ci = vp.c12;
-		VISIT_CELL();
-		vx = wasm_f32x4_add(vx, wvx);
-		vy = wasm_f32x4_add(vy, wvy);
-		gv00 = wasm_f32x4_add(gv00, wvx);
-		gv10 = wasm_f32x4_add(gv10, wvy);
-
-		w = vp.w20;
-		ci = vp.c20;
-		VISIT_CELL();
-		vx = wasm_f32x4_add(vx, wvx);
-		vy = wasm_f32x4_add(vy, wvy);
-		gv00 = wasm_f32x4_sub(gv00, wvx);
-		gv01 = wasm_f32x4_add(gv01, wvx);
-		gv10 = wasm_f32x4_sub(gv10, wvy);
-		gv11 = wasm_f32x4_add(gv11, wvy);
-
-		w = vp.w21;
-		ci = vp.c21;
-		VISIT_CELL();
-		vx = wasm_f32x4_add(vx, wvx);
-		vy = wasm_f32x4_add(vy, wvy);
-		gv01 = wasm_f32x4_add(gv01, wvx);
-		gv11 = wasm_f32x4_add(gv11, wvy);
-
-		w = vp.w22;
-		ci = vp.c22;
-		VISIT_CELL();
-		vx = wasm_f32x4_add(vx, wvx);
-		vy = wasm_f32x4_add(vy, wvy);
-		gv00 = wasm_f32x4_add(gv00, wvx);
-		gv01 = wasm_f32x4_add(gv01, wvx);
-		gv10 = wasm_f32x4_add(gv10, wvy);
-		gv11 = wasm_f32x4_add(gv11, wvy);
-
-		gv00 = wasm_f32x4_mul(wasm_f32x4_const_splat(4), wasm_f32x4_add(gv00, wasm_f32x4_mul(vx, vp.dx)));
-		gv01 = wasm_f32x4_mul(wasm_f32x4_const_splat(4), wasm_f32x4_add(gv01, wasm_f32x4_mul(vx, vp.dy)));
-		gv10 = wasm_f32x4_mul(wasm_f32x4_const_splat(4), wasm_f32x4_add(gv10, wasm_f32x4_mul(vy, vp.dx)));
-		gv11 = wasm_f32x4_mul(wasm_f32x4_const_splat(4), wasm_f32x4_add(gv11, wasm_f32x4_mul(vy, vp.dy)));
-
-		v128 nposx = wasm_f32x4_min(wasm_f32x4_max(wasm_f32x4_add(vp.posx, vx), minPosX), maxPosX);
-		v128 nposy = wasm_f32x4_min(wasm_f32x4_max(wasm_f32x4_add(vp.posy, vy), minPosY), maxPosY);
-		v128 nvelx = wasm_f32x4_sub(nposx, vp.posx);
-		v128 nvely = wasm_f32x4_sub(nposy, vp.posy);
-
-		v128 accx = wasm_f32x4_sub(nvelx, vp.velx);
-		v128 accy = wasm_f32x4_sub(nvely, vp.vely);
-		v128 densityRatio = wasm_f32x4_mul(vp.density, wasm_f32x4_const_splat(INV_DENSITY));
-		v128 accLen = wasm_f32x4_sqrt(wasm_f32x4_add(f32x4_pow2(accx), f32x4_pow2(accy)));
-		v128 aerationScale = wasm_f32x4_mul(
-			wasm_f32x4_sub(wasm_f32x4_const_splat(1),
-				wasm_f32x4_mul(densityRatio, wasm_f32x4_const_splat(1.0 / AERATION_THRESHOLD))),
-			wasm_f32x4_const_splat(AERATION_COEFF));
-		v128 aerationDelta = wasm_f32x4_max(wasm_f32x4_const_splat(0), wasm_f32x4_mul(accLen, aerationScale));
-		v128 newAeration =
-			wasm_f32x4_min(wasm_f32x4_const_splat(1), wasm_f32x4_add(vp.aeration, aerationDelta));
-
-		p1.aeration = wasm_f32x4_extract_lane(newAeration, 0);
-		p2.aeration = wasm_f32x4_extract_lane(newAeration, 1);
-		p3.aeration = wasm_f32x4_extract_lane(newAeration, 2);
-		p4.aeration = wasm_f32x4_extract_lane(newAeration, 3);
-		p1.posx = wasm_f32x4_extract_lane(nposx, 0);
-		p2.posx = wasm_f32x4_extract_lane(nposx, 1);
-		p3.posx = wasm_f32x4_extract_lane(nposx, 2);
-		p4.posx = wasm_f32x4_extract_lane(nposx, 3);
-		p1.posy = wasm_f32x4_extract_lane(nposy, 0);
-		p2.posy = wasm_f32x4_extract_lane(nposy, 1);
-		p3.posy = wasm_f32x4_extract_lane(nposy, 2);
-		p4.posy = wasm_f32x4_extract_lane(nposy, 3);
-		p1.velx = wasm_f32x4_extract_lane(nvelx, 0);
-		p2.velx = wasm_f32x4_extract_lane(nvelx, 1);
-		p3.velx = wasm_f32x4_extract_lane(nvelx, 2);
-		p4.velx = wasm_f32x4_extract_lane(nvelx, 3);
-		p1.vely = wasm_f32x4_extract_lane(nvely, 0);
-		p2.vely = wasm_f32x4_extract_lane(nvely, 1);
-		p3.vely = wasm_f32x4_extract_lane(nvely, 2);
-		p4.vely = wasm_f32x4_extract_lane(nvely, 3);
-		p1.gvel00 = wasm_f32x4_extract_lane(gv00, 0);
-		p2.gvel00 = wasm_f32x4_extract_lane(gv00, 1);
-		p3.gvel00 = wasm_f32x4_extract_lane(gv00, 2);
-		p4.gvel00 = wasm_f32x4_extract_lane(gv00, 3);
-		p1.gvel01 = wasm_f32x4_extract_lane(gv01, 0);
-		p2.gvel01 = wasm_f32x4_extract_lane(gv01, 1);
-		p3.gvel01 = wasm_f32x4_extract_lane(gv01, 2);
-		p4.gvel01 = wasm_f32x4_extract_lane(gv01, 3);
-		p1.gvel10 = wasm_f32x4_extract_lane(gv10, 0);
-		p2.gvel10 = wasm_f32x4_extract_lane(gv10, 1);
-		p3.gvel10 = wasm_f32x4_extract_lane(gv10, 2);
-		p4.gvel10 = wasm_f32x4_extract_lane(gv10, 3);
-		p1.gvel11 = wasm_f32x4_extract_lane(gv11, 0);
-		p2.gvel11 = wasm_f32x4_extract_lane(gv11, 1);
-		p3.gvel11 = wasm_f32x4_extract_lane(gv11, 2);
-		p4.gvel11 = wasm_f32x4_extract_lane(gv11, 3);
+	bool reserveCells(i32 n) {
+		Arena a;
+		if (!a.init(G_NUM_FIELDS * Arena::footprint<f32>(n) + Arena::footprint<i32>(n + 1) +
+					Arena::footprint<i32>(n + 2)))
+			return false;
+		const i32 keep = mini(numC, n);
+		for (i32 f = 0; f < G_NUM_FIELDS; f++) {
+			f32* plane = a.take<f32>(n);
+			if (keep > 0) {
+				memcpy(plane, gdata[f], keep * sizeof(f32));
+			}
+			gdata[f] = plane;
+		}
+		cellStarts = a.take<i32>(n + 1);
+		binStarts = a.take<i32>(n + 2);
+		cellArena.swap(a);
+		gmass = gdata[G_MASS];
+		gaeration = gdata[G_AERATION];
+		gvelx = gdata[G_VEL_X];
+		gvely = gdata[G_VEL_Y];
+		gdvelx = gdata[G_DVEL_X];
+		gdvely = gdata[G_DVEL_Y];
+		capC = n;
+		gridDirty = true;
+		sdfArena.release();
+		sdfDist = nullptr;
+		sdfDirty = true;
+		fixedArena.release();
+		fixedGrid[0] = nullptr;
+		solverArena.release();
+		spres = nullptr;
+
+		// the private grids only hold data during a phase
+		allocPrivateGrids(1);
+		if (!allocPrivateGrids(pool.size())) {
+			setThreads(1);
+		}
+		return true;
+	}
+
+	// sets the capacity to the given number of particles and cells, or to what is in use
+	// if that is more. the buffers move, so views of particlePlane() and cellPlane() must be
+	// taken again. returns 0, keeping the old storage, if out of memory
+	i32 reserve(i32 particles, i32 cells) {
+		particles = maxi(particles, numP);
+		cells = maxi(cells, numC);
+		if (particles < 0 || particles > MAX_CAPACITY || cells < 0 || cells > MAX_CAPACITY)
+			return 0;
+		particles = (particles + 15) & ~15;
+		if (particles != capP && !reserveParticles(particles))
+			return 0;
+		if (cells != capC && !reserveCells(cells))
+			return 0;
+		return 1;
+	}
+
+	i32 particleCapacity() {
+		return capP;
+	}
+
+	i32 cellCapacity() {
+		return capC;
+	}
+
+	f64 storageBytes() {
+		size_t bytes = particleArena.bytes() + cellArena.bytes() + stencilArena.bytes() + binArena.bytes() +
+			fixedArena.bytes() + blockArena.bytes() + sdfArena.bytes() + textureArena.bytes() +
+			solverArena.bytes();
+		for (const Arena& a : privateArenas) {
+			bytes += a.bytes();
+		}
+#ifdef WATER_STATS
+		bytes += traceArena.bytes() + traceTextArena.bytes();
+#endif
+		return (f64) bytes;
+	}
+
+	iptr particleIds() {
+		return ptr(pids);
+	}
+
+	iptr permutation() {
+		return ptr(perm);
+	}
+
+	f32 disorder() {
+		return lastDisorder;
+	}
+
+	void resetIds() {
+		numP = mini(numP, capP);
+		for (i32 i = 0; i < numP; i++) {
+			pids[i] = i;
+		}
+		numIds = numP;
+		nextId = numP;
+	}
+
+	// gives ids to particles appended since the last call. particles written past the
+	// capacity are dropped
+	inline void syncIds() {
+		numP = mini(numP, capP);
+		if (numIds > numP) {
+			numIds = numP;
+		}
+		while (numIds < numP) {
+			pids[numIds++] = nextId++;
+		}
+	}
+
+	void setSortPolicy(i32 interval, f32 threshold) {
+		sortInterval = interval;
+		sortThreshold = threshold;
+		stepsSinceSort = 0;
+	}
+
+	// fused: applyPressure and g2p recompute the stencils instead of reading them back from
+	// the cache, trading a little arithmetic for 512 bytes of traffic per quad and pass
+	void setFusedStencil(i32 fused) {
+		fusedStencil = fused != 0;
+		if (fusedStencil) {
+			stencilArena.release();
+			vps = nullptr;
+		}
+	}
+
+	// allocates what mode needs on top of the scatter: the bins or the fixed point grid
+	bool allocTransfer(i32 mode) {
+		if (mode == TRANSFER_FIXED && !fixedGrid[0]) {
+			if (!fixedArena.init(G_NUM_FIELDS * Arena::footprint<i64>(capC)))
+				return false;
+			for (i32 f = 0; f < G_NUM_FIELDS; f++) {
+				fixedGrid[f] = fixedArena.take<i64>(capC);
+				memset(fixedGrid[f], 0, capC * sizeof(i64));
+			}
+		}
+		if (mode == TRANSFER_GATHER && !bins) {
+			if (!binArena.init(Arena::footprint<BinnedParticle>(capP)))
+				return false;
+			bins = binArena.take<BinnedParticle>(capP);
+		}
+		return true;
+	}
+
+	// takes effect on the next transferMass
+	bool setTransferMode(i32 mode) {
+		mode = mode == TRANSFER_GATHER || mode == TRANSFER_FIXED ? mode : TRANSFER_SCATTER;
+		if (!allocTransfer(mode))
+			return false;
+		transferMode = mode;
+		return true;
+	}
+
+	// takes effect on the next transferMass
+	void setFeatures(i32 features) {
+		features &= FEATURE_ALL;
+		if (features == stepFeatures)
+			return;
+		if (!(features & FEATURE_AERATION) && numP > 0) {
+			memset(paeration, 0, numP * sizeof(f32));
+		}
+		stepFeatures = features;
+		gridDirty = true; // the planes of the features left out were not kept up to date
+	}
+
+	i32 features() {
+		return stepFeatures;
+	}
+
+	void setFluidParams(
+		f32 stiffness, f32 aerationThreshold, f32 aerationCoeff, f32 aerationBlur, f32 aerationDamp) {
+		params = {stiffness, aerationThreshold, aerationCoeff, aerationBlur, aerationDamp};
+		scales = stepScales(stepDt, params, solver);
+	}
+
+	void setPressureSolver(i32 solver, i32 maxIterations, f32 tolerance) {
+		this->solver = solver == PRESSURE_PROJECT ? PRESSURE_PROJECT : PRESSURE_EOS;
+		solverMaxIterations = maxi(maxIterations, 1);
+		solverTolerance = fmaxf(tolerance, 0);
+		unconvergedSolves = 0;
+		scales = stepScales(stepDt, params, this->solver);
+	}
+
+	i32 pressureSolver() {
+		return solver;
+	}
+
+	// returns the instruction set in effect, isa or the widest supported one below it. takes
+	// effect on the next transferMass
+	i32 setKernelIsa(i32 isa) {
+		this->isa = isa < ISA_SIMD128 ? ISA_SIMD128 : isa > supportedIsa ? supportedIsa : isa;
+		return this->isa;
+	}
+
+	i32 kernelIsa() {
+		return isa;
+	}
+
+	// counting sort of the particles by the cell they are in
+	void sortParticles() {
+		STAT_PHASE(STAT_SORT);
+		syncIds();
+		memset(cellStarts, 0, (numC + 1) * sizeof(i32));
+		for (i32 i = 0; i < numP; i++) {
+			i32 key = (i32) pposy[i] * gridStride + (i32) pposx[i];
+			key = maxi(0, mini(numC - 1, key));
+			sortDst[i] = key;
+			cellStarts[key + 1]++;
+		}
+		for (i32 i = 0; i < numC; i++) {
+			cellStarts[i + 1] += cellStarts[i];
+		}
+		for (i32 i = 0; i < numP; i++) {
+			const i32 dst = cellStarts[sortDst[i]]++;
+			sortDst[i] = dst;
+			perm[dst] = i;
+		}
+
+		// move the planes and ids one at a time
+		static_assert(sizeof(f32) == sizeof(i32), "planes are permuted through an i32 buffer");
+		for (i32 f = 0; f <= P_NUM_FIELDS; f++) {
+			i32* plane = f < P_NUM_FIELDS ? (i32*) pdata[f] : pids;
+			for (i32 i = 0; i < numP; i++) {
+				sortBuf[sortDst[i]] = plane[i];
+			}
+			memcpy(plane, sortBuf, numP * sizeof(i32));
+		}
+		stepsSinceSort = 0;
+		lastDisorder = 0;
+	}
+
+	// counting sort of the particles into bins by the cell they are in, leaving the bin of each in
+	// sortDst. returns the number of disordered quads
+	i32 binParticles() {
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split((numP + 3) >> 2, t, pool.size(), begin, end);
+			i32 disordered = 0;
+			for (i32 q = begin; q < end; q++) {
+				i32 lo = numC;
+				i32 hi = 0;
+				for (i32 i = q << 2; i < mini((q + 1) << 2, numP); i++) {
+					i32 key = (i32) pposy[i] * gridStride + (i32) pposx[i];
+					key = maxi(0, mini(numC - 1, key));
+					sortDst[i] = key;
+					lo = mini(lo, key);
+					hi = maxi(hi, key);
+				}
+				disordered += hi - lo > 2 * gridStride;
+			}
+			disorderedQuads[t] = disordered;
+		});
+
+		// counted two entries up, so that placing leaves binStarts[c] at the start of cell c
+		memset(binStarts, 0, (numC + 2) * sizeof(i32));
+		for (i32 i = 0; i < numP; i++) {
+			binStarts[sortDst[i] + 2]++;
+		}
+		for (i32 i = 2; i < numC + 2; i++) {
+			binStarts[i] += binStarts[i - 1];
+		}
+		for (i32 i = 0; i < numP; i++) {
+			const i32 dst = binStarts[sortDst[i] + 1]++;
+			sortDst[i] = dst;
+			sortBuf[dst] = i;
+		}
+
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split(numP, t, pool.size(), begin, end);
+			for (i32 k = begin; k < end; k++) {
+				const i32 i = sortBuf[k];
+				bins[k] = {pposx[i], pposy[i], paeration[i], pvelx[i], pvely[i], pgvel00[i], pgvel01[i],
+					pgvel10[i], pgvel11[i], 0};
+			}
+		});
+
+		i32 disordered = 0;
+		for (i32 t = 0; t < pool.size(); t++) {
+			disordered += disorderedQuads[t];
+		}
+		return disordered;
+	}
+
+	void setGrid(i32 gw, i32 gh) {
+		const i32 stride = (gw + GRID_ROW_ALIGN - 1) & ~(GRID_ROW_ALIGN - 1);
+		if ((i64) stride * gh > capC && !reserve(capP, stride * gh))
+			return;
+		if (gw != gridW || gh != gridH) {
+			gridDirty = true;
+			sdfDirty = true;
+		}
+		gridW = gw;
+		gridH = gh;
+		gridStride = stride;
+		numC = stride * gh;
+	}
+
+	void setGridWindow(i32 originY, i32 walls) {
+		// colliders and emitters are kept in the coordinates of the grid
+		const f32 shift = (f32) (gridOriginY - originY);
+		if (shift != 0) {
+			for (i32 k = 0; k < numColliders; k++) {
+				colliders[k].y += shift;
+			}
+			for (i32 k = 0; k < numEmitters; k++) {
+				emitters[k].y += shift;
+			}
+			sdfDirty = true;
+		}
+		gridOriginY = originY;
+		gridWalls = walls & WALL_ALL;
+	}
+
+	// forgets which cells hold data, for when the grid was written from outside
+	void clearGrid() {
+		gridDirty = true;
+	}
+
+	f32 gridActivity() {
+		return blocksW * blocksH > 0 ? (f32) numActive / (blocksW * blocksH) : 0;
+	}
+
+	i32 cellActive(i32 x, i32 y) {
+		const i32 bx = x >> BLOCK_SHIFT;
+		const i32 by = y >> BLOCK_SHIFT;
+		if (x < 0 || y < 0 || bx >= blocksW || by >= blocksH || blocksW * blocksH > capB)
+			return 0;
+		return blockActive[by * blocksW + bx];
+	}
+
+	bool reserveBlocks(i32 n) {
+		if (!blockArena.init(WorkerPool::MAX_THREADS * Arena::footprint<u8>(n) + 2 * Arena::footprint<u8>(n) +
+							 2 * Arena::footprint<i32>(n))) {
+			capB = 0;
+			return false;
+		}
+		blockMarks = blockArena.take<u8>(WorkerPool::MAX_THREADS * Arena::footprint<u8>(n));
+		blockActive = blockArena.take<u8>(n);
+		blockNearStatic = blockArena.take<u8>(n);
+		activeBlocks = blockArena.take<i32>(n);
+		clearBlocks = blockArena.take<i32>(n);
+		capB = n;
+		gridDirty = true;
+		sdfDirty = true;
+		return true;
+	}
+
+	// rebuilds the active and clear lists from the cells the particles are in. numP includes
+	// the padding
+	void activateBlocks(i32 numP) {
+		pool.run([&](i32 t) {
+			u8* marks = blockMarks + t * Arena::footprint<u8>(capB);
+			memset(marks, 0, blocksW * blocksH);
+			i32 begin;
+			i32 end;
+			split((numP + 3) >> 2, t, pool.size(), begin, end);
+			begin <<= 2;
+			end <<= 2;
+			const v128 margins = wasm_i32x4_const_splat(BLOCK_MARGIN);
+			const v128 zeros = wasm_i32x4_const_splat(0);
+			const v128 maxBxs = wasm_i32x4_splat(blocksW - 1);
+			const v128 maxBys = wasm_i32x4_splat(blocksH - 1);
+			const v128 blocksWs = wasm_i32x4_splat(blocksW);
+			// the padding copies the last particle, so whole quads can be marked
+			for (i32 i = begin; i < end; i += 4) {
+				const v128 x = wasm_i32x4_trunc_sat_f32x4(wasm_v128_load(pposx + i));
+				const v128 y = wasm_i32x4_trunc_sat_f32x4(wasm_v128_load(pposy + i));
+				const v128 bx0 =
+					wasm_i32x4_max(zeros, wasm_i32x4_shr(wasm_i32x4_sub(x, margins), BLOCK_SHIFT));
+				const v128 bx1 =
+					wasm_i32x4_min(maxBxs, wasm_i32x4_shr(wasm_i32x4_add(x, margins), BLOCK_SHIFT));
+				const v128 by0 = wasm_i32x4_mul(
+					wasm_i32x4_max(zeros, wasm_i32x4_shr(wasm_i32x4_sub(y, margins), BLOCK_SHIFT)), blocksWs);
+				const v128 by1 = wasm_i32x4_mul(
+					wasm_i32x4_min(maxBys, wasm_i32x4_shr(wasm_i32x4_add(y, margins), BLOCK_SHIFT)),
+					blocksWs);
+				const v128 b00 = wasm_i32x4_add(by0, bx0);
+				const v128 b01 = wasm_i32x4_add(by0, bx1);
+				const v128 b10 = wasm_i32x4_add(by1, bx0);
+				const v128 b11 = wasm_i32x4_add(by1, bx1);
+
+#define MARK_LANE(k)                                \
+	{                                               \
+		marks[wasm_i32x4_extract_lane(b00, k)] = 1; \
+		marks[wasm_i32x4_extract_lane(b01, k)] = 1; \
+		marks[wasm_i32x4_extract_lane(b10, k)] = 1; \
+		marks[wasm_i32x4_extract_lane(b11, k)] = 1; \
+	}
+
+				MARK_LANE(0);
+				MARK_LANE(1);
+				MARK_LANE(2);
+				MARK_LANE(3);
+
+#undef MARK_LANE
+			}
+		});
+
+		numActive = 0;
+		numClear = 0;
+		for (i32 b = 0; b < blocksW * blocksH; b++) {
+			u8 active = 0;
+			for (i32 t = 0; t < pool.size(); t++) {
+				active |= blockMarks[t * Arena::footprint<u8>(capB) + b];
+			}
+			if (active) {
+				activeBlocks[numActive++] = b;
+			}
+			if (active || blockActive[b] || gridDirty) {
+				clearBlocks[numClear++] = b;
+			}
+			blockActive[b] = active;
+		}
+		gridDirty = false;
+	}
+
+	// mass and momentum of the quads [begin, end) into grid (or fixedGrid, see Accumulation), returns
+	// the number of disordered quads
+	template <bool FUSED, i32 ACC, i32 FEATURES>
+	i32 transferQuads(f32* const* grid, i32 begin, i32 end, i32 numP) {
+		constexpr bool AERATED = (FEATURES & FEATURE_AERATION) != 0;
+		f32* mass = grid[G_MASS];
+		f32* cellAeration = grid[G_AERATION];
+		f32* momx = grid[G_VEL_X];
+		f32* momy = grid[G_VEL_Y];
+		i64* fixedMass = fixedGrid[G_MASS];
+		i64* fixedAeration = fixedGrid[G_AERATION];
+		i64* fixedMomx = fixedGrid[G_VEL_X];
+		i64* fixedMomy = fixedGrid[G_VEL_Y];
+		i32 disordered = 0;
+		for (i32 i = begin; i < end; i += 4) {
+			VectorizedParticle stencil;
+			VectorizedParticle& vp = FUSED ? stencil : vps[i >> 2];
+			computeStencil(vp, i, numP);
+			const v128 aeration = AERATED ? wasm_v128_load(paeration + i) : wasm_f32x4_const_splat(0);
+			const v128 velx = wasm_v128_load(pvelx + i);
+			const v128 vely = wasm_v128_load(pvely + i);
+			const v128 gvel00 = wasm_v128_load(pgvel00 + i);
+			const v128 gvel01 = wasm_v128_load(pgvel01 + i);
+			const v128 gvel10 = wasm_v128_load(pgvel10 + i);
+			const v128 gvel11 = wasm_v128_load(pgvel11 + i);
+
+			{
+				const i32 ci0 = wasm_i32x4_extract_lane(vp.c00, 0);
+				const i32 ci1 = wasm_i32x4_extract_lane(vp.c00, 1);
+				const i32 ci2 = wasm_i32x4_extract_lane(vp.c00, 2);
+				const i32 ci3 = wasm_i32x4_extract_lane(vp.c00, 3);
+				const i32 lo = mini(mini(ci0, ci1), mini(ci2, ci3));
+				const i32 hi = maxi(maxi(ci0, ci1), maxi(ci2, ci3));
+				disordered += hi - lo > 2 * gridStride;
+			}
+
+			const v128 gv00x = wasm_f32x4_mul(gvel00, vp.dx);
+			const v128 gv01y = wasm_f32x4_mul(gvel01, vp.dy);
+			const v128 gv10x = wasm_f32x4_mul(gvel10, vp.dx);
+			const v128 gv11y = wasm_f32x4_mul(gvel11, vp.dy);
+
+			const v128 cvx = wasm_f32x4_add(velx, wasm_f32x4_add(gv00x, gv01y));
+			const v128 cvy = wasm_f32x4_add(vely, wasm_f32x4_add(gv10x, gv11y));
+
+			v128 ci;
+			v128 w;
+			v128 wvx;
+			v128 wvy;
+
+#define VISIT_CELL()                                                                       \
+	{                                                                                      \
+		scatterAdd<ACC>(mass, fixedMass, ci, w);                                           \
+		if (AERATED) {                                                                     \
+			scatterAdd<ACC>(cellAeration, fixedAeration, ci, wasm_f32x4_mul(w, aeration)); \
+		}                                                                                  \
+		scatterAdd<ACC>(momx, fixedMomx, ci, wvx);                                         \
+		scatterAdd<ACC>(momy, fixedMomy, ci, wvy);                                         \
+	}
+
+			ci = vp.c00;
+			w = vp.w00;
+			wvx = wasm_f32x4_mul(w, wasm_f32x4_sub(wasm_f32x4_sub(cvx, gvel00), gvel01));
+			wvy = wasm_f32x4_mul(w, wasm_f32x4_sub(wasm_f32x4_sub(cvy, gvel10), gvel11));
+			VISIT_CELL();
+
+			ci = vp.c01;
+			w = vp.w01;
+			wvx = wasm_f32x4_mul(w, wasm_f32x4_sub(cvx, gvel01));
+			wvy = wasm_f32x4_mul(w, wasm_f32x4_sub(cvy, gvel11));
+			VISIT_CELL();
+
+			ci = vp.c02;
+			w = vp.w02;
+			wvx = wasm_f32x4_mul(w, wasm_f32x4_sub(wasm_f32x4_add(cvx, gvel00), gvel01));
+			wvy = wasm_f32x4_mul(w, wasm_f32x4_sub(wasm_f32x4_add(cvy, gvel10), gvel11));
+			VISIT_CELL();
+
+			ci = vp.c10;
+			w = vp.w10;
+			wvx = wasm_f32x4_mul(w, wasm_f32x4_sub(cvx, gvel00));
+			wvy = wasm_f32x4_mul(w, wasm_f32x4_sub(cvy, gvel10));
+			VISIT_CELL();
+
+			ci = vp.c11;
+			w = vp.w11;
+			wvx = wasm_f32x4_mul(w, cvx);
+			wvy = wasm_f32x4_mul(w, cvy);
+			VISIT_CELL();
+
+			ci = vp.c12;
+			w = vp.w12;
+			wvx = wasm_f32x4_mul(w, wasm_f32x4_add(cvx, gvel00));
+			wvy = wasm_f32x4_mul(w, wasm_f32x4_add(cvy, gvel10));
+			VISIT_CELL();
+
+			ci = vp.c20;
+			w = vp.w20;
+			wvx = wasm_f32x4_mul(w, wasm_f32x4_add(wasm_f32x4_sub(cvx, gvel00), gvel01));
+			wvy = wasm_f32x4_mul(w, wasm_f32x4_add(wasm_f32x4_sub(cvy, gvel10), gvel11));
+			VISIT_CELL();
+
+			ci = vp.c21;
+			w = vp.w21;
+			wvx = wasm_f32x4_mul(w, wasm_f32x4_add(cvx, gvel01));
+			wvy = wasm_f32x4_mul(w, wasm_f32x4_add(cvy, gvel11));
+			VISIT_CELL();
+
+			ci = vp.c22;
+			w = vp.w22;
+			wvx = wasm_f32x4_mul(w, wasm_f32x4_add(wasm_f32x4_add(cvx, gvel00), gvel01));
+			wvy = wasm_f32x4_mul(w, wasm_f32x4_add(wasm_f32x4_add(cvy, gvel10), gvel11));
+			VISIT_CELL();
 
 #undef VISIT_CELL
+		}
+		return disordered;
+	}
+
+	template <bool FUSED, i32 FEATURES>
+	i32 transferQuads(i32 acc, f32* const* grid, i32 begin, i32 end, i32 numP) {
+		if (acc == ACC_ATOMIC)
+			return transferQuads<FUSED, ACC_ATOMIC, FEATURES>(grid, begin, end, numP);
+		if (acc == ACC_FIXED)
+			return transferQuads<FUSED, ACC_FIXED, FEATURES>(grid, begin, end, numP);
+		return transferQuads<FUSED, ACC_FLOAT, FEATURES>(grid, begin, end, numP);
+	}
+
+	template <bool FUSED>
+	i32 transferQuads(i32 features, i32 acc, f32* const* grid, i32 begin, i32 end, i32 numP) {
+		if (features & FEATURE_AERATION)
+			return transferQuads<FUSED, FEATURE_AERATION>(acc, grid, begin, end, numP);
+		return transferQuads<FUSED, 0>(acc, grid, begin, end, numP);
 	}
+
+	// mass, aeration and momentum of the BLOCK_SIZE cells from x0 on row y, pulled from the bins.
+	// the cells from x1 on are padding and are left empty
+	template <i32 FEATURES>
+	void pullTransferRow(i32 y, i32 x0, i32 x1) {
+		constexpr bool AERATED = (FEATURES & FEATURE_AERATION) != 0;
+		const v128 offsets = wasm_f32x4_make(0.5, 1.5, 2.5, 3.5);
+		for (i32 x = x0; x < x0 + BLOCK_SIZE; x += 4) {
+			const v128 cx = wasm_f32x4_add(wasm_f32x4_splat(x), offsets);
+			const v128 inside = wasm_f32x4_lt(cx, wasm_f32x4_splat(x1));
+			v128 m = wasm_f32x4_const_splat(0);
+			v128 a = wasm_f32x4_const_splat(0);
+			v128 mx = wasm_f32x4_const_splat(0);
+			v128 my = wasm_f32x4_const_splat(0);
+			if (x < x1) {
+				forBinnedNear(y, x, cx, [&](const BinnedParticle& p, v128 rx, f32 ry, v128 w) {
+					const v128 vx = wasm_f32x4_add(wasm_f32x4_splat(p.velx + p.gvel01 * ry),
+						wasm_f32x4_mul(wasm_f32x4_splat(p.gvel00), rx));
+					const v128 vy = wasm_f32x4_add(wasm_f32x4_splat(p.vely + p.gvel11 * ry),
+						wasm_f32x4_mul(wasm_f32x4_splat(p.gvel10), rx));
+					m = wasm_f32x4_add(m, w);
+					if (AERATED) {
+						a = wasm_f32x4_add(a, wasm_f32x4_mul(w, wasm_f32x4_splat(p.aeration)));
+					}
+					mx = wasm_f32x4_add(mx, wasm_f32x4_mul(w, vx));
+					my = wasm_f32x4_add(my, wasm_f32x4_mul(w, vy));
+				});
+				m = wasm_v128_and(m, inside);
+				a = wasm_v128_and(a, inside);
+				mx = wasm_v128_and(mx, inside);
+				my = wasm_v128_and(my, inside);
+			}
+			const i32 c = y * gridStride + x;
+			const v128 hasMass = wasm_f32x4_gt(m, wasm_f32x4_const_splat(0));
+			wasm_v128_store(gmass + c, m);
+			if (AERATED) {
+				wasm_v128_store(gaeration + c, wasm_v128_bitselect(wasm_f32x4_div(a, m), a, hasMass));
+			}
+			wasm_v128_store(gvelx + c, mx);
+			wasm_v128_store(gvely + c, my);
+		}
+	}
+
+	void transferMass() {
+		STAT_SUBSTEP_BEGIN();
+		STAT_PHASE(STAT_TRANSFER);
+		syncIds();
+		stepsSinceSort++;
+		gridSteps++;
+		if ((sortInterval > 0 && stepsSinceSort >= sortInterval) ||
+			(sortThreshold > 0 && lastDisorder > sortThreshold)) {
+			sortParticles();
+		}
+
+		accumulation = ACC_FLOAT;
+		// reserve() dropped the buffers of the mode; without memory for them it falls back to the
+		// scatter, which transferMode() reports
+		if (!allocTransfer(transferMode)) {
+			transferMode = TRANSFER_SCATTER;
+		}
+		if (transferMode == TRANSFER_FIXED) {
+			accumulation = pool.size() > 1 ? ACC_ATOMIC : ACC_FIXED;
+		}
+
+#ifdef WATER_WIDE
+		wide = nullptr;
+		if (isa == ISA_AVX512) {
+			wide = &avx512Kernels[stepFeatures];
+		} else if (isa == ISA_AVX2) {
+			wide = &avx2Kernels[stepFeatures];
+		}
+		if (accumulation != ACC_FLOAT) {
+			wide = nullptr; // they only scatter floats
+		}
+#endif
+		const i32 lanes = wide ? wide->lanes : 4;
+
+		int origNumP = numP;
+		int numP = origNumP;
+
+		// pad to a multiple of the lanes
+		while (numP & (lanes - 1)) {
+			// copy the last particle to pad
+			for (i32 f = 0; f < P_NUM_FIELDS; f++) {
+				pdata[f][numP] = pdata[f][numP - 1];
+			}
+			numP++;
+		}
+
+		blocksW = (gridW + BLOCK_SIZE - 1) >> BLOCK_SHIFT;
+		blocksH = (gridH + BLOCK_SIZE - 1) >> BLOCK_SHIFT;
+		if (blocksW * blocksH > capB && !reserveBlocks(blocksW * blocksH))
+			return;
+		activateBlocks(numP);
+
+		gathering = transferMode == TRANSFER_GATHER;
+		if (gathering) {
+			lastDisorder = origNumP > 0 ? (f32) binParticles() / ((origNumP + 3) >> 2) : 0;
+
+			// every cell of the active blocks is written once, the others only need clearing
+			pool.run([&](i32 t) {
+				clearStaleBlocks(t);
+				i32 begin;
+				i32 end;
+				split(numActive, t, pool.size(), begin, end);
+				for (i32 b = begin; b < end; b++) {
+					forBlockRows(activeBlocks[b], [&](i32 y, i32 x0, i32 x1) {
+						if (stepFeatures & FEATURE_AERATION) {
+							pullTransferRow<FEATURE_AERATION>(y, x0, x1);
+						} else {
+							pullTransferRow<0>(y, x0, x1);
+						}
+					});
+				}
+			});
+			return;
+		}
+
+		if (!wide && !fusedStencil && !vps) {
+			if (stencilArena.init(Arena::footprint<VectorizedParticle>(capP >> 2))) {
+				vps = stencilArena.take<VectorizedParticle>(capP >> 2);
+			} else {
+				// no room for the cache, recompute instead
+				fusedStencil = true;
+			}
+		}
+
+		// mass and momentum transfer, each thread into its own grid or all into fixedGrid
+		pool.run([&](i32 t) {
+			f32* const* grid = t == 0 ? gdata : privateGrids[t];
+			if (accumulation == ACC_FLOAT) {
+				for (i32 k = 0; k < numClear; k++) {
+					forBlockRows(clearBlocks[k], [&](i32 y, i32 x0, i32) {
+						clearBlockRow(grid, y * gridStride + x0);
+					});
+				}
+			} else {
+				clearStaleBlocks(t);
+			}
+			i32 begin;
+			i32 end;
+			split(numP / lanes, t, pool.size(), begin, end);
+			begin *= lanes;
+			end *= lanes;
+			if (wide) {
+				const KernelState state = {pdata, gdata, gridW, gridH, gridStride, origNumP, scales};
+				disorderedQuads[t] = wide->transfer(state, grid, begin, end);
+			} else if (fusedStencil) {
+				disorderedQuads[t] =
+					transferQuads<true>(stepFeatures, accumulation, grid, begin, end, origNumP);
+			} else {
+				disorderedQuads[t] =
+					transferQuads<false>(stepFeatures, accumulation, grid, begin, end, origNumP);
+			}
+		});
+
+		{
+			i32 disordered = 0;
+			for (i32 t = 0; t < pool.size(); t++) {
+				disordered += disorderedQuads[t];
+			}
+			lastDisorder = numP > 0 ? (f32) disordered / ((origNumP + 3) >> 2) : 0;
+		}
+
+		// sum up the grids (or convert the fixed point sums) and normalize aeration
+		const i32 grids = accumulation == ACC_FLOAT ? pool.size() : 1;
+		const bool aerated = stepFeatures & FEATURE_AERATION;
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split(numActive, t, pool.size(), begin, end);
+			for (i32 b = begin; b < end; b++) {
+				forBlockRows(activeBlocks[b], [&](i32 y, i32 x0, i32) {
+					const i32 row = y * gridStride + x0;
+					if (accumulation != ACC_FLOAT) {
+						convertFixedRow(row, G_MASS, G_VEL_Y + 1);
+					}
+					for (i32 i = row; i < row + BLOCK_SIZE; i += 4) {
+						v128 m = wasm_v128_load(gmass + i);
+						v128 mx = wasm_v128_load(gvelx + i);
+						v128 my = wasm_v128_load(gvely + i);
+						for (i32 k = 1; k < grids; k++) {
+							f32* const* pg = privateGrids[k];
+							m = wasm_f32x4_add(m, wasm_v128_load(pg[G_MASS] + i));
+							mx = wasm_f32x4_add(mx, wasm_v128_load(pg[G_VEL_X] + i));
+							my = wasm_f32x4_add(my, wasm_v128_load(pg[G_VEL_Y] + i));
+						}
+						wasm_v128_store(gmass + i, m);
+						wasm_v128_store(gvelx + i, mx);
+						wasm_v128_store(gvely + i, my);
+						if (!aerated)
+							continue;
+						v128 a = wasm_v128_load(gaeration + i);
+						for (i32 k = 1; k < grids; k++) {
+							a = wasm_f32x4_add(a, wasm_v128_load(privateGrids[k][G_AERATION] + i));
+						}
+						const v128 hasMass = wasm_f32x4_gt(m, wasm_f32x4_const_splat(0));
+						wasm_v128_store(gaeration + i, wasm_v128_bitselect(wasm_f32x4_div(a, m), a, hasMass));
+					}
+				});
+			}
+		});
+	}
+
+	void mirrorMass() {
+		STAT_PHASE(STAT_MIRROR_MASS);
+		// symmetric boundary condition
+		for (i32 i = 0; i < gridH; i++) {
+			i32 n = gridW - 1;
+			i32 off = i * gridStride;
+			mirror(off, off + 1);
+			mirror(off + n, off + n - 1);
+		}
+		const i32 n = gridH - 1;
+		for (i32 j = 0; j < gridW; j++) {
+			if (gridWalls & WALL_TOP) {
+				mirror(j, j + gridStride);
+			}
+			if (gridWalls & WALL_BOTTOM) {
+				mirror(j + n * gridStride, j + (n - 1) * gridStride);
+			}
+		}
+	}
+
+	// density, aeration blur and pressure of the quads [begin, end), pressure scattered into grid (or
+	// fixedGrid, see Accumulation) or, with PULL, left in the bins for pullPressureRow
+	template <bool FUSED, bool PULL, i32 ACC, i32 FEATURES>
+	void pressureQuads(f32* const* grid, i32 begin, i32 end) {
+		constexpr bool AERATED = (FEATURES & FEATURE_AERATION) != 0;
+		f32* dvelx = grid[G_DVEL_X];
+		f32* dvely = grid[G_DVEL_Y];
+		i64* fixedDvelx = fixedGrid[G_DVEL_X];
+		i64* fixedDvely = fixedGrid[G_DVEL_Y];
+		const v128 aerationDamp = wasm_f32x4_splat(scales.aerationDamp);
+		const v128 aerationBlur = wasm_f32x4_splat(scales.aerationBlur);
+		const v128 pressureScale = wasm_f32x4_splat(scales.pressure);
+		const v128 stiffness = wasm_f32x4_splat(scales.stiffness);
+
+		for (i32 i = begin; i < end; i += 4) {
+			VectorizedParticle stencil;
+			if (FUSED) {
+				computeStencil(stencil, i, numP);
+			}
+			const VectorizedParticle& vp = FUSED ? stencil : vps[i >> 2];
+
+			v128 density = wasm_f32x4_const_splat(0);
+
+			density = wasm_f32x4_add(density, wasm_f32x4_mul(vp.w00, f32x4_gather(gmass, vp.c00)));
+			density = wasm_f32x4_add(density, wasm_f32x4_mul(vp.w01, f32x4_gather(gmass, vp.c01)));
+			density = wasm_f32x4_add(density, wasm_f32x4_mul(vp.w02, f32x4_gather(gmass, vp.c02)));
+			density = wasm_f32x4_add(density, wasm_f32x4_mul(vp.w10, f32x4_gather(gmass, vp.c10)));
+			density = wasm_f32x4_add(density, wasm_f32x4_mul(vp.w11, f32x4_gather(gmass, vp.c11)));
+			density = wasm_f32x4_add(density, wasm_f32x4_mul(vp.w12, f32x4_gather(gmass, vp.c12)));
+			density = wasm_f32x4_add(density, wasm_f32x4_mul(vp.w20, f32x4_gather(gmass, vp.c20)));
+			density = wasm_f32x4_add(density, wasm_f32x4_mul(vp.w21, f32x4_gather(gmass, vp.c21)));
+			density = wasm_f32x4_add(density, wasm_f32x4_mul(vp.w22, f32x4_gather(gmass, vp.c22)));
+			wasm_v128_store(pdens + i, density);
+
+			if (AERATED) {
+				const v128 paer = wasm_v128_load(paeration + i);
+				v128 aeration = wasm_f32x4_const_splat(0);
+				aeration = wasm_f32x4_add(aeration, wasm_f32x4_mul(vp.w00, f32x4_gather(gaeration, vp.c00)));
+				aeration = wasm_f32x4_add(aeration, wasm_f32x4_mul(vp.w01, f32x4_gather(gaeration, vp.c01)));
+				aeration = wasm_f32x4_add(aeration, wasm_f32x4_mul(vp.w02, f32x4_gather(gaeration, vp.c02)));
+				aeration = wasm_f32x4_add(aeration, wasm_f32x4_mul(vp.w10, f32x4_gather(gaeration, vp.c10)));
+				aeration = wasm_f32x4_add(aeration, wasm_f32x4_mul(vp.w11, f32x4_gather(gaeration, vp.c11)));
+				aeration = wasm_f32x4_add(aeration, wasm_f32x4_mul(vp.w12, f32x4_gather(gaeration, vp.c12)));
+				aeration = wasm_f32x4_add(aeration, wasm_f32x4_mul(vp.w20, f32x4_gather(gaeration, vp.c20)));
+				aeration = wasm_f32x4_add(aeration, wasm_f32x4_mul(vp.w21, f32x4_gather(gaeration, vp.c21)));
+				aeration = wasm_f32x4_add(aeration, wasm_f32x4_mul(vp.w22, f32x4_gather(gaeration, vp.c22)));
+				const v128 newAeration = wasm_f32x4_mul(aerationDamp,
+					wasm_f32x4_add(paer, wasm_f32x4_mul(wasm_f32x4_sub(aeration, paer), aerationBlur)));
+				wasm_v128_store(paeration + i, newAeration);
+			}
+
+			if (scales.pressure == 0)
+				continue; // projectPressure() pushes instead
+
+			v128 pressure = wasm_f32x4_mul(
+				wasm_f32x4_sub(wasm_f32x4_mul(density, wasm_f32x4_const_splat(INV_DENSITY)),
+					wasm_f32x4_const_splat(1)),
+				stiffness);
+			pressure = wasm_f32x4_max(wasm_f32x4_const_splat(0), pressure);
+
+			v128 volume = wasm_f32x4_div(wasm_f32x4_const_splat(1), density);
+			volume = wasm_v128_and(volume, wasm_f32x4_gt(density, wasm_f32x4_const_splat(0)));
+			v128 coeff = wasm_f32x4_mul(volume, wasm_f32x4_mul(pressureScale, pressure));
+			if (PULL) {
+				alignas(16) f32 coeffs[4];
+				wasm_v128_store(coeffs, coeff);
+				for (i32 l = 0; l < 4 && i + l < numP; l++) {
+					bins[sortDst[i + l]].coeff = coeffs[l];
+				}
+				continue;
+			}
+			v128 coeffx = wasm_f32x4_mul(coeff, vp.dx);
+			v128 coeffy = wasm_f32x4_mul(coeff, vp.dy);
+
+			v128 coeffx0 = wasm_f32x4_sub(coeffx, coeff);
+			v128 coeffx1 = coeffx;
+			v128 coeffx2 = wasm_f32x4_add(coeffx, coeff);
+			v128 coeffy0 = wasm_f32x4_sub(coeffy, coeff);
+			v128 coeffy1 = coeffy;
+			v128 coeffy2 = wasm_f32x4_add(coeffy, coeff);
+
+#define ADD_DVEL(ci, w, coeffx, coeffy)                                    \
+	{                                                                      \
+		scatterSub<ACC>(dvelx, fixedDvelx, ci, wasm_f32x4_mul(w, coeffx)); \
+		scatterSub<ACC>(dvely, fixedDvely, ci, wasm_f32x4_mul(w, coeffy)); \
+	}
+
+			ADD_DVEL(vp.c00, vp.w00, coeffx0, coeffy0);
+			ADD_DVEL(vp.c01, vp.w01, coeffx1, coeffy0);
+			ADD_DVEL(vp.c02, vp.w02, coeffx2, coeffy0);
+			ADD_DVEL(vp.c10, vp.w10, coeffx0, coeffy1);
+			ADD_DVEL(vp.c11, vp.w11, coeffx1, coeffy1);
+			ADD_DVEL(vp.c12, vp.w12, coeffx2, coeffy1);
+			ADD_DVEL(vp.c20, vp.w20, coeffx0, coeffy2);
+			ADD_DVEL(vp.c21, vp.w21, coeffx1, coeffy2);
+			ADD_DVEL(vp.c22, vp.w22, coeffx2, coeffy2);
+
+#undef ADD_DVEL
+		}
+	}
+
+	template <bool FUSED, i32 FEATURES>
+	void pressureQuads(i32 acc, f32* const* grid, i32 begin, i32 end) {
+		if (acc == ACC_ATOMIC) {
+			pressureQuads<FUSED, false, ACC_ATOMIC, FEATURES>(grid, begin, end);
+		} else if (acc == ACC_FIXED) {
+			pressureQuads<FUSED, false, ACC_FIXED, FEATURES>(grid, begin, end);
+		} else {
+			pressureQuads<FUSED, false, ACC_FLOAT, FEATURES>(grid, begin, end);
+		}
+	}
+
+	template <bool FUSED>
+	void pressureQuads(i32 features, i32 acc, f32* const* grid, i32 begin, i32 end) {
+		if (features & FEATURE_AERATION) {
+			pressureQuads<FUSED, FEATURE_AERATION>(acc, grid, begin, end);
+		} else {
+			pressureQuads<FUSED, 0>(acc, grid, begin, end);
+		}
+	}
+
+	// momentum change of the BLOCK_SIZE cells from x0 on row y, pulled from the pressure in the bins
+	void pullPressureRow(i32 y, i32 x0, i32 x1) {
+		const v128 offsets = wasm_f32x4_make(0.5, 1.5, 2.5, 3.5);
+		for (i32 x = x0; x < x0 + BLOCK_SIZE; x += 4) {
+			const v128 cx = wasm_f32x4_add(wasm_f32x4_splat(x), offsets);
+			v128 dx = wasm_f32x4_const_splat(0);
+			v128 dy = wasm_f32x4_const_splat(0);
+			if (x < x1) {
+				forBinnedNear(y, x, cx, [&](const BinnedParticle& p, v128 rx, f32 ry, v128 w) {
+					const v128 wc = wasm_f32x4_mul(w, wasm_f32x4_splat(p.coeff));
+					dx = wasm_f32x4_sub(dx, wasm_f32x4_mul(wc, rx));
+					dy = wasm_f32x4_sub(dy, wasm_f32x4_mul(wc, wasm_f32x4_splat(ry)));
+				});
+				const v128 inside = wasm_f32x4_lt(cx, wasm_f32x4_splat(x1));
+				dx = wasm_v128_and(dx, inside);
+				dy = wasm_v128_and(dy, inside);
+			}
+			const i32 c = y * gridStride + x;
+			wasm_v128_store(gdvelx + c, dx);
+			wasm_v128_store(gdvely + c, dy);
+		}
+	}
+
+	// zeroes the momentum change of the active blocks, for the steps in which the kernels only compute
+	// densities and aeration
+	void clearMomentumChange() {
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split(numActive, t, pool.size(), begin, end);
+			for (i32 b = begin; b < end; b++) {
+				forBlockRows(activeBlocks[b], [&](i32 y, i32 x0, i32) {
+					const i32 row = y * gridStride + x0;
+					for (i32 i = row; i < row + BLOCK_SIZE; i += 4) {
+						wasm_v128_store(gdvelx + i, wasm_f32x4_const_splat(0));
+						wasm_v128_store(gdvely + i, wasm_f32x4_const_splat(0));
+					}
+				});
+			}
+		});
+	}
+
+	void applyPressure() {
+		STAT_PHASE(STAT_PRESSURE);
+		if (gathering) {
+			pool.run([&](i32 t) {
+				i32 begin;
+				i32 end;
+				split((numP + 3) >> 2, t, pool.size(), begin, end);
+				if (stepFeatures & FEATURE_AERATION) {
+					pressureQuads<true, true, ACC_FLOAT, FEATURE_AERATION>(gdata, begin << 2, end << 2);
+				} else {
+					pressureQuads<true, true, ACC_FLOAT, 0>(gdata, begin << 2, end << 2);
+				}
+			});
+			if (solver != PRESSURE_EOS) {
+				clearMomentumChange();
+				return;
+			}
+			pool.run([&](i32 t) {
+				i32 begin;
+				i32 end;
+				split(numActive, t, pool.size(), begin, end);
+				for (i32 b = begin; b < end; b++) {
+					forBlockRows(activeBlocks[b], [&](i32 y, i32 x0, i32 x1) {
+						pullPressureRow(y, x0, x1);
+					});
+				}
+			});
+			return;
+		}
+
+		// includes the padding added by transferMass
+		const i32 lanes = wide ? wide->lanes : 4;
+		const i32 numP = (this->numP + lanes - 1) & ~(lanes - 1);
+
+		// apply pressure, each thread into its own grid or all into fixedGrid
+		pool.run([&](i32 t) {
+			f32* const* grid = t == 0 ? gdata : privateGrids[t];
+			i32 begin;
+			i32 end;
+			split(numP / lanes, t, pool.size(), begin, end);
+			begin *= lanes;
+			end *= lanes;
+
+			if (wide) {
+				const KernelState state = {pdata, gdata, gridW, gridH, gridStride, this->numP, scales};
+				wide->pressure(state, grid, begin, end);
+			} else if (fusedStencil) {
+				pressureQuads<true>(stepFeatures, accumulation, grid, begin, end);
+			} else {
+				pressureQuads<false>(stepFeatures, accumulation, grid, begin, end);
+			}
+		});
+		if (solver != PRESSURE_EOS) {
+			clearMomentumChange();
+			return;
+		}
+
+		// sum up the pressure contributions (or convert the fixed point sums)
+		if (pool.size() > 1 || accumulation != ACC_FLOAT) {
+			pool.run([&](i32 t) {
+				i32 begin;
+				i32 end;
+				split(numActive, t, pool.size(), begin, end);
+				for (i32 b = begin; b < end; b++) {
+					forBlockRows(activeBlocks[b], [&](i32 y, i32 x0, i32) {
+						const i32 row = y * gridStride + x0;
+						if (accumulation != ACC_FLOAT) {
+							convertFixedRow(row, G_DVEL_X, G_DVEL_Y + 1);
+							return;
+						}
+						for (i32 i = row; i < row + BLOCK_SIZE; i += 4) {
+							v128 dx = wasm_v128_load(gdvelx + i);
+							v128 dy = wasm_v128_load(gdvely + i);
+							for (i32 k = 1; k < pool.size(); k++) {
+								dx = wasm_f32x4_add(dx, wasm_v128_load(privateGrids[k][G_DVEL_X] + i));
+								dy = wasm_f32x4_add(dy, wasm_v128_load(privateGrids[k][G_DVEL_Y] + i));
+							}
+							wasm_v128_store(gdvelx + i, dx);
+							wasm_v128_store(gdvely + i, dy);
+						}
+					});
+				}
+			});
+		}
+	}
+
+	void mirrorPressure() {
+		STAT_PHASE(STAT_MIRROR_PRESSURE);
+		// symmetric boundary condition
+		for (i32 i = 0; i < gridH; i++) {
+			i32 n = gridW - 1;
+			i32 off = i * gridStride;
+			mirror2(off, off + 1, true, false);
+			mirror2(off + n, off + n - 1, true, false);
+		}
+		const i32 n = gridH - 1;
+		for (i32 j = 0; j < gridW; j++) {
+			if (gridWalls & WALL_TOP) {
+				mirror2(j, j + gridStride, false, true);
+			}
+			if (gridWalls & WALL_BOTTOM) {
+				mirror2(j + n * gridStride, j + (n - 1) * gridStride, false, true);
+			}
+		}
+	}
+
+	void p2g() {
+		transferMass();
+		mirrorMass();
+		applyPressure();
+		mirrorPressure();
+	}
+
+	void countColliders() {
+		while (numColliders > 0 && colliders[numColliders - 1].shape < 0) {
+			numColliders--;
+		}
+		numStatic = 0;
+		numMoving = 0;
+		for (i32 k = 0; k < numColliders; k++) {
+			if (colliders[k].shape < 0)
+				continue;
+			if (colliders[k].flags & COLLIDER_MOVING) {
+				numMoving++;
+			} else {
+				numStatic++;
+			}
+		}
+	}
+
+	i32 addCollider(i32 shape, f32 x, f32 y, f32 sizeX, f32 sizeY, i32 flags) {
+		if (shape != COLLIDER_CIRCLE && shape != COLLIDER_BOX)
+			return -1;
+		i32 id = 0;
+		while (id < numColliders && colliders[id].shape >= 0) {
+			id++;
+		}
+		if (id == MAX_COLLIDERS)
+			return -1;
+		colliders[id] = {shape, flags, x, y - gridOriginY, sizeX, sizeY, 0, 0};
+		numColliders = maxi(numColliders, id + 1);
+		countColliders();
+		if (!(flags & COLLIDER_MOVING)) {
+			sdfDirty = true;
+		}
+		return id;
+	}
+
+	void setColliderVelocity(i32 id, f32 vx, f32 vy) {
+		if (id < 0 || id >= numColliders || colliders[id].shape < 0)
+			return;
+		colliders[id].vx = vx;
+		colliders[id].vy = vy;
+	}
+
+	void removeCollider(i32 id) {
+		if (id < 0 || id >= numColliders || colliders[id].shape < 0)
+			return;
+		if (!(colliders[id].flags & COLLIDER_MOVING)) {
+			sdfDirty = true;
+		}
+		colliders[id].shape = -1;
+		countColliders();
+	}
+
+	void clearColliders() {
+		numColliders = 0;
+		countColliders();
+		sdfDirty = true;
+	}
+
+	// bakes the static colliders into the SDF grid and flags the blocks near them
+	void rebuildStaticSdf() {
+		if (!sdfDist) {
+			// one spare quad per plane, loads may run past the last row
+			if (!sdfArena.init(4 * Arena::footprint<f32>(capC)))
+				return;
+			sdfDist = sdfArena.take<f32>(capC);
+			sdfNormalX = sdfArena.take<f32>(capC);
+			sdfNormalY = sdfArena.take<f32>(capC);
+			sdfSlip = sdfArena.take<f32>(capC);
+		}
+
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split(gridH, t, pool.size(), begin, end);
+			for (i32 i = begin; i < end; i++) {
+				const v128 py = wasm_f32x4_splat(i + 0.5);
+				for (i32 j = 0; j < gridStride; j += 4) {
+					const v128 px = wasm_f32x4_make(j + 0.5, j + 1.5, j + 2.5, j + 3.5);
+					v128 dist = wasm_f32x4_const_splat(FAR);
+					v128 nx = wasm_f32x4_const_splat(0);
+					v128 ny = wasm_f32x4_const_splat(0);
+					v128 slip = wasm_f32x4_const_splat(1);
+					for (i32 k = 0; k < numColliders; k++) {
+						const Collider& c = colliders[k];
+						if (c.shape < 0 || (c.flags & COLLIDER_MOVING))
+							continue;
+						v128 d;
+						v128 cnx;
+						v128 cny;
+						colliderSdf(c, px, py, d, cnx, cny);
+						const v128 closer = wasm_f32x4_lt(d, dist);
+						dist = wasm_v128_bitselect(d, dist, closer);
+						nx = wasm_v128_bitselect(cnx, nx, closer);
+						ny = wasm_v128_bitselect(cny, ny, closer);
+						slip = wasm_v128_bitselect(
+							wasm_f32x4_splat(c.flags & COLLIDER_NO_SLIP ? 0 : 1), slip, closer);
+					}
+					const i32 idx = i * gridStride + j;
+					wasm_v128_store(sdfDist + idx, dist);
+					wasm_v128_store(sdfNormalX + idx, nx);
+					wasm_v128_store(sdfNormalY + idx, ny);
+					wasm_v128_store(sdfSlip + idx, slip);
+				}
+			}
+		});
+
+		for (i32 b = 0; b < blocksW * blocksH; b++) {
+			u8 near = 0;
+			forBlockRows(b, [&](i32 y, i32 x0, i32 x1) {
+				for (i32 i = y * gridStride + x0; i < y * gridStride + x1; i++) {
+					near |= sdfDist[i] < COLLIDER_BAND;
+				}
+			});
+			blockNearStatic[b] = near;
+		}
+		sdfDirty = false;
+	}
+
+	// advances the moving colliders by a substep
+	void moveColliders() {
+		for (i32 k = 0; k < numColliders; k++) {
+			Collider& c = colliders[k];
+			if (c.shape >= 0 && (c.flags & COLLIDER_MOVING)) {
+				c.x += c.vx * stepDt;
+				c.y += c.vy * stepDt;
+			}
+		}
+	}
+
+	// projects the velocities of cells in the band of a collider out of it, relative to the
+	// collider's own velocity
+	void projectColliders() {
+		if (numStatic > 0 && sdfDirty) {
+			rebuildStaticSdf();
+		}
+		const bool hasStatic = numStatic > 0 && !sdfDirty;
+
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split(numActive, t, pool.size(), begin, end);
+			for (i32 b = begin; b < end; b++) {
+				const i32 block = activeBlocks[b];
+				const bool nearStatic = hasStatic && blockNearStatic[block];
+
+				// moving colliders whose bounds, grown by the band, overlap the block
+				i32 near[MAX_COLLIDERS];
+				i32 numNear = 0;
+				{
+					const f32 x0 = (block % blocksW) << BLOCK_SHIFT;
+					const f32 y0 = (block / blocksW) << BLOCK_SHIFT;
+					for (i32 k = 0; k < numColliders && numMoving > 0; k++) {
+						const Collider& c = colliders[k];
+						if (c.shape < 0 || !(c.flags & COLLIDER_MOVING))
+							continue;
+						const f32 hx = c.sizeX + COLLIDER_BAND + 1;
+						const f32 hy = (c.shape == COLLIDER_CIRCLE ? c.sizeX : c.sizeY) + COLLIDER_BAND + 1;
+						if (c.x + hx > x0 && c.x - hx < x0 + BLOCK_SIZE && c.y + hy > y0 &&
+							c.y - hy < y0 + BLOCK_SIZE) {
+							near[numNear++] = k;
+						}
+					}
+				}
+				if (!nearStatic && numNear == 0)
+					continue;
+
+				forBlockRows(block, [&](i32 i, i32 x0, i32) {
+					const v128 py = wasm_f32x4_splat(i + 0.5);
+					i32 idx = i * gridStride + x0;
+					for (i32 j = x0; j < x0 + BLOCK_SIZE; j += 4, idx += 4) {
+						const v128 px = wasm_f32x4_make(j + 0.5, j + 1.5, j + 2.5, j + 3.5);
+
+						v128 dist = wasm_f32x4_const_splat(FAR);
+						v128 nx = wasm_f32x4_const_splat(0);
+						v128 ny = wasm_f32x4_const_splat(0);
+						v128 slip = wasm_f32x4_const_splat(1);
+						v128 cvx = wasm_f32x4_const_splat(0);
+						v128 cvy = wasm_f32x4_const_splat(0);
+						if (nearStatic) {
+							dist = wasm_v128_load(sdfDist + idx);
+							nx = wasm_v128_load(sdfNormalX + idx);
+							ny = wasm_v128_load(sdfNormalY + idx);
+							slip = wasm_v128_load(sdfSlip + idx);
+						}
+						for (i32 k = 0; k < numNear; k++) {
+							const Collider& c = colliders[near[k]];
+							v128 d;
+							v128 cnx;
+							v128 cny;
+							colliderSdf(c, px, py, d, cnx, cny);
+							const v128 closer = wasm_f32x4_lt(d, dist);
+							dist = wasm_v128_bitselect(d, dist, closer);
+							nx = wasm_v128_bitselect(cnx, nx, closer);
+							ny = wasm_v128_bitselect(cny, ny, closer);
+							slip = wasm_v128_bitselect(
+								wasm_f32x4_splat(c.flags & COLLIDER_NO_SLIP ? 0 : 1), slip, closer);
+							cvx = wasm_v128_bitselect(wasm_f32x4_splat(c.vx * stepDt), cvx, closer);
+							cvy = wasm_v128_bitselect(wasm_f32x4_splat(c.vy * stepDt), cvy, closer);
+						}
+
+						const v128 vx = wasm_v128_load(gvelx + idx);
+						const v128 vy = wasm_v128_load(gvely + idx);
+						const v128 relx = wasm_f32x4_sub(vx, cvx);
+						const v128 rely = wasm_f32x4_sub(vy, cvy);
+						const v128 vn = wasm_f32x4_add(wasm_f32x4_mul(relx, nx), wasm_f32x4_mul(rely, ny));
+						// only cells in the band moving into the solid
+						const v128 hit =
+							wasm_v128_and(wasm_f32x4_lt(dist, wasm_f32x4_const_splat(COLLIDER_BAND)),
+								wasm_f32x4_lt(vn, wasm_f32x4_const_splat(0)));
+						const v128 tx = wasm_f32x4_sub(relx, wasm_f32x4_mul(vn, nx));
+						const v128 ty = wasm_f32x4_sub(rely, wasm_f32x4_mul(vn, ny));
+						const v128 nvx =
+							wasm_v128_bitselect(wasm_f32x4_add(cvx, wasm_f32x4_mul(tx, slip)), vx, hit);
+						const v128 nvy =
+							wasm_v128_bitselect(wasm_f32x4_add(cvy, wasm_f32x4_mul(ty, slip)), vy, hit);
+
+						wasm_v128_store(gvelx + idx, nvx);
+						wasm_v128_store(gvely + idx, nvy);
+					}
+				});
+			}
+		});
+	}
+
+	// pushes four particle positions out of the colliders
+	inline void projectPositions(v128& px, v128& py) {
+		const v128 zeros = wasm_f32x4_const_splat(0);
+		if (numStatic > 0 && !sdfDirty) {
+			// first-order estimate from the centre of the cell the particle is in
+			const v128 gx = wasm_f32x4_floor(px);
+			const v128 gy = wasm_f32x4_floor(py);
+			const v128 row = wasm_i32x4_mul(wasm_i32x4_trunc_sat_f32x4(gy), wasm_i32x4_splat(gridStride));
+			const v128 cidx = wasm_i32x4_add(row, wasm_i32x4_trunc_sat_f32x4(gx));
+			const i32 i0 = wasm_i32x4_extract_lane(cidx, 0);
+			const i32 i1 = wasm_i32x4_extract_lane(cidx, 1);
+			const i32 i2 = wasm_i32x4_extract_lane(cidx, 2);
+			const i32 i3 = wasm_i32x4_extract_lane(cidx, 3);
+			const v128 nx = wasm_f32x4_make(sdfNormalX[i0], sdfNormalX[i1], sdfNormalX[i2], sdfNormalX[i3]);
+			const v128 ny = wasm_f32x4_make(sdfNormalY[i0], sdfNormalY[i1], sdfNormalY[i2], sdfNormalY[i3]);
+			const v128 ox = wasm_f32x4_sub(px, wasm_f32x4_add(gx, wasm_f32x4_const_splat(0.5)));
+			const v128 oy = wasm_f32x4_sub(py, wasm_f32x4_add(gy, wasm_f32x4_const_splat(0.5)));
+			v128 d = wasm_f32x4_make(sdfDist[i0], sdfDist[i1], sdfDist[i2], sdfDist[i3]);
+			d = wasm_f32x4_add(d, wasm_f32x4_add(wasm_f32x4_mul(nx, ox), wasm_f32x4_mul(ny, oy)));
+			d = wasm_f32x4_min(d, zeros);
+			px = wasm_f32x4_sub(px, wasm_f32x4_mul(d, nx));
+			py = wasm_f32x4_sub(py, wasm_f32x4_mul(d, ny));
+		}
+		for (i32 k = 0; k < numColliders && numMoving > 0; k++) {
+			const Collider& c = colliders[k];
+			if (c.shape < 0 || !(c.flags & COLLIDER_MOVING))
+				continue;
+			v128 d;
+			v128 nx;
+			v128 ny;
+			colliderSdf(c, px, py, d, nx, ny);
+			d = wasm_f32x4_min(d, zeros);
+			px = wasm_f32x4_sub(px, wasm_f32x4_mul(d, nx));
+			py = wasm_f32x4_sub(py, wasm_f32x4_mul(d, ny));
+		}
+	}
+
+	void updateGrid(
+		f32 gravityX, f32 gravityY, f32 mouseX, f32 mouseY, f32 dmouseX, f32 dmouseY, f32 radius) {
+		STAT_PHASE(STAT_UPDATE_GRID);
+		mouseY -= gridOriginY; // in the coordinates of the tank, see setGridWindow()
+		v128 gravityXs = wasm_f32x4_splat(gravityX);
+		v128 gravityYs = wasm_f32x4_splat(gravityY);
+		v128 mouseXs = wasm_f32x4_splat(mouseX);
+		v128 mouseYs = wasm_f32x4_splat(mouseY);
+		v128 dmouseXs = wasm_f32x4_splat(dmouseX);
+		v128 dmouseYs = wasm_f32x4_splat(dmouseY);
+		v128 rad2s = wasm_f32x4_splat(radius * radius);
+		v128 invRs = wasm_f32x4_splat(1 / radius);
+
+		// momentum to velocity
+		if (wide) {
+			const KernelState state = {pdata, gdata, gridW, gridH, gridStride, numP, scales};
+			const GridForces forces = {gravityX, gravityY, mouseX, mouseY, dmouseX, dmouseY, radius};
+			pool.run([&](i32 t) {
+				i32 begin;
+				i32 end;
+				split(numActive, t, pool.size(), begin, end);
+				threadSpeed2[t] = wide->velocity(state, activeBlocks, begin, end, blocksW, forces);
+			});
+		} else {
+			pool.run([&](i32 t) {
+				i32 begin;
+				i32 end;
+				split(numActive, t, pool.size(), begin, end);
+				v128 speed2 = wasm_f32x4_const_splat(0);
+				for (i32 b = begin; b < end; b++) {
+					// whole rows of the block, the padding cells past the grid have no mass
+					forBlockRows(activeBlocks[b], [&](i32 i, i32 x0, i32) {
+						i32 idx = i * gridStride + x0;
+						for (i32 j = x0; j < x0 + BLOCK_SIZE; j += 4, idx += 4) {
+							v128 mass = wasm_v128_load(gmass + idx);
+							v128 mask = wasm_f32x4_gt(mass, wasm_f32x4_const_splat(0));
+							v128 invM = wasm_f32x4_div(wasm_f32x4_const_splat(1), mass);
+							v128 mx =
+								wasm_f32x4_add(wasm_v128_load(gvelx + idx), wasm_v128_load(gdvelx + idx));
+							v128 my =
+								wasm_f32x4_add(wasm_v128_load(gvely + idx), wasm_v128_load(gdvely + idx));
+							v128 vx = wasm_f32x4_add(wasm_f32x4_mul(mx, invM), gravityXs);
+							v128 vy = wasm_f32x4_add(wasm_f32x4_mul(my, invM), gravityYs);
+
+							// mouse interaction
+							v128 dx =
+								wasm_f32x4_sub(mouseXs, wasm_f32x4_make(j + 0.5, j + 1.5, j + 2.5, j + 3.5));
+							v128 dy =
+								wasm_f32x4_sub(mouseYs, wasm_f32x4_make(i + 0.5, i + 0.5, i + 0.5, i + 0.5));
+							v128 r2 = wasm_f32x4_add(f32x4_pow2(dx), f32x4_pow2(dy));
+							v128 mask2 = wasm_f32x4_lt(r2, rad2s);
+							v128 r = wasm_f32x4_sqrt(r2);
+							v128 coeff = wasm_f32x4_min(wasm_f32x4_const_splat(1),
+								wasm_f32x4_sub(wasm_f32x4_const_splat(2), wasm_f32x4_mul(r, invRs)));
+							coeff = wasm_v128_and(coeff, mask2);
+							vx = wasm_f32x4_add(vx, wasm_f32x4_mul(coeff, wasm_f32x4_sub(dmouseXs, vx)));
+							vy = wasm_f32x4_add(vy, wasm_f32x4_mul(coeff, wasm_f32x4_sub(dmouseYs, vy)));
+
+							vx = wasm_v128_and(vx, mask);
+							vy = wasm_v128_and(vy, mask);
+							speed2 = wasm_f32x4_max(speed2, wasm_f32x4_add(f32x4_pow2(vx), f32x4_pow2(vy)));
+
+							wasm_v128_store(gvelx + idx, vx);
+							wasm_v128_store(gvely + idx, vy);
+						}
+					});
+				}
+				threadSpeed2[t] = f32x4_max_lane(speed2);
+			});
+		}
+		gridSpeed2 = maxOverThreads(threadSpeed2);
+
+		if (numColliders > 0) {
+			moveColliders();
+			projectColliders();
+		}
+
+		applyWalls();
+	}
+
+	// the boundary condition, on the border cells of the active blocks only
+	void applyWalls() {
+		// the rows of the top and bottom walls, -1 where the grid is open
+		const i32 top = gridWalls & WALL_TOP ? 0 : -1;
+		const i32 bottom = gridWalls & WALL_BOTTOM ? gridH - 1 : -1;
+		auto wall = [&](i32 i, i32 j) {
+			const i32 idx = i * gridStride + j + 1;
+			f32& vx = gvelx[idx - 1];
+			f32& vy = gvely[idx - 1];
+			if (j == 0)
+				vx = -gvelx[idx + 1];
+			if (j == gridW - 1)
+				vx = -gvelx[idx - 1];
+			if (i == top)
+				vy = -gvely[idx + gridStride];
+			if (i == bottom)
+				vy = -gvely[idx - gridStride];
+			if (j == 0 && vx < 0)
+				vx *= -1;
+			if (j == gridW - 1 && vx > 0)
+				vx *= -1;
+			if (i == top && vy < 0)
+				vy *= -1;
+			if (i == bottom && vy > 0)
+				vy *= -1;
+		};
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split(numActive, t, pool.size(), begin, end);
+			for (i32 b = begin; b < end; b++) {
+				if (!onBorder(activeBlocks[b]))
+					continue;
+				forBlockRows(activeBlocks[b], [&](i32 i, i32 x0, i32 x1) {
+					if (i == top || i == bottom) {
+						for (i32 j = x0; j < x1; j++) {
+							wall(i, j);
+						}
+						return;
+					}
+					if (x0 == 0)
+						wall(i, 0);
+					if (x1 == gridW)
+						wall(i, gridW - 1);
+				});
+			}
+		});
+	}
+
+	// calls f(y, c) with the first cell c of the rows of thread t's share of the active blocks, but
+	// those of the walls
+	template <class F>
+	inline void forSolverRows(i32 t, F&& f) {
+		i32 begin;
+		i32 end;
+		split(numActive, t, pool.size(), begin, end);
+		for (i32 b = begin; b < end; b++) {
+			forBlockRows(activeBlocks[b], [&](i32 y, i32 x0, i32) {
+				if (y > 0 && y < gridH - 1) {
+					f(y, y * gridStride + x0);
+				}
+			});
+		}
+	}
+
+	// the sum of the four neighbours of each of the four cells from c
+	inline v128 neighbourSum(const f32* x, i32 c) {
+		const v128 up = wasm_v128_load(x + c - gridStride);
+		const v128 down = wasm_v128_load(x + c + gridStride);
+		const v128 sides = wasm_f32x4_add(wasm_v128_load(x + c - 1), wasm_v128_load(x + c + 1));
+		return wasm_f32x4_add(wasm_f32x4_add(up, down), sides);
+	}
+
+	// the operator of the pressure solve on the four cells from c: the negated Laplacian over the
+	// unknowns. other cells hold 0 in x, which is the pressure of empty cells; the walls are left out
+	// of sdiag as well, so no pressure crosses them
+	inline v128 solverOperator(const f32* x, i32 c) {
+		const v128 diag = wasm_v128_load(sdiag + c);
+		const v128 ax = wasm_f32x4_sub(wasm_f32x4_mul(diag, wasm_v128_load(x + c)), neighbourSum(x, c));
+		return wasm_v128_and(ax, wasm_f32x4_gt(diag, wasm_f32x4_const_splat(0)));
+	}
+
+	inline f64 sumOverThreads(i32 k) {
+		f64 sum = 0;
+		for (i32 t = 0; t < pool.size(); t++) {
+			sum += threadSums[t][k];
+		}
+		return sum;
+	}
+
+	// allocates the planes of the solve and zeroes them when they don't hold the last step's
+	bool prepareSolver() {
+		if (!spres) {
+			if (!solverArena.init(6 * Arena::footprint<f32>(capC)))
+				return false;
+			f32** planes[] = {&spres, &sres, &sdir, &sadir, &sdiag, &sinvDiag};
+			for (f32** plane : planes) {
+				*plane = solverArena.take<f32>(capC);
+			}
+			solverW = 0;
+		}
+		// another layout, or blocks that went stale without a solve to clear them
+		if (gridW != solverW || gridH != solverH || solvedStep != gridSteps - 1) {
+			f32* planes[] = {spres, sres, sdir, sadir, sdiag, sinvDiag};
+			for (f32* plane : planes) {
+				memset(plane, 0, capC * sizeof(f32));
+			}
+			solverW = gridW;
+			solverH = gridH;
+		}
+		solvedStep = gridSteps;
+		return true;
+	}
+
+	// zeroes the BLOCK_SIZE cells from c on in every plane of the solve
+	inline void clearSolverRow(i32 c) {
+		f32* planes[] = {spres, sres, sdir, sadir, sdiag, sinvDiag};
+		for (f32* plane : planes) {
+			for (i32 k = 0; k < BLOCK_SIZE; k += 4) {
+				wasm_v128_store(plane + c + k, wasm_f32x4_const_splat(0));
+			}
+		}
+	}
+
+	// the cells of the four from c inside a static collider, which the solve treats like walls
+	inline v128 solidAt(i32 c) {
+		return wasm_f32x4_lt(wasm_v128_load(sdfDist + c), wasm_f32x4_const_splat(0));
+	}
+
+	// the unknowns, diagonal and right-hand side of the BLOCK_SIZE cells from x0 on row y, which is
+	// not a wall. the solve takes the velocities of a cell for those of its left and top faces, as
+	// on a MAC grid: the divergence of a cell is the flow out of its right and bottom faces (the
+	// velocities of the next cells) less that in through its own, and the gradient is one-sided
+	// the other way (see subtractPressureGradient), so that it is the divergence of the gradient
+	// that the 5-point solverOperator solves for. faces onto a wall or a solid are closed and
+	// carry nothing. the right-hand side makes the velocities divergence-free, and moves driftGain
+	// of the density error back to the rest density: all of it inside the water, only compression
+	// at its surface, which is never full. solids is set in the blocks near a static collider
+	void setupSolverRow(i32 y, i32 x0, bool solids) {
+		const v128 zeros = wasm_f32x4_const_splat(0);
+		const v128 ones = wasm_f32x4_const_splat(1);
+		const v128 lastX = wasm_f32x4_splat(gridW - 2); // the last cell inside the walls
+		const v128 invDensity = wasm_f32x4_const_splat(INV_DENSITY);
+		const v128 driftGain = wasm_f32x4_splat(scales.driftGain);
+		const v128 open = wasm_i32x4_const_splat(-1);
+		// the top and bottom faces, all closed on the rows next to the walls
+		const v128 topOpen = y == 1 ? zeros : open;
+		const v128 bottomOpen = y == gridH - 2 ? zeros : open;
+		for (i32 x = x0; x < x0 + BLOCK_SIZE; x += 4) {
+			const i32 c = y * gridStride + x;
+			const v128 xs = wasm_f32x4_add(wasm_f32x4_splat(x), wasm_f32x4_make(0, 1, 2, 3));
+			const v128 mass = wasm_v128_load(gmass + c);
+			const v128 inside = wasm_v128_and(wasm_f32x4_ge(xs, ones), wasm_f32x4_le(xs, lastX));
+			v128 leftOpen = wasm_v128_andnot(open, wasm_f32x4_eq(xs, ones));
+			v128 rightOpen = wasm_v128_andnot(open, wasm_f32x4_eq(xs, lastX));
+			v128 top = topOpen;
+			v128 bottom = bottomOpen;
+			if (solids) {
+				leftOpen = wasm_v128_andnot(leftOpen, solidAt(c - 1));
+				rightOpen = wasm_v128_andnot(rightOpen, solidAt(c + 1));
+				top = wasm_v128_andnot(top, solidAt(c - gridStride));
+				bottom = wasm_v128_andnot(bottom, solidAt(c + gridStride));
+			}
+			// masks are -1, so adding them counts the open faces down from 0
+			const v128 diag = wasm_f32x4_sub(zeros, wasm_f32x4_convert_i32x4(wasm_i32x4_add(
+				wasm_i32x4_add(leftOpen, rightOpen), wasm_i32x4_add(top, bottom))));
+			v128 unknown = wasm_v128_and(inside, wasm_f32x4_gt(mass, zeros));
+			if (solids) {
+				unknown = wasm_v128_and(unknown, wasm_f32x4_gt(diag, zeros));
+				unknown = wasm_v128_andnot(unknown, solidAt(c));
+			}
+
+			const v128 dvx = wasm_f32x4_sub(wasm_v128_and(wasm_v128_load(gvelx + c + 1), rightOpen),
+				wasm_v128_and(wasm_v128_load(gvelx + c), leftOpen));
+			const v128 dvy = wasm_f32x4_sub(wasm_v128_and(wasm_v128_load(gvely + c + gridStride), bottom),
+				wasm_v128_and(wasm_v128_load(gvely + c), top));
+			const v128 div = wasm_f32x4_add(dvx, dvy);
+			const v128 error = wasm_f32x4_sub(wasm_f32x4_mul(mass, invDensity), ones);
+			const v128 inner = wasm_v128_and(
+				wasm_v128_and(wasm_f32x4_gt(wasm_v128_load(gmass + c - 1), zeros),
+					wasm_f32x4_gt(wasm_v128_load(gmass + c + 1), zeros)),
+				wasm_v128_and(wasm_f32x4_gt(wasm_v128_load(gmass + c - gridStride), zeros),
+					wasm_f32x4_gt(wasm_v128_load(gmass + c + gridStride), zeros)));
+			const v128 drift = wasm_v128_bitselect(error, wasm_f32x4_max(error, zeros), inner);
+			const v128 rhs = wasm_f32x4_sub(wasm_f32x4_mul(driftGain, drift), div);
+
+			wasm_v128_store(spres + c, wasm_v128_and(wasm_v128_load(spres + c), unknown));
+			wasm_v128_store(sres + c, wasm_v128_and(rhs, unknown));
+			wasm_v128_store(sdir + c, zeros);
+			wasm_v128_store(sadir + c, zeros);
+			wasm_v128_store(sdiag + c, wasm_v128_and(diag, unknown));
+			wasm_v128_store(sinvDiag + c, wasm_v128_and(wasm_f32x4_div(ones, diag), unknown));
+		}
+	}
+
+	// subtracts the pressure gradient across the left and top faces of the BLOCK_SIZE cells from x0
+	// on row y from their velocities, see setupSolverRow. the faces of empty cells next to the water
+	// take it too, the pressure being 0 there. closed faces are stopped, as the solve assumed
+	void subtractPressureGradient(i32 y, i32 x0, bool solids) {
+		const v128 second = wasm_f32x4_const_splat(2); // the first cell with an open left face
+		const v128 lastX = wasm_f32x4_splat(gridW - 2);
+		const v128 topOpen = y == 1 ? wasm_f32x4_const_splat(0) : wasm_i32x4_const_splat(-1);
+		for (i32 x = x0; x < x0 + BLOCK_SIZE; x += 4) {
+			const i32 c = y * gridStride + x;
+			const v128 xs = wasm_f32x4_add(wasm_f32x4_splat(x), wasm_f32x4_make(0, 1, 2, 3));
+			const v128 p = wasm_v128_load(spres + c);
+			v128 leftOpen = wasm_v128_and(wasm_f32x4_ge(xs, second), wasm_f32x4_le(xs, lastX));
+			v128 top = topOpen;
+			if (solids) {
+				const v128 solid = solidAt(c);
+				leftOpen = wasm_v128_andnot(leftOpen, wasm_v128_or(solid, solidAt(c - 1)));
+				top = wasm_v128_andnot(top, wasm_v128_or(solid, solidAt(c - gridStride)));
+			}
+			const v128 gx = wasm_f32x4_sub(p, wasm_v128_load(spres + c - 1));
+			const v128 gy = wasm_f32x4_sub(p, wasm_v128_load(spres + c - gridStride));
+			const v128 vx = wasm_f32x4_sub(wasm_v128_load(gvelx + c), gx);
+			const v128 vy = wasm_f32x4_sub(wasm_v128_load(gvely + c), gy);
+			wasm_v128_store(gvelx + c, wasm_v128_and(vx, leftOpen));
+			wasm_v128_store(gvely + c, wasm_v128_and(vy, top));
+		}
+	}
+
+	void projectPressure() {
+		if (solver == PRESSURE_EOS || numActive == 0)
+			return;
+		STAT_PHASE(STAT_PROJECT);
+		if (!prepareSolver())
+			return;
+		const v128 zeros = wasm_f32x4_const_splat(0);
+		// updateGrid rebuilt the distances if they were dirty
+		const bool hasStatic = numStatic > 0 && !sdfDirty;
+
+		// the blocks that went inactive are cleared as clearStaleBlocks does for the grid, so the
+		// planes stay zero outside the active blocks
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split(numClear, t, pool.size(), begin, end);
+			for (i32 k = begin; k < end; k++) {
+				if (!blockActive[clearBlocks[k]]) {
+					forBlockRows(clearBlocks[k], [&](i32 y, i32 x0, i32) {
+						clearSolverRow(y * gridStride + x0);
+					});
+				}
+			}
+			split(numActive, t, pool.size(), begin, end);
+			for (i32 b = begin; b < end; b++) {
+				const bool solids = hasStatic && blockNearStatic[activeBlocks[b]];
+				forBlockRows(activeBlocks[b], [&](i32 y, i32 x0, i32) {
+					if (y == 0 || y == gridH - 1) {
+						clearSolverRow(y * gridStride + x0);
+					} else {
+						setupSolverRow(y, x0, solids);
+					}
+				});
+			}
+		});
+
+		// the residual of the last pressure, the initial guess
+		pool.run([&](i32 t) {
+			v128 rz = zeros;
+			v128 bb = zeros;
+			forSolverRows(t, [&](i32, i32 row) {
+				for (i32 c = row; c < row + BLOCK_SIZE; c += 4) {
+					const v128 rhs = wasm_v128_load(sres + c);
+					const v128 inv = wasm_v128_load(sinvDiag + c);
+					const v128 r = wasm_f32x4_sub(rhs, solverOperator(spres, c));
+					const v128 z = wasm_f32x4_mul(r, inv);
+					wasm_v128_store(sres + c, r);
+					wasm_v128_store(sdir + c, z);
+					rz = wasm_f32x4_add(rz, wasm_f32x4_mul(r, z));
+					bb = wasm_f32x4_add(bb, wasm_f32x4_mul(f32x4_pow2(rhs), inv));
+				}
+			});
+			threadSums[t][0] = f32x4_sum_lanes(rz);
+			threadSums[t][1] = f32x4_sum_lanes(bb);
+		});
+		f64 rz = sumOverThreads(0);
+		const f64 rhsNorm = sumOverThreads(1);
+		if (rhsNorm == 0) {
+			// nothing to correct, the velocities stand
+			solverResidual = 0;
+			return;
+		}
+
+		// Jacobi preconditioned conjugate gradients, three passes an iteration
+		const f64 target = (f64) solverTolerance * solverTolerance * rhsNorm;
+		i32 iterations = 0;
+		while (iterations < solverMaxIterations && rz > target) {
+			iterations++;
+			pool.run([&](i32 t) {
+				v128 dq = zeros;
+				forSolverRows(t, [&](i32, i32 row) {
+					for (i32 c = row; c < row + BLOCK_SIZE; c += 4) {
+						const v128 q = solverOperator(sdir, c);
+						wasm_v128_store(sadir + c, q);
+						dq = wasm_f32x4_add(dq, wasm_f32x4_mul(wasm_v128_load(sdir + c), q));
+					}
+				});
+				threadSums[t][0] = f32x4_sum_lanes(dq);
+			});
+			const f64 dq = sumOverThreads(0);
+			if (!(dq > 0))
+				break;
+			const v128 alpha = wasm_f32x4_splat((f32) (rz / dq));
+			pool.run([&](i32 t) {
+				v128 rz = zeros;
+				forSolverRows(t, [&](i32, i32 row) {
+					for (i32 c = row; c < row + BLOCK_SIZE; c += 4) {
+						const v128 x = wasm_f32x4_add(
+							wasm_v128_load(spres + c), wasm_f32x4_mul(alpha, wasm_v128_load(sdir + c)));
+						const v128 r = wasm_f32x4_sub(
+							wasm_v128_load(sres + c), wasm_f32x4_mul(alpha, wasm_v128_load(sadir + c)));
+						wasm_v128_store(spres + c, x);
+						wasm_v128_store(sres + c, r);
+						rz = wasm_f32x4_add(rz, wasm_f32x4_mul(f32x4_pow2(r), wasm_v128_load(sinvDiag + c)));
+					}
+				});
+				threadSums[t][0] = f32x4_sum_lanes(rz);
+			});
+			const f64 nextRz = sumOverThreads(0);
+			const v128 beta = wasm_f32x4_splat((f32) (nextRz / rz));
+			rz = nextRz;
+			if (rz <= target)
+				break;
+			pool.run([&](i32 t) {
+				forSolverRows(t, [&](i32, i32 row) {
+					for (i32 c = row; c < row + BLOCK_SIZE; c += 4) {
+						const v128 z = wasm_f32x4_mul(wasm_v128_load(sres + c), wasm_v128_load(sinvDiag + c));
+						const v128 d = wasm_f32x4_add(z, wasm_f32x4_mul(beta, wasm_v128_load(sdir + c)));
+						wasm_v128_store(sdir + c, d);
+					}
+				});
+			});
+		}
+		solverIterations += iterations;
+		solverResidual = (f32) sqrt(rz / rhsNorm);
+		// counted in Stats; the partial solution is used all the same, solverResidual being left
+		unconvergedSolves += rz > target;
+
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split(numActive, t, pool.size(), begin, end);
+			for (i32 b = begin; b < end; b++) {
+				const bool solids = hasStatic && blockNearStatic[activeBlocks[b]];
+				forBlockRows(activeBlocks[b], [&](i32 y, i32 x0, i32) {
+					if (y > 0 && y < gridH - 1) {
+						subtractPressureGradient(y, x0, solids);
+					}
+				});
+			}
+		});
+		if (numColliders > 0) {
+			projectColliders();
+		}
+		applyWalls();
+	}
+
+	// grid to particle for the quads [begin, end), returns the largest squared velocity
+	template <bool FUSED, i32 FEATURES>
+	f32 g2pQuads(i32 begin, i32 end) {
+		constexpr bool AERATED = (FEATURES & FEATURE_AERATION) != 0;
+		const f32 ONE = 1 + 1e-3;
+		const v128 minPosX = wasm_f32x4_const_splat(ONE);
+		const v128 maxPosX = wasm_f32x4_splat(gridW - ONE);
+		const v128 minPosY = wasm_f32x4_const_splat(ONE);
+		const v128 maxPosY = wasm_f32x4_splat(gridH - ONE);
+		const v128 aerationCoeff = wasm_f32x4_splat(scales.aerationCoeff);
+		const v128 invAerationThreshold = wasm_f32x4_splat(scales.invAerationThreshold);
+		v128 speed2 = wasm_f32x4_const_splat(0);
+
+		for (i32 i = begin; i < end; i += 4) {
+			VectorizedParticle stencil;
+			if (FUSED) {
+				computeStencil(stencil, i, numP);
+			}
+			const VectorizedParticle& vp = FUSED ? stencil : vps[i >> 2];
+			const v128 posx = wasm_v128_load(pposx + i);
+			const v128 posy = wasm_v128_load(pposy + i);
+
+			v128 vx = wasm_f32x4_const_splat(0);
+			v128 vy = wasm_f32x4_const_splat(0);
+			v128 gv00 = wasm_f32x4_const_splat(0);
+			v128 gv01 = wasm_f32x4_const_splat(0);
+			v128 gv10 = wasm_f32x4_const_splat(0);
+			v128 gv11 = wasm_f32x4_const_splat(0);
+
+			v128 w;
+			v128 ci;
+			v128 wvx;
+			v128 wvy;
+
+#define VISIT_CELL()                                      \
+	{                                                     \
+		wvx = wasm_f32x4_mul(w, f32x4_gather(gvelx, ci)); \
+		wvy = wasm_f32x4_mul(w, f32x4_gather(gvely, ci)); \
+	}
+
+			w = vp.w00;
+			ci = vp.c00;
+			VISIT_CELL();
+			vx = wasm_f32x4_add(vx, wvx);
+			vy = wasm_f32x4_add(vy, wvy);
+			gv00 = wasm_f32x4_sub(gv00, wvx);
+			gv01 = wasm_f32x4_sub(gv01, wvx);
+			gv10 = wasm_f32x4_sub(gv10, wvy);
+			gv11 = wasm_f32x4_sub(gv11, wvy);
+
+			w = vp.w01;
+			ci = vp.c01;
+			VISIT_CELL();
+			vx = wasm_f32x4_add(vx, wvx);
+			vy = wasm_f32x4_add(vy, wvy);
+			gv01 = wasm_f32x4_sub(gv01, wvx);
+			gv11 = wasm_f32x4_sub(gv11, wvy);
+
+			w = vp.w02;
+			ci = vp.c02;
+			VISIT_CELL();
+			vx = wasm_f32x4_add(vx, wvx);
+			vy = wasm_f32x4_add(vy, wvy);
+			gv00 = wasm_f32x4_add(gv00, wvx);
+			gv01 = wasm_f32x4_sub(gv01, wvx);
+			gv10 = wasm_f32x4_add(gv10, wvy);
+			gv11 = wasm_f32x4_sub(gv11, wvy);
+
+			w = vp.w10;
+			ci = vp.c10;
+			VISIT_CELL();
+			vx = wasm_f32x4_add(vx, wvx);
+			vy = wasm_f32x4_add(vy, wvy);
+			gv00 = wasm_f32x4_sub(gv00, wvx);
+			gv10 = wasm_f32x4_sub(gv10, wvy);
+
+			w = vp.w11;
+			ci = vp.c11;
+			VISIT_CELL();
+			vx = wasm_f32x4_add(vx, wvx);
+			vy = wasm_f32x4_add(vy, wvy);
+
+			w = vp.w12;
+			ci = vp.c12;
+			VISIT_CELL();
+			vx = wasm_f32x4_add(vx, wvx);
+			vy = wasm_f32x4_add(vy, wvy);
+			gv00 = wasm_f32x4_add(gv00, wvx);
+			gv10 = wasm_f32x4_add(gv10, wvy);
+
+			w = vp.w20;
+			ci = vp.c20;
+			VISIT_CELL();
+			vx = wasm_f32x4_add(vx, wvx);
+			vy = wasm_f32x4_add(vy, wvy);
+			gv00 = wasm_f32x4_sub(gv00, wvx);
+			gv01 = wasm_f32x4_add(gv01, wvx);
+			gv10 = wasm_f32x4_sub(gv10, wvy);
+			gv11 = wasm_f32x4_add(gv11, wvy);
+
+			w = vp.w21;
+			ci = vp.c21;
+			VISIT_CELL();
+			vx = wasm_f32x4_add(vx, wvx);
+			vy = wasm_f32x4_add(vy, wvy);
+			gv01 = wasm_f32x4_add(gv01, wvx);
+			gv11 = wasm_f32x4_add(gv11, wvy);
+
+			w = vp.w22;
+			ci = vp.c22;
+			VISIT_CELL();
+			vx = wasm_f32x4_add(vx, wvx);
+			vy = wasm_f32x4_add(vy, wvy);
+			gv00 = wasm_f32x4_add(gv00, wvx);
+			gv01 = wasm_f32x4_add(gv01, wvx);
+			gv10 = wasm_f32x4_add(gv10, wvy);
+			gv11 = wasm_f32x4_add(gv11, wvy);
+
+			gv00 = wasm_f32x4_mul(wasm_f32x4_const_splat(4), wasm_f32x4_add(gv00, wasm_f32x4_mul(vx, vp.dx)));
+			gv01 = wasm_f32x4_mul(wasm_f32x4_const_splat(4), wasm_f32x4_add(gv01, wasm_f32x4_mul(vx, vp.dy)));
+			gv10 = wasm_f32x4_mul(wasm_f32x4_const_splat(4), wasm_f32x4_add(gv10, wasm_f32x4_mul(vy, vp.dx)));
+			gv11 = wasm_f32x4_mul(wasm_f32x4_const_splat(4), wasm_f32x4_add(gv11, wasm_f32x4_mul(vy, vp.dy)));
+
+			speed2 = wasm_f32x4_max(speed2, wasm_f32x4_add(f32x4_pow2(vx), f32x4_pow2(vy)));
+			v128 nposx = wasm_f32x4_min(wasm_f32x4_max(wasm_f32x4_add(posx, vx), minPosX), maxPosX);
+			v128 nposy = wasm_f32x4_min(wasm_f32x4_max(wasm_f32x4_add(posy, vy), minPosY), maxPosY);
+			if (numColliders > 0) {
+				projectPositions(nposx, nposy);
+				nposx = wasm_f32x4_min(wasm_f32x4_max(nposx, minPosX), maxPosX);
+				nposy = wasm_f32x4_min(wasm_f32x4_max(nposy, minPosY), maxPosY);
+			}
+			v128 nvelx = wasm_f32x4_sub(nposx, posx);
+			v128 nvely = wasm_f32x4_sub(nposy, posy);
+
+			if (AERATED) {
+				v128 accx = wasm_f32x4_sub(nvelx, wasm_v128_load(pvelx + i));
+				v128 accy = wasm_f32x4_sub(nvely, wasm_v128_load(pvely + i));
+				v128 densityRatio =
+					wasm_f32x4_mul(wasm_v128_load(pdens + i), wasm_f32x4_const_splat(INV_DENSITY));
+				v128 accLen = wasm_f32x4_sqrt(wasm_f32x4_add(f32x4_pow2(accx), f32x4_pow2(accy)));
+				v128 aerationScale = wasm_f32x4_mul(
+					wasm_f32x4_sub(
+						wasm_f32x4_const_splat(1), wasm_f32x4_mul(densityRatio, invAerationThreshold)),
+					aerationCoeff);
+				v128 aerationDelta =
+					wasm_f32x4_max(wasm_f32x4_const_splat(0), wasm_f32x4_mul(accLen, aerationScale));
+				v128 newAeration = wasm_f32x4_min(
+					wasm_f32x4_const_splat(1), wasm_f32x4_add(wasm_v128_load(paeration + i), aerationDelta));
+				wasm_v128_store(paeration + i, newAeration);
+			}
+
+			wasm_v128_store(pposx + i, nposx);
+			wasm_v128_store(pposy + i, nposy);
+			wasm_v128_store(pvelx + i, nvelx);
+			wasm_v128_store(pvely + i, nvely);
+			wasm_v128_store(pgvel00 + i, gv00);
+			wasm_v128_store(pgvel01 + i, gv01);
+			wasm_v128_store(pgvel10 + i, gv10);
+			wasm_v128_store(pgvel11 + i, gv11);
+
+#undef VISIT_CELL
+		}
+		return f32x4_max_lane(speed2);
+	}
+
+	template <bool FUSED>
+	f32 g2pQuads(i32 features, i32 begin, i32 end) {
+		if (features & FEATURE_AERATION)
+			return g2pQuads<FUSED, FEATURE_AERATION>(begin, end);
+		return g2pQuads<FUSED, 0>(begin, end);
+	}
+
+	void g2p() {
+		STAT_PHASE(STAT_G2P);
+		// grid to particle. the wide kernels leave the collider projection to the 4-lane ones
+		const i32 lanes = wide && numColliders == 0 ? wide->lanes : 4;
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split((numP + lanes - 1) / lanes, t, pool.size(), begin, end);
+			begin *= lanes;
+			end *= lanes;
+
+			if (lanes > 4) {
+				const KernelState state = {pdata, gdata, gridW, gridH, gridStride, numP, scales};
+				threadSpeed2[t] = wide->g2p(state, begin, end);
+			} else if (fusedStencil || wide || gathering) {
+				threadSpeed2[t] = g2pQuads<true>(stepFeatures, begin, end);
+			} else {
+				threadSpeed2[t] = g2pQuads<false>(stepFeatures, begin, end);
+			}
+		});
+		particleSpeed2 = maxOverThreads(threadSpeed2);
+	}
+
+	// point sprites for the renderer, as updateMesh in Main.hx lays them out: per particle the
+	// position in pixels, the point size in device pixels and the aeration clamped to [0, 1]
+	iptr renderVertices(f32 scale, f32 pixelScale) {
+		const v128 scales = wasm_f32x4_splat(scale);
+		const v128 sizeScales = wasm_f32x4_splat(scale * PDELTA * 0.85f * 2 * pixelScale);
+
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split((numP + 3) >> 2, t, pool.size(), begin, end);
+			begin <<= 2;
+			end <<= 2;
+
+			for (i32 i = begin; i < end; i += 4) {
+				const v128 x = wasm_f32x4_mul(wasm_v128_load(pposx + i), scales);
+				const v128 y = wasm_f32x4_mul(wasm_v128_load(pposy + i), scales);
+				const v128 d = wasm_f32x4_mul(wasm_v128_load(pdens + i), wasm_f32x4_const_splat(INV_DENSITY));
+				const v128 size = wasm_f32x4_mul(
+					wasm_f32x4_min(
+						wasm_f32x4_add(d, wasm_f32x4_const_splat(0.5)), wasm_f32x4_const_splat(1.5)),
+					sizeScales);
+				const v128 aeration = wasm_f32x4_min(
+					wasm_f32x4_max(wasm_v128_load(paeration + i), wasm_f32x4_const_splat(0)),
+					wasm_f32x4_const_splat(1));
+
+				// 4x4 transpose into one vertex per particle
+				const v128 xy01 = wasm_i32x4_shuffle(x, y, 0, 4, 1, 5);
+				const v128 xy23 = wasm_i32x4_shuffle(x, y, 2, 6, 3, 7);
+				const v128 sa01 = wasm_i32x4_shuffle(size, aeration, 0, 4, 1, 5);
+				const v128 sa23 = wasm_i32x4_shuffle(size, aeration, 2, 6, 3, 7);
+				f32* v = vertices + i * 4;
+				wasm_v128_store(v, wasm_i32x4_shuffle(xy01, sa01, 0, 1, 4, 5));
+				wasm_v128_store(v + 4, wasm_i32x4_shuffle(xy01, sa01, 2, 3, 6, 7));
+				wasm_v128_store(v + 8, wasm_i32x4_shuffle(xy23, sa23, 0, 1, 4, 5));
+				wasm_v128_store(v + 12, wasm_i32x4_shuffle(xy23, sa23, 2, 3, 6, 7));
+			}
+		});
+		return ptr(vertices);
+	}
+
+	// the texture buffer and filter taps of densityTexture() for the current grid and threads
+	bool reserveTexture(i32 width, i32 height, i32 format) {
+		const i32 tapsX = (i32) ceilf(2 * fmaxf((f32) gridW / width, 1));
+		const i32 tapsY = (i32) ceilf(2 * fmaxf((f32) gridH / height, 1));
+		const i32 stride = (width + 7) & ~7;
+		const size_t bytes = (size_t) width * height * (format == TEXTURE_F16 ? 4 : 2);
+		const i32 n = pool.size();
+		textureW = 0;
+		texture = nullptr;
+		const size_t columns = Arena::footprint<i32>(tapsX * stride) + Arena::footprint<f32>(tapsX * stride);
+		const size_t rows = Arena::footprint<i32>(tapsY * height) + Arena::footprint<f32>(tapsY * height);
+		const size_t scratch = n * Arena::footprint<f32>(2 * gridStride);
+		if (!textureArena.init(Arena::footprint<u8>(bytes) + columns + rows + scratch))
+			return false;
+		texture = textureArena.take<u8>(bytes);
+		columnTaps = textureArena.take<i32>(tapsX * stride);
+		columnWeights = textureArena.take<f32>(tapsX * stride);
+		rowTaps = textureArena.take<i32>(tapsY * height);
+		rowWeights = textureArena.take<f32>(tapsY * height);
+		for (i32 t = 0; t < n; t++) {
+			textureRows[t] = textureArena.take<f32>(2 * gridStride);
+		}
+		// the padding columns read cell 0 with no weight
+		memset(columnTaps, 0, tapsX * stride * sizeof(i32));
+		memset(columnWeights, 0, tapsX * stride * sizeof(f32));
+		tentTaps(width, gridW, tapsX, 1, stride, columnTaps, columnWeights);
+		tentTaps(height, gridH, tapsY, tapsY, 1, rowTaps, rowWeights);
+		textureW = width;
+		textureH = height;
+		textureFormat = format;
+		textureGridW = gridW;
+		textureGridH = gridH;
+		textureThreads = n;
+		columnTapCount = tapsX;
+		rowTapCount = tapsY;
+		tapStride = stride;
+		return true;
+	}
+
+	// texture row y filtered down the grid into the mass and the mass times aeration of each column
+	void filterTextureRow(i32 y, f32* mass, f32* aeration, bool aerated) {
+		memset(mass, 0, 2 * gridStride * sizeof(f32));
+		for (i32 k = 0; k < rowTapCount; k++) {
+			const f32 w = rowWeights[y * rowTapCount + k];
+			if (w == 0)
+				continue;
+			const i32 row = rowTaps[y * rowTapCount + k];
+			const u8* active = blockActive + (row >> BLOCK_SHIFT) * blocksW;
+			const v128 weights = wasm_f32x4_splat(w);
+			const f32* m = gmass + row * gridStride;
+			const f32* a = gaeration + row * gridStride;
+			// blocks the last step left out may hold stale sums
+			for (i32 x = 0; x < gridW; x += 4) {
+				const v128 on = wasm_i32x4_splat(-(i32) active[x >> BLOCK_SHIFT]);
+				const v128 wm = wasm_v128_and(wasm_f32x4_mul(wasm_v128_load(m + x), weights), on);
+				wasm_v128_store(mass + x, wasm_f32x4_add(wasm_v128_load(mass + x), wm));
+				if (aerated) {
+					const v128 wa = wasm_f32x4_mul(wm, wasm_v128_load(a + x));
+					wasm_v128_store(aeration + x, wasm_f32x4_add(wasm_v128_load(aeration + x), wa));
+				}
+			}
+		}
+	}
+
+	// the density and aeration of texels [x, x + 4) of a row filtered by filterTextureRow()
+	void filterTexels(i32 x, const f32* mass, const f32* aeration, v128& density, v128& meanAeration) {
+		v128 m = wasm_f32x4_const_splat(0);
+		v128 a = wasm_f32x4_const_splat(0);
+		for (i32 k = 0; k < columnTapCount; k++) {
+			const v128 idx = wasm_v128_load(columnTaps + k * tapStride + x);
+			const v128 w = wasm_v128_load(columnWeights + k * tapStride + x);
+			m = wasm_f32x4_add(m, wasm_f32x4_mul(f32x4_gather(mass, idx), w));
+			a = wasm_f32x4_add(a, wasm_f32x4_mul(f32x4_gather(aeration, idx), w));
+		}
+		const v128 tiny = wasm_f32x4_const_splat(1e-6);
+		density = wasm_f32x4_mul(m, wasm_f32x4_const_splat(INV_DENSITY));
+		meanAeration = wasm_v128_and(wasm_f32x4_div(a, wasm_f32x4_max(m, tiny)), wasm_f32x4_gt(m, tiny));
+	}
+
+	iptr densityTexture(i32 width, i32 height, i32 format) {
+		if (width <= 0 || height <= 0 || width > MAX_TEXTURE_SIZE || height > MAX_TEXTURE_SIZE ||
+			(format != TEXTURE_U8 && format != TEXTURE_F16) || gridW <= 0 || gridH <= 0)
+			return 0;
+		if ((width != textureW || height != textureH || format != textureFormat || gridW != textureGridW ||
+				gridH != textureGridH || pool.size() > textureThreads) &&
+			!reserveTexture(width, height, format))
+			return 0;
+		const i32 texelBytes = format == TEXTURE_F16 ? 4 : 2;
+		if (gridDirty) {
+			// nothing stepped on this grid yet
+			memset(texture, 0, (size_t) width * height * texelBytes);
+			return ptr(texture);
+		}
+
+		const bool aerated = stepFeatures & FEATURE_AERATION;
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split(height, t, pool.size(), begin, end);
+			f32* mass = textureRows[t];
+			f32* aeration = mass + gridStride;
+			const v128 zeros = wasm_f32x4_const_splat(0);
+			const v128 halves = wasm_f32x4_const_splat(0.5);
+
+			for (i32 y = begin; y < end; y++) {
+				filterTextureRow(y, mass, aeration, aerated);
+				u8* row = texture + (size_t) y * width * texelBytes;
+				// eight texels at a time, the last ones through a copy
+				for (i32 x = 0; x < width; x += 8) {
+					alignas(16) u8 texels[32];
+					v128 d0, a0, d1, a1;
+					filterTexels(x, mass, aeration, d0, a0);
+					filterTexels(x + 4, mass, aeration, d1, a1);
+					u8* dst = x + 8 <= width ? row + x * texelBytes : texels;
+					if (format == TEXTURE_U8) {
+						const v128 g0 = wasm_i32x4_shl(f32x4_to_unorm8(a0), 8);
+						const v128 g1 = wasm_i32x4_shl(f32x4_to_unorm8(a1), 8);
+						const v128 rg0 = wasm_v128_or(f32x4_to_unorm8(wasm_f32x4_mul(d0, halves)), g0);
+						const v128 rg1 = wasm_v128_or(f32x4_to_unorm8(wasm_f32x4_mul(d1, halves)), g1);
+						wasm_v128_store(dst, wasm_u16x8_narrow_i32x4(rg0, rg1));
+					} else {
+						const v128 h0 = wasm_i32x4_shl(f32x4_to_f16(wasm_f32x4_max(a0, zeros)), 16);
+						const v128 h1 = wasm_i32x4_shl(f32x4_to_f16(wasm_f32x4_max(a1, zeros)), 16);
+						wasm_v128_store(dst, wasm_v128_or(f32x4_to_f16(d0), h0));
+						wasm_v128_store(dst + 16, wasm_v128_or(f32x4_to_f16(d1), h1));
+					}
+					if (dst == texels) {
+						memcpy(row + x * texelBytes, texels, (width - x) * texelBytes);
+					}
+				}
+			}
+		});
+		return ptr(texture);
+	}
+
+	// room for count more particles, growing the storage by half again at least so that steady
+	// inflows rarely move it. returns how many fit
+	i32 makeRoom(i32 count) {
+		syncIds();
+		count = mini(count, MAX_CAPACITY - numP);
+		const i32 wanted = numP + count;
+		if (wanted > capP && !reserve(maxi(wanted, mini(capP + (capP >> 1), MAX_CAPACITY)), 0)) {
+			reserve(wanted, 0);
+		}
+		return maxi(mini(count, capP - numP), 0);
+	}
+
+	// velocities in cells per base step. there must be room
+	inline void appendParticle(f32 x, f32 y, f32 vx, f32 vy) {
+		const i32 i = numP++;
+		for (i32 f = 0; f < P_NUM_FIELDS; f++) {
+			pdata[f][i] = 0;
+		}
+		pposx[i] = x;
+		pposy[i] = y;
+		pvelx[i] = vx * stepDt;
+		pvely[i] = vy * stepDt;
+	}
+
+	// the points of a lattice over [x0, x1) x [y0, y1) that inside(x, y) accepts
+	template <class Inside>
+	i32 emitLattice(f32 x0, f32 y0, f32 x1, f32 y1, f32 spacing, f32 vx, f32 vy, Inside inside) {
+		if (!(spacing > 0) || !(x1 > x0) || !(y1 > y0))
+			return 0;
+		const f32 cols = ceilf((x1 - x0) / spacing);
+		const f32 rows = ceilf((y1 - y0) / spacing);
+		if (cols * rows > MAX_CAPACITY)
+			return 0;
+		const i32 room = makeRoom((i32) (cols * rows));
+		const i32 before = numP;
+		for (i32 r = 0; r < rows; r++) {
+			const f32 y = y0 + r * spacing;
+			for (i32 c = 0; c < cols && numP - before < room; c++) {
+				const f32 x = x0 + c * spacing;
+				if (inside(x, y)) {
+					appendParticle(x, y, vx, vy);
+				}
+			}
+		}
+		return numP - before;
+	}
+
+	i32 emitBox(f32 x, f32 y, f32 halfW, f32 halfH, f32 spacing, f32 vx, f32 vy) {
+		return emitLattice(x - halfW, y - halfH, x + halfW, y + halfH, spacing, vx, vy, [](f32, f32) {
+			return true;
+		});
+	}
+
+	i32 emitDisc(f32 x, f32 y, f32 radius, f32 spacing, f32 vx, f32 vy) {
+		const f32 r2 = radius * radius;
+		return emitLattice(
+			x - radius, y - radius, x + radius, y + radius, spacing, vx, vy, [&](f32 px, f32 py) {
+				return (px - x) * (px - x) + (py - y) * (py - y) < r2;
+			});
+	}
+
+	// count particles at random points of a source
+	void emitRandom(const Emitter& e, i32 count) {
+		count = makeRoom(count);
+		const u32 key = hash32(~jitterSeed + emitCalls++ * 0x9e3779b9);
+		for (i32 k = 0; k < count; k++) {
+			const f32 u = signedUnit(hash32(key ^ (2 * k)));
+			const f32 v = signedUnit(hash32(key ^ (2 * k + 1)));
+			if (e.shape == COLLIDER_BOX) {
+				appendParticle(e.x + u * e.sizeX, e.y + v * e.sizeY, e.vx, e.vy);
+			} else {
+				// uniform over the disc
+				const f32 r = e.sizeX * sqrtf(0.5f * (u + 1));
+				const f32 a = v * (f32) M_PI;
+				appendParticle(e.x + r * cosf(a), e.y + r * sinf(a), e.vx, e.vy);
+			}
+		}
+	}
+
+	void countEmitters() {
+		while (numEmitters > 0 && emitters[numEmitters - 1].kind < 0) {
+			numEmitters--;
+		}
+		numSinks = 0;
+		for (i32 k = 0; k < numEmitters; k++) {
+			numSinks += emitters[k].kind == EMITTER_SINK;
+		}
+	}
+
+	i32 addEmitter(i32 kind, i32 shape, f32 x, f32 y, f32 sizeX, f32 sizeY, f32 rate, f32 vx, f32 vy) {
+		if (kind != EMITTER_SOURCE && kind != EMITTER_SINK)
+			return -1;
+		if (shape != COLLIDER_CIRCLE && shape != COLLIDER_BOX)
+			return -1;
+		i32 id = 0;
+		while (id < numEmitters && emitters[id].kind >= 0) {
+			id++;
+		}
+		if (id == MAX_EMITTERS)
+			return -1;
+		emitters[id] = {kind, shape, x, y - gridOriginY, sizeX, sizeY, rate > 0 ? rate : 0, vx, vy, 0};
+		numEmitters = maxi(numEmitters, id + 1);
+		countEmitters();
+		return id;
+	}
+
+	void moveEmitter(i32 id, f32 x, f32 y) {
+		if (id < 0 || id >= numEmitters || emitters[id].kind < 0)
+			return;
+		emitters[id].x = x;
+		emitters[id].y = y - gridOriginY;
+	}
+
+	void removeEmitter(i32 id) {
+		if (id < 0 || id >= numEmitters || emitters[id].kind < 0)
+			return;
+		emitters[id].kind = -1;
+		countEmitters();
+	}
+
+	void clearEmitters() {
+		numEmitters = 0;
+		countEmitters();
+	}
+
+	i32 emitterCount() {
+		i32 n = 0;
+		for (i32 k = 0; k < numEmitters; k++) {
+			n += emitters[k].kind >= 0;
+		}
+		return n;
+	}
+
+	// removes the particles left out of the lane masks keep(i) of the quads i, packing the rest to
+	// the front in their order. each quad is shuffled with COMPACT_SHUFFLES and stored over the
+	// particles already read, so it runs in place. returns the number removed
+	template <class Keep>
+	i32 compactParticles(Keep keep) {
+		syncIds();
+		i32* planes[P_NUM_FIELDS + 1];
+		for (i32 f = 0; f < P_NUM_FIELDS; f++) {
+			planes[f] = (i32*) pdata[f];
+		}
+		planes[P_NUM_FIELDS] = pids;
+
+		i32 n = 0;
+		i32 first = -1; // the first quad that lost a particle, those before stay where they are
+		for (i32 i = 0; i < numP; i += 4) {
+			const u32 valid = numP - i >= 4 ? 15 : (1 << (numP - i)) - 1;
+			const u32 lanes = wasm_i32x4_bitmask(keep(i)) & valid;
+			if (first < 0) {
+				if (lanes == valid) {
+					n = mini(i + 4, numP);
+					continue;
+				}
+				first = i;
+			}
+			const v128 shuffle = wasm_v128_load(COMPACT_SHUFFLES.bytes[lanes]);
+			for (i32* plane : planes) {
+				wasm_v128_store(plane + n, wasm_i8x16_swizzle(wasm_v128_load(plane + i), shuffle));
+			}
+			wasm_v128_store(perm + n, wasm_i8x16_swizzle(wasm_i32x4_make(i, i + 1, i + 2, i + 3), shuffle));
+			n += __builtin_popcount(lanes);
+		}
+		if (first < 0)
+			return 0;
+		for (i32 i = 0; i < first; i++) {
+			perm[i] = i;
+		}
+		const i32 removed = numP - n;
+		numP = n;
+		numIds = n;
+		return removed;
+	}
+
+	// lanes of the four particles inside a sink
+	inline v128 inSinks(v128 px, v128 py) {
+		v128 inside = wasm_i32x4_const_splat(0);
+		for (i32 k = 0; k < numEmitters; k++) {
+			const Emitter& e = emitters[k];
+			if (e.kind != EMITTER_SINK)
+				continue;
+			const v128 dx = wasm_f32x4_sub(px, wasm_f32x4_splat(e.x));
+			const v128 dy = wasm_f32x4_sub(py, wasm_f32x4_splat(e.y));
+			if (e.shape == COLLIDER_BOX) {
+				inside = wasm_v128_or(inside,
+					wasm_v128_and(wasm_f32x4_lt(wasm_f32x4_abs(dx), wasm_f32x4_splat(e.sizeX)),
+						wasm_f32x4_lt(wasm_f32x4_abs(dy), wasm_f32x4_splat(e.sizeY))));
+			} else {
+				const v128 d2 = wasm_f32x4_add(wasm_f32x4_mul(dx, dx), wasm_f32x4_mul(dy, dy));
+				inside = wasm_v128_or(inside, wasm_f32x4_lt(d2, wasm_f32x4_splat(e.sizeX * e.sizeX)));
+			}
+		}
+		return inside;
+	}
+
+	i32 removeParticles(const u8* keep) {
+		return compactParticles([&](i32 i) {
+			return wasm_i32x4_make(-(keep[i] != 0), -(i + 1 < numP && keep[i + 1] != 0),
+				-(i + 2 < numP && keep[i + 2] != 0), -(i + 3 < numP && keep[i + 3] != 0));
+		});
+	}
+
+	i32 updateEmitters(f32 duration) {
+		if (numEmitters == 0)
+			return 0;
+		STAT_PHASE(STAT_EMIT);
+		syncIds();
+		const i32 before = numP;
+		for (i32 k = 0; k < numEmitters && duration > 0; k++) {
+			Emitter& e = emitters[k];
+			if (e.kind != EMITTER_SOURCE)
+				continue;
+			e.owed += e.rate * duration;
+			const i32 count = (i32) fminf(e.owed, MAX_CAPACITY);
+			e.owed -= count;
+			emitRandom(e, count);
+		}
+		if (numSinks > 0) {
+			compactParticles([&](i32 i) {
+				const v128 inside = inSinks(wasm_v128_load(pposx + i), wasm_v128_load(pposy + i));
+				return wasm_v128_xor(inside, wasm_i32x4_const_splat(-1));
+			});
+		}
+		return numP - before;
+	}
+
+	void setJitterSeed(u32 seed) {
+		jitterSeed = seed;
+		jitterCalls = 0;
+		emitCalls = 0;
+	}
+
+	// moves every particle by a random offset in [-amount, amount) on each axis
+	void jitter(f32 amount) {
+		STAT_PHASE(STAT_JITTER);
+		const v128 keys = wasm_i32x4_splat((i32) hash32(jitterSeed + jitterCalls++ * 0x9e3779b9));
+		const v128 amounts = wasm_f32x4_splat(amount);
+		// the fixed point transfer keeps results independent of the particle order, so it counts by id
+		const bool byId = accumulation != ACC_FLOAT;
+		if (byId) {
+			syncIds();
+		}
+
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split((numP + 3) >> 2, t, pool.size(), begin, end);
+			begin <<= 2;
+			end <<= 2;
+
+			for (i32 i = begin; i < end; i += 4) {
+				// even counters for x, odd for y
+				const v128 n = byId ? wasm_v128_load(pids + i) : wasm_i32x4_make(i, i + 1, i + 2, i + 3);
+				const v128 cx = wasm_i32x4_shl(n, 1);
+				const v128 cy = wasm_i32x4_add(cx, wasm_i32x4_const_splat(1));
+				const v128 dx =
+					wasm_f32x4_mul(f32x4_signed_unit(u32x4_hash(wasm_v128_xor(cx, keys))), amounts);
+				const v128 dy =
+					wasm_f32x4_mul(f32x4_signed_unit(u32x4_hash(wasm_v128_xor(cy, keys))), amounts);
+				wasm_v128_store(pposx + i, wasm_f32x4_add(wasm_v128_load(pposx + i), dx));
+				wasm_v128_store(pposy + i, wasm_f32x4_add(wasm_v128_load(pposy + i), dy));
+			}
+		});
+	}
+
+	// changes the substep length, converting the particle velocities to the new unit
+	void setStepDt(f32 dt) {
+		if (dt == stepDt)
+			return;
+		const f32 ratio = dt / stepDt;
+		const v128 ratios = wasm_f32x4_splat(ratio);
+		f32* const planes[] = {pvelx, pvely, pgvel00, pgvel01, pgvel10, pgvel11};
+		pool.run([&](i32 t) {
+			i32 begin;
+			i32 end;
+			split((numP + 3) >> 2, t, pool.size(), begin, end);
+			for (f32* plane : planes) {
+				for (i32 i = begin << 2; i < end << 2; i += 4) {
+					wasm_v128_store(plane + i, wasm_f32x4_mul(wasm_v128_load(plane + i), ratios));
+				}
+			}
+		});
+		particleSpeed2 *= ratio * ratio;
+		gridSpeed2 *= ratio * ratio;
+		stepDt = dt;
+		scales = stepScales(dt, params, solver);
+	}
+
+	void setAdaptiveSteps(f32 maxCfl, i32 minCount, i32 maxCount, f32 frameBudgetMs) {
+		cfl = maxCfl > 0 ? maxCfl : 0;
+		minSubsteps = maxi(minCount, 1);
+		maxSubsteps = maxi(maxCount, minSubsteps);
+		budgetMs = frameBudgetMs > 0 ? frameBudgetMs : 0;
+	}
+
+	f32 adaptiveCfl() {
+		return cfl;
+	}
+
+	i32 beginFrame(f32 duration) {
+		if (duration <= 0) {
+			frameSubsteps = 0;
+			return 0;
+		}
+		i32 n = maxi((i32) (duration + 0.5f), 1);
+		f32 dt = duration / n;
+		if (cfl > 0) {
+			// enough substeps that nothing moves more than cfl cells in one, as fast as it moved
+			// in the last one
+			const f32 speed = sqrtf(fmaxf(particleSpeed2, gridSpeed2)) / stepDt;
+			f32 wanted = ceilf(duration * speed / cfl);
+			// and no longer than the equation of state stands, however calm the water
+			f32 maxDt = duration;
+			if (solver == PRESSURE_EOS && params.stiffness > 0) {
+				maxDt = EOS_MAX_DT * sqrtf(STIFFNESS / params.stiffness);
+				wanted = fmaxf(wanted, ceilf(duration / maxDt));
+			}
+			n = (i32) fminf(wanted, maxSubsteps);
+			if (budgetMs > 0 && substepMs > 0) {
+				n = mini(n, (i32) fminf(budgetMs / substepMs, maxSubsteps));
+			}
+			n = maxi(n, minSubsteps);
+			dt = duration / n;
+			// capped frames stretch the CFL number up to CFL_OVERLOAD times; past that they
+			// advance less time instead, slowing the water down rather than blowing it up
+			if (n < wanted && speed * dt > cfl * CFL_OVERLOAD) {
+				dt = cfl * CFL_OVERLOAD / speed;
+			}
+			// the stability limit is not stretched at all
+			dt = fminf(dt, maxDt);
+		}
+		setStepDt(dt);
+		frameSubsteps = n;
+		frameStart = nowMs();
+		solverIterations = 0;
+#ifdef WATER_STATS
+		memset(phaseMs, 0, sizeof(phaseMs));
+#endif
+		return n;
+	}
+
+	void endFrame() {
+		if (frameSubsteps == 0)
+			return;
+		const f64 end = nowMs();
+		const f32 ms = (end - frameStart) / frameSubsteps;
+		substepMs = substepMs == 0 ? ms : substepMs + (ms - substepMs) * 0.2f;
+#ifdef WATER_STATS
+		for (i32 p = 0; p < STAT_NUM_PHASES; p++) {
+			frameStats.phaseMs[p] = phaseMs[p];
+		}
+		frameStats.frameMs = end - frameStart;
+		frameStats.frames++;
+		frameStats.substeps = frameSubsteps;
+		frameStats.solverIterations = solverIterations;
+		frameStats.solverResidual = solverResidual;
+		frameStats.unconvergedSolves = unconvergedSolves;
+		traceEvent(TRACE_FRAME, frameStart, end);
+#endif
+		frameSubsteps = 0;
+	}
+
+	f32 substepDt() {
+		return stepDt;
+	}
+
+	f32 maxSpeed() {
+		return sqrtf(fmaxf(particleSpeed2, gridSpeed2)) / stepDt;
+	}
+
+	iptr stats() {
+#ifdef WATER_STATS
+		Stats& s = frameStats;
+		s.particles = numP;
+		s.activeBlocks = numActive;
+		s.activeCells = 0;
+		memset(s.histogram, 0, sizeof(s.histogram));
+		s.minDensity = 0;
+		s.maxDensity = 0;
+		if (numP > 0) {
+			s.minDensity = pdens[0];
+			s.maxDensity = pdens[0];
+			for (i32 i = 1; i < numP; i++) {
+				s.minDensity = fminf(s.minDensity, pdens[i]);
+				s.maxDensity = fmaxf(s.maxDensity, pdens[i]);
+			}
+		}
+		if (numC == 0)
+			return ptr(&s);
+
+		// particles per cell, counted in the scratch of the sort
+		memset(cellStarts, 0, numC * sizeof(i32));
+		for (i32 i = 0; i < numP; i++) {
+			const i32 key = (i32) pposy[i] * gridStride + (i32) pposx[i];
+			cellStarts[maxi(0, mini(numC - 1, key))]++;
+		}
+		for (i32 b = 0; b < numActive; b++) {
+			forBlockRows(activeBlocks[b], [&](i32 y, i32 x0, i32 x1) {
+				for (i32 x = x0; x < x1; x++) {
+					const i32 c = y * gridStride + x;
+					s.histogram[mini(cellStarts[c], STAT_HISTOGRAM_BINS - 1)]++;
+					s.activeCells += gmass[c] > 0;
+				}
+			});
+		}
+		return ptr(&s);
+#else
+		return 0;
+#endif
+	}
+
+	i32 traceStart(i32 maxEvents) {
+#ifdef WATER_STATS
+		traceCount = 0;
+		if (maxEvents > traceCap) {
+			if (!traceArena.init(Arena::footprint<TraceEvent>(maxEvents))) {
+				traceCap = 0;
+				tracing = false;
+				return 0;
+			}
+			traceEvents = traceArena.take<TraceEvent>(maxEvents);
+		}
+		traceCap = maxi(maxEvents, traceCap);
+		tracing = traceCap > 0;
+		return tracing;
+#else
+		return 0;
+#endif
+	}
+
+	void traceStop() {
+#ifdef WATER_STATS
+		tracing = false;
+#endif
+	}
+
+	iptr traceJson() {
+#ifdef WATER_STATS
+		// the longest event takes well under this many characters
+		constexpr i32 EVENT_CHARS = 128;
+		const i32 cap = (traceCount + 1) * EVENT_CHARS;
+		if (!traceTextArena.init(Arena::footprint<char>(cap)))
+			return 0;
+		traceText = traceTextArena.take<char>(cap);
+		// events are added as they end, a frame after its phases
+		f64 origin = traceCount > 0 ? traceEvents[0].start : 0;
+		for (i32 i = 1; i < traceCount; i++) {
+			origin = fmin(origin, traceEvents[i].start);
+		}
+		i32 n = snprintf(traceText, cap, "{\"traceEvents\":[");
+		for (i32 i = 0; i < traceCount; i++) {
+			const TraceEvent& e = traceEvents[i];
+			n += snprintf(traceText + n, cap - n,
+				"%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+				i > 0 ? "," : "", TRACE_NAMES[e.name], (e.start - origin) * 1000, e.duration * 1000.0);
+		}
+		n += snprintf(traceText + n, cap - n, "\n],\"displayTimeUnit\":\"ms\"}\n");
+		traceTextSize = n;
+		return ptr(traceText);
+#else
+		return 0;
+#endif
+	}
+
+	i32 traceJsonSize() {
+#ifdef WATER_STATS
+		return traceTextSize;
+#else
+		return 0;
+#endif
+	}
+
+	// runs a frame of substeps base steps (p2g, updateGrid, g2p, jitter per substep) in one call
+	void step(i32 substeps, f32 gravityX, f32 gravityY, f32 mouseX, f32 mouseY, f32 dmouseX, f32 dmouseY,
+		f32 radius, f32 jitterAmount) {
+		const i32 n = beginFrame(substeps);
+		const f32 dt = stepDt;
+		updateEmitters(substeps);
+		for (i32 i = 0; i < n; i++) {
+			p2g();
+			updateGrid(
+				gravityX * dt * dt, gravityY * dt * dt, mouseX, mouseY, dmouseX * dt, dmouseY * dt, radius);
+			projectPressure();
+			g2p();
+			jitter(jitterAmount * dt);
+		}
+		endFrame();
+	}
+};
+
+// the simulation every process starts with, which is never destroyed
+Simulation mainSimulation;
+thread_local Simulation* sim = &mainSimulation;
+
+inline Simulation* simulationAt(iptr s) {
+	return s ? (Simulation*) s : &mainSimulation;
+}
+
+WASM_EXPORT iptr simulationCreate() {
+	// value-initialized, so that the storage pointers start out null as they do in mainSimulation
+	return ptr(new (std::nothrow) Simulation());
+}
+
+WASM_EXPORT void simulationDestroy(iptr s) {
+	Simulation* const target = simulationAt(s);
+	if (target == &mainSimulation)
+		return;
+	if (sim == target) {
+		sim = &mainSimulation;
+	}
+	delete target;
+}
+
+WASM_EXPORT void simulationSelect(iptr s) {
+	sim = simulationAt(s);
+}
+
+WASM_EXPORT iptr simulation() {
+	return sim == &mainSimulation ? 0 : ptr(sim);
+}
+
+WASM_EXPORT i32 particleCount() {
+	return sim->numP;
+}
+
+WASM_EXPORT void setParticleCount(i32 n) {
+	sim->numP = n;
+}
+
+WASM_EXPORT iptr particlePlane(i32 field) {
+	return sim->particlePlane(field);
+}
+
+WASM_EXPORT iptr cellPlane(i32 field) {
+	return sim->cellPlane(field);
+}
+
+WASM_EXPORT i32 cellStride() {
+	return sim->cellStride();
+}
+
+WASM_EXPORT void setThreads(i32 n) {
+	sim->setThreads(n);
+}
+
+WASM_EXPORT i32 threads() {
+	return sim->threads();
+}
+
+WASM_EXPORT i32 reserve(i32 particles, i32 cells) {
+	return sim->reserve(particles, cells);
+}
+
+WASM_EXPORT i32 particleCapacity() {
+	return sim->particleCapacity();
+}
+
+WASM_EXPORT i32 cellCapacity() {
+	return sim->cellCapacity();
+}
+
+WASM_EXPORT f64 storageBytes() {
+	return sim->storageBytes();
+}
+
+WASM_EXPORT iptr particleIds() {
+	return sim->particleIds();
+}
+
+WASM_EXPORT iptr permutation() {
+	return sim->permutation();
+}
+
+WASM_EXPORT f32 disorder() {
+	return sim->disorder();
+}
+
+WASM_EXPORT void resetIds() {
+	sim->resetIds();
+}
+
+WASM_EXPORT void setSortPolicy(i32 interval, f32 threshold) {
+	sim->setSortPolicy(interval, threshold);
+}
+
+WASM_EXPORT void setFusedStencil(i32 fused) {
+	sim->setFusedStencil(fused);
+}
+
+WASM_EXPORT i32 setTransferMode(i32 mode) {
+	return sim->setTransferMode(mode);
+}
+
+WASM_EXPORT i32 transferMode() {
+	return sim->transferMode;
+}
+
+WASM_EXPORT void setFeatures(i32 features) {
+	sim->setFeatures(features);
+}
+
+WASM_EXPORT i32 features() {
+	return sim->features();
+}
+
+WASM_EXPORT void setFluidParams(
+	f32 stiffness, f32 aerationThreshold, f32 aerationCoeff, f32 aerationBlur, f32 aerationDamp) {
+	sim->setFluidParams(stiffness, aerationThreshold, aerationCoeff, aerationBlur, aerationDamp);
+}
+
+WASM_EXPORT void setPressureSolver(i32 solver, i32 maxIterations, f32 tolerance) {
+	sim->setPressureSolver(solver, maxIterations, tolerance);
+}
+
+WASM_EXPORT i32 pressureSolver() {
+	return sim->pressureSolver();
+}
+
+WASM_EXPORT i32 setKernelIsa(i32 isa) {
+	return sim->setKernelIsa(isa);
+}
+
+WASM_EXPORT i32 kernelIsa() {
+	return sim->kernelIsa();
+}
+
+WASM_EXPORT void sortParticles() {
+	sim->sortParticles();
+}
+
+WASM_EXPORT void setGrid(i32 gw, i32 gh) {
+	sim->setGrid(gw, gh);
+}
+
+WASM_EXPORT void setGridWindow(i32 originY, i32 walls) {
+	sim->setGridWindow(originY, walls);
+}
+
+WASM_EXPORT void clearGrid() {
+	sim->clearGrid();
+}
+
+WASM_EXPORT f32 gridActivity() {
+	return sim->gridActivity();
+}
+
+WASM_EXPORT i32 cellActive(i32 x, i32 y) {
+	return sim->cellActive(x, y);
+}
+
+WASM_EXPORT void transferMass() {
+	sim->transferMass();
+}
+
+WASM_EXPORT void mirrorMass() {
+	sim->mirrorMass();
+}
+
+WASM_EXPORT void applyPressure() {
+	sim->applyPressure();
+}
+
+WASM_EXPORT void mirrorPressure() {
+	sim->mirrorPressure();
+}
+
+WASM_EXPORT void p2g() {
+	sim->p2g();
+}
+
+WASM_EXPORT i32 addCollider(i32 shape, f32 x, f32 y, f32 sizeX, f32 sizeY, i32 flags) {
+	return sim->addCollider(shape, x, y, sizeX, sizeY, flags);
+}
+
+WASM_EXPORT void setColliderVelocity(i32 id, f32 vx, f32 vy) {
+	sim->setColliderVelocity(id, vx, vy);
+}
+
+WASM_EXPORT void removeCollider(i32 id) {
+	sim->removeCollider(id);
+}
+
+WASM_EXPORT void clearColliders() {
+	sim->clearColliders();
+}
+
+WASM_EXPORT i32 emitBox(f32 x, f32 y, f32 halfW, f32 halfH, f32 spacing, f32 vx, f32 vy) {
+	return sim->emitBox(x, y, halfW, halfH, spacing, vx, vy);
+}
+
+WASM_EXPORT i32 emitDisc(f32 x, f32 y, f32 radius, f32 spacing, f32 vx, f32 vy) {
+	return sim->emitDisc(x, y, radius, spacing, vx, vy);
+}
+
+WASM_EXPORT i32 addEmitter(
+	i32 kind, i32 shape, f32 x, f32 y, f32 sizeX, f32 sizeY, f32 rate, f32 vx, f32 vy) {
+	return sim->addEmitter(kind, shape, x, y, sizeX, sizeY, rate, vx, vy);
+}
+
+WASM_EXPORT void moveEmitter(i32 id, f32 x, f32 y) {
+	sim->moveEmitter(id, x, y);
+}
+
+WASM_EXPORT void removeEmitter(i32 id) {
+	sim->removeEmitter(id);
+}
+
+WASM_EXPORT i32 emitterCount() {
+	return sim->emitterCount();
+}
+
+WASM_EXPORT void clearEmitters() {
+	sim->clearEmitters();
+}
+
+WASM_EXPORT i32 updateEmitters(f32 duration) {
+	return sim->updateEmitters(duration);
+}
+
+WASM_EXPORT i32 removeParticles(const u8* keep) {
+	return sim->removeParticles(keep);
+}
+
+WASM_EXPORT void updateGrid(
+	f32 gravityX, f32 gravityY, f32 mouseX, f32 mouseY, f32 dmouseX, f32 dmouseY, f32 radius) {
+	sim->updateGrid(gravityX, gravityY, mouseX, mouseY, dmouseX, dmouseY, radius);
+}
+
+WASM_EXPORT void projectPressure() {
+	sim->projectPressure();
+}
+
+WASM_EXPORT void g2p() {
+	sim->g2p();
+}
+
+WASM_EXPORT iptr renderVertices(f32 scale, f32 pixelScale) {
+	return sim->renderVertices(scale, pixelScale);
+}
+
+WASM_EXPORT iptr densityTexture(i32 width, i32 height, i32 format) {
+	return sim->densityTexture(width, height, format);
+}
+
+WASM_EXPORT void setJitterSeed(u32 seed) {
+	sim->setJitterSeed(seed);
+}
+
+WASM_EXPORT void jitter(f32 amount) {
+	sim->jitter(amount);
+}
+
+WASM_EXPORT void setAdaptiveSteps(f32 maxCfl, i32 minCount, i32 maxCount, f32 frameBudgetMs) {
+	sim->setAdaptiveSteps(maxCfl, minCount, maxCount, frameBudgetMs);
+}
+
+WASM_EXPORT f32 adaptiveCfl() {
+	return sim->adaptiveCfl();
+}
+
+WASM_EXPORT i32 beginFrame(f32 duration) {
+	return sim->beginFrame(duration);
+}
+
+WASM_EXPORT void endFrame() {
+	sim->endFrame();
+}
+
+WASM_EXPORT f32 substepDt() {
+	return sim->substepDt();
+}
+
+WASM_EXPORT f32 maxSpeed() {
+	return sim->maxSpeed();
+}
+
+WASM_EXPORT iptr stats() {
+	return sim->stats();
+}
+
+WASM_EXPORT i32 traceStart(i32 maxEvents) {
+	return sim->traceStart(maxEvents);
+}
+
+WASM_EXPORT void traceStop() {
+	sim->traceStop();
+}
+
+WASM_EXPORT iptr traceJson() {
+	return sim->traceJson();
+}
+
+WASM_EXPORT i32 traceJsonSize() {
+	return sim->traceJsonSize();
+}
+
+WASM_EXPORT void step(i32 substeps, f32 gravityX, f32 gravityY, f32 mouseX, f32 mouseY, f32 dmouseX,
+	f32 dmouseY, f32 radius, f32 jitterAmount) {
+	sim->step(substeps, gravityX, gravityY, mouseX, mouseY, dmouseX, dmouseY, radius, jitterAmount);
+}
+
+// stepBatch() threads, each stepping whole simulations
+WorkerPool batchPool;
+
+WASM_EXPORT void setBatchThreads(i32 n) {
+	batchPool.resize(n);
+}
+
+WASM_EXPORT i32 batchThreads() {
+	return batchPool.size();
+}
+
+WASM_EXPORT void stepBatch(const BatchStep* steps, i32 count) {
+	// handed out one at a time, so that threads finishing small scenes take on the next ones
+	std::atomic<i32> next{0};
+	batchPool.run([&](i32) {
+		for (i32 k; (k = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+			const BatchStep& s = steps[k];
+			Simulation* const target = simulationAt(s.simulation);
+			target->step(s.substeps, s.gravityX, s.gravityY, s.mouseX, s.mouseY, s.dmouseX, s.dmouseY,
+				s.radius, s.jitter);
+		}
+	});
 }
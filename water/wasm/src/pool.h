@@ -0,0 +1,132 @@
+#pragma once
+#include "wasm.h"
+
+#ifdef WATER_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#endif
+
+// fork-join worker pool. run(f) calls f(t) once for every t in [0, size()) and
+// returns when all calls have finished; the calling thread runs t = 0.
+// without WATER_THREADS (the default wasm build) the pool always has size 1.
+class WorkerPool {
+public:
+	static constexpr i32 MAX_THREADS = 64;
+
+	WorkerPool() = default;
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	~WorkerPool() {
+		resize(1);
+	}
+
+	i32 size() const {
+		return numThreads;
+	}
+
+#ifdef WATER_THREADS
+	void resize(i32 n) {
+		n = n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : n;
+		if (n == numThreads)
+			return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+			generation++;
+		}
+		wake.notify_all();
+		for (std::thread& w : workers) {
+			w.join();
+		}
+		workers.clear();
+		quit = false;
+		numThreads = n;
+		for (i32 t = 1; t < n; t++) {
+			workers.emplace_back(&WorkerPool::work, this, t, generation);
+		}
+	}
+
+	template <class F>
+	void run(F&& f) {
+		if (numThreads == 1) {
+			f(0);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = (void*) &f;
+			call = &invoke<std::remove_reference_t<F>>;
+			pending = numThreads - 1;
+			generation++;
+		}
+		wake.notify_all();
+		f(0);
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] {
+			return pending == 0;
+		});
+	}
+
+private:
+	template <class F>
+	static void invoke(void* f, i32 t) {
+		(*(F*) f)(t);
+	}
+
+	void work(i32 t, u64 seen) {
+		for (;;) {
+			void* f;
+			void (*c)(void*, i32);
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] {
+					return generation != seen;
+				});
+				seen = generation;
+				if (quit)
+					return;
+				f = job;
+				c = call;
+			}
+			c(f, t);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (--pending == 0)
+					done.notify_one();
+			}
+		}
+	}
+
+	i32 numThreads = 1;
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	u64 generation = 0;
+	bool quit = false;
+	void* job = nullptr;
+	void (*call)(void*, i32) = nullptr;
+	i32 pending = 0;
+#else
+	void resize(i32) {
+	}
+
+	template <class F>
+	void run(F&& f) {
+		f(0);
+	}
+
+private:
+	i32 numThreads = 1;
+#endif
+};
+
+// [begin, end) of the t-th of n near-equal parts of [0, count)
+inline void split(i32 count, i32 t, i32 n, i32& begin, i32& end) {
+	begin = (i32) ((i64) count * t / n);
+	end = (i32) ((i64) count * (t + 1) / n);
+}
@@ -0,0 +1,501 @@
+// compact recordings of the particle state for replay without the simulation. positions, density
+// and aeration are quantized to 16 bits, delta-coded against the previous frame and grouped into
+// chunks that each start with a key frame, so a player can seek to any chunk
+#include "water.h"
+#include "arena.h"
+#include "kernels.h"
+#include <cstring>
+
+namespace {
+	// stream layout, little endian:
+	//   header  "WREC", u32 version, f32 width, f32 height (the extent of the positions, in cells)
+	//   chunk   "WCHK", u32 first frame, u32 frames, u32 payload bytes, then the frames
+	//   frame   varint n, u8 flags, [n varint id gaps], then n varint deltas per plane
+	// particles are ordered by id, as unsigned so that ids which wrapped past 2^31 come last and gaps
+	// are taken mod 2^32. a delta is the zigzagged difference mod 2^16 to the same
+	// particle in the previous frame of the chunk, or to zero if it wasn't there
+	constexpr u32 STREAM_MAGIC = 0x43455257; // "WREC"
+	constexpr u32 CHUNK_MAGIC = 0x4b484357; // "WCHK"
+	constexpr u32 VERSION = 1;
+	constexpr i32 HEADER_BYTES = 16;
+	constexpr i32 CHUNK_HEADER_BYTES = 16;
+	constexpr u8 FRAME_IDS = 1; // the ids differ from the previous frame and follow
+	constexpr i32 NUM_PLANES = 4; // x, y, density, aeration
+	constexpr f32 QMAX = 65535;
+	constexpr f32 DENSITY_RANGE = 4; // quantized densities span [0, DENSITY_RANGE * DENSITY)
+	constexpr i32 MAX_VARINT_BYTES = 5;
+	constexpr i32 RADIX_BITS = 11;
+	constexpr i32 RADIX = 1 << RADIX_BITS;
+	constexpr i32 RADIX_PASSES = (32 + RADIX_BITS - 1) / RADIX_BITS;
+
+	// bytes that grow on demand, keeping their contents
+	struct Bytes {
+		Arena arena;
+		u8* data = nullptr;
+		size_t size = 0;
+		size_t cap = 0;
+
+		// room for extra more bytes, false if out of memory
+		bool reserve(size_t extra) {
+			if (size + extra <= cap)
+				return true;
+			const size_t n = size + extra > cap * 2 ? size + extra : cap * 2;
+			Arena a;
+			if (!a.init(Arena::footprint<u8>(n)))
+				return false;
+			u8* d = a.take<u8>(n);
+			if (size > 0) {
+				memcpy(d, data, size);
+			}
+			arena.swap(a);
+			data = d;
+			cap = n;
+			return true;
+		}
+
+		template <class T>
+		void put(T v) {
+			memcpy(data + size, &v, sizeof(T));
+			size += sizeof(T);
+		}
+
+		void putVarint(u32 v) {
+			while (v >= 0x80) {
+				data[size++] = (u8) (v | 0x80);
+				v >>= 7;
+			}
+			data[size++] = (u8) v;
+		}
+	};
+
+	u32 get32(const u8* p) {
+		u32 v;
+		memcpy(&v, p, 4);
+		return v;
+	}
+
+	// reads v at p and moves past it, false if it runs past end or MAX_VARINT_BYTES
+	bool getVarint(const u8*& p, const u8* end, u32& v) {
+		v = 0;
+		for (i32 i = 0; i < MAX_VARINT_BYTES && p < end; i++) {
+			const u8 b = *p++;
+			v |= (u32) (b & 0x7f) << 7 * i;
+			if (b < 0x80)
+				return true;
+		}
+		return false;
+	}
+
+	u16 quantize(f32 v, f32 scale) {
+		const f32 q = v * scale + 0.5f;
+		return (u16) (q < 0 ? 0 : q > QMAX ? QMAX : q);
+	}
+
+	u16 zigzag(u16 d) {
+		return (u16) (d << 1 ^ (u16) ((i16) d >> 15));
+	}
+
+	u16 unzigzag(u16 z) {
+		return (u16) (z >> 1 ^ (u16) -(z & 1));
+	}
+
+	// the quantized particles of one frame, ascending by id
+	struct Frame {
+		Arena arena;
+		i32 cap = 0;
+		i32 n = 0;
+		u32* ids = nullptr;
+		i32* from = nullptr; // index of the same particle in the previous frame, -1 if new
+		u16* planes[NUM_PLANES] = {};
+
+		// room for count particles, dropping the contents
+		bool reserve(i32 count) {
+			if (count <= cap)
+				return true;
+			Arena a;
+			if (!a.init(2 * Arena::footprint<i32>(count) + NUM_PLANES * Arena::footprint<u16>(count)))
+				return false;
+			ids = a.take<u32>(count);
+			from = a.take<i32>(count);
+			for (i32 p = 0; p < NUM_PLANES; p++) {
+				planes[p] = a.take<u16>(count);
+			}
+			arena.swap(a);
+			cap = count;
+			return true;
+		}
+
+		// matches the ids against the previous frame, true if they are the same
+		bool link(const Frame& prev) {
+			if (n == prev.n && (n == 0 || memcmp(ids, prev.ids, n * sizeof(u32)) == 0)) {
+				for (i32 k = 0; k < n; k++) {
+					from[k] = k;
+				}
+				return true;
+			}
+			i32 j = 0;
+			for (i32 k = 0; k < n; k++) {
+				while (j < prev.n && prev.ids[j] < ids[k]) {
+					j++;
+				}
+				from[k] = j < prev.n && prev.ids[j] == ids[k] ? j : -1;
+			}
+			return false;
+		}
+	};
+
+	struct Recorder {
+		bool active = false;
+		f32 posScale; // quantization steps per cell
+		i32 chunkFrames;
+		u32 frames;
+		u32 chunkCount; // frames in the open chunk
+		Frame frame[2];
+		i32 cur = 0;
+		Arena sortArena; // (id, index) pairs of the particles, sorted by id
+		u32* sortIds[2];
+		u32* sortIndices[2];
+		i32 sortCap = 0;
+		i32 counts[RADIX_PASSES][RADIX];
+		Bytes chunk; // the open chunk
+		Bytes out; // finished data not drained yet
+	} rec;
+
+	struct Player {
+		Bytes input;
+		f32 width;
+		f32 height;
+		f32 posStep; // cells per quantization step
+		i32 frames = 0;
+		Arena indexArena;
+		u32* chunkOffsets;
+		u32* chunkFirsts;
+		i32 numChunks = 0;
+		i32 chunk = -1; // of the last decoded frame
+		i32 frame = -1; // last decoded
+		const u8* pos; // next frame in the chunk
+		const u8* end; // of the chunk
+		Frame state[2];
+		i32 cur = 0;
+		Arena vertexArena;
+		f32* vertices;
+		i32 vertexCap = 0;
+	} player;
+
+	// moves the open chunk to the output. false if out of memory, which leaves it open
+	bool closeChunk() {
+		if (rec.chunkCount == 0)
+			return true;
+		if (!rec.out.reserve(rec.chunk.size))
+			return false;
+		memcpy(rec.out.data + rec.out.size, rec.chunk.data, rec.chunk.size);
+		rec.out.size += rec.chunk.size;
+		rec.chunk.size = 0;
+		rec.chunkCount = 0;
+		return true;
+	}
+}
+
+WASM_EXPORT i32 recordStart(f32 width, f32 height, i32 chunkFrames) {
+	rec.out.size = 0;
+	rec.chunk.size = 0;
+	if (!rec.out.reserve(HEADER_BYTES))
+		return 0;
+	rec.out.put(STREAM_MAGIC);
+	rec.out.put(VERSION);
+	rec.out.put(width);
+	rec.out.put(height);
+	rec.posScale = QMAX / (width > height ? width : height);
+	rec.chunkFrames = chunkFrames > 0 ? chunkFrames : 1;
+	rec.frames = 0;
+	rec.chunkCount = 0;
+	rec.active = true;
+	return 1;
+}
+
+WASM_EXPORT i32 recordFrame() {
+	if (!rec.active)
+		return -1;
+	const i32 n = particleCount() < particleCapacity() ? particleCount() : particleCapacity();
+	const i32* ids = (const i32*) particleIds();
+
+	// visit the particles by id, so that sorting them doesn't break the deltas: a radix sort of
+	// (id, index) pairs, whose cost follows the live particles rather than the ids handed out.
+	// passes over a digit all ids share are skipped, and ids already in order take none
+	if (n > rec.sortCap) {
+		const i32 cap = n > rec.sortCap * 2 ? n : rec.sortCap * 2;
+		if (!rec.sortArena.init(4 * Arena::footprint<u32>(cap)))
+			return -1;
+		for (i32 b = 0; b < 2; b++) {
+			rec.sortIds[b] = rec.sortArena.take<u32>(cap);
+			rec.sortIndices[b] = rec.sortArena.take<u32>(cap);
+		}
+		rec.sortCap = cap;
+	}
+	auto& counts = rec.counts;
+	memset(counts, 0, sizeof(counts));
+	bool ordered = true;
+	for (i32 i = 0; i < n; i++) {
+		const u32 id = (u32) ids[i];
+		rec.sortIds[0][i] = id;
+		rec.sortIndices[0][i] = i;
+		ordered &= i == 0 || id > (u32) ids[i - 1];
+		for (i32 d = 0; d < RADIX_PASSES; d++) {
+			counts[d][id >> (d * RADIX_BITS) & (RADIX - 1)]++;
+		}
+	}
+	i32 sorted = 0; // the buffer holding the pairs
+	for (i32 d = 0; d < RADIX_PASSES && n > 0 && !ordered; d++) {
+		const i32 shift = d * RADIX_BITS;
+		const u32* src = rec.sortIds[sorted];
+		if (counts[d][src[0] >> shift & (RADIX - 1)] == n)
+			continue;
+		i32 at = 0;
+		for (i32 r = 0; r < RADIX; r++) {
+			const i32 c = counts[d][r];
+			counts[d][r] = at;
+			at += c;
+		}
+		const u32* srcIndices = rec.sortIndices[sorted];
+		u32* dst = rec.sortIds[sorted ^ 1];
+		u32* dstIndices = rec.sortIndices[sorted ^ 1];
+		for (i32 i = 0; i < n; i++) {
+			const i32 to = counts[d][src[i] >> shift & (RADIX - 1)]++;
+			dst[to] = src[i];
+			dstIndices[to] = srcIndices[i];
+		}
+		sorted ^= 1;
+	}
+
+	const bool key = rec.chunkCount == 0;
+	Frame& prev = rec.frame[rec.cur];
+	Frame& f = rec.frame[rec.cur ^ 1];
+	if (!f.reserve(n))
+		return -1;
+	if (key) {
+		prev.n = 0;
+	}
+	const f32* xs = (const f32*) particlePlane(P_POS_X);
+	const f32* ys = (const f32*) particlePlane(P_POS_Y);
+	const f32* ds = (const f32*) particlePlane(P_DENSITY);
+	const f32* as = (const f32*) particlePlane(P_AERATION);
+	const f32 densityScale = QMAX / (DENSITY_RANGE * DENSITY);
+	const u32* sortedIds = rec.sortIds[sorted];
+	const u32* sortedIndices = rec.sortIndices[sorted];
+	for (i32 j = 0; j < n; j++) {
+		const u32 i = sortedIndices[j];
+		f.ids[j] = sortedIds[j];
+		f.planes[0][j] = quantize(xs[i], rec.posScale);
+		f.planes[1][j] = quantize(ys[i], rec.posScale);
+		f.planes[2][j] = quantize(ds[i], densityScale);
+		f.planes[3][j] = quantize(as[i], QMAX);
+	}
+	f.n = n;
+	const bool sameIds = f.link(prev);
+
+	Bytes& c = rec.chunk;
+	if (!c.reserve(CHUNK_HEADER_BYTES + (1 + n + NUM_PLANES * n) * MAX_VARINT_BYTES + 1))
+		return -1;
+	if (key) {
+		c.put(CHUNK_MAGIC);
+		c.put(rec.frames);
+		c.put(0u);
+		c.put(0u);
+	}
+	c.putVarint(n);
+	c.data[c.size++] = sameIds ? 0 : FRAME_IDS;
+	if (!sameIds) {
+		u32 last = ~0u;
+		for (i32 j = 0; j < n; j++) {
+			c.putVarint(f.ids[j] - last - 1);
+			last = f.ids[j];
+		}
+	}
+	for (i32 p = 0; p < NUM_PLANES; p++) {
+		const u16* q = f.planes[p];
+		const u16* pq = prev.planes[p];
+		for (i32 j = 0; j < n; j++) {
+			const u16 base = f.from[j] < 0 ? 0 : pq[f.from[j]];
+			c.putVarint(zigzag((u16) (q[j] - base)));
+		}
+	}
+	rec.cur ^= 1;
+	rec.frames++;
+	rec.chunkCount++;
+
+	// keep the header of the open chunk current
+	const u32 payload = (u32) c.size - CHUNK_HEADER_BYTES;
+	memcpy(c.data + 8, &rec.chunkCount, 4);
+	memcpy(c.data + 12, &payload, 4);
+	// a chunk that couldn't be closed grows until a later frame manages to
+	if ((i32) rec.chunkCount >= rec.chunkFrames && !closeChunk())
+		return -1;
+	return (i32) rec.out.size;
+}
+
+WASM_EXPORT void recordStop() {
+	if (!rec.active)
+		return;
+	closeChunk();
+	rec.active = false;
+}
+
+WASM_EXPORT iptr recordData() {
+	return ptr(rec.out.data);
+}
+
+WASM_EXPORT i32 recordSize() {
+	return (i32) rec.out.size;
+}
+
+WASM_EXPORT void recordDrain() {
+	rec.out.size = 0;
+}
+
+WASM_EXPORT iptr playerBuffer(i32 bytes) {
+	player.input.size = 0;
+	player.frames = 0;
+	if (bytes < 0 || !player.input.reserve(bytes))
+		return 0;
+	player.input.size = bytes;
+	return ptr(player.input.data);
+}
+
+WASM_EXPORT i32 playerOpen() {
+	Player& pl = player;
+	pl.frames = 0;
+	pl.numChunks = 0;
+	pl.chunk = -1;
+	pl.frame = -1;
+	const u8* data = pl.input.data;
+	const size_t size = pl.input.size;
+	if (size < HEADER_BYTES || get32(data) != STREAM_MAGIC || get32(data + 4) != VERSION)
+		return -1;
+	memcpy(&pl.width, data + 8, 4);
+	memcpy(&pl.height, data + 12, 4);
+	pl.posStep = (pl.width > pl.height ? pl.width : pl.height) / QMAX;
+
+	// index the chunks. a truncated last one (e.g. from an unfinished recording) is left out
+	i32 count = 0;
+	for (size_t at = HEADER_BYTES; at + CHUNK_HEADER_BYTES <= size; count++) {
+		const size_t end = at + CHUNK_HEADER_BYTES + get32(data + at + 12);
+		if (get32(data + at) != CHUNK_MAGIC || end > size)
+			break;
+		at = end;
+	}
+	if (!pl.indexArena.init(2 * Arena::footprint<u32>(count)))
+		return -1;
+	pl.chunkOffsets = pl.indexArena.take<u32>(count);
+	pl.chunkFirsts = pl.indexArena.take<u32>(count);
+	size_t at = HEADER_BYTES;
+	for (i32 c = 0; c < count; c++) {
+		if (get32(data + at + 4) != (u32) pl.frames)
+			break;
+		pl.chunkOffsets[c] = (u32) at;
+		pl.chunkFirsts[c] = (u32) pl.frames;
+		pl.frames += get32(data + at + 8);
+		pl.numChunks++;
+		at += CHUNK_HEADER_BYTES + get32(data + at + 12);
+	}
+	return pl.frames;
+}
+
+WASM_EXPORT i32 playerFrames() {
+	return player.frames;
+}
+
+WASM_EXPORT i32 playerNumP() {
+	return player.frame < 0 ? 0 : player.state[player.cur].n;
+}
+
+WASM_EXPORT iptr playerFrame(i32 frame, f32 scale, f32 pixelScale) {
+	Player& pl = player;
+	if (frame < 0 || frame >= pl.frames)
+		return 0;
+
+	// decode forward from the current frame if it's earlier in the same chunk, else from the key
+	// frame of the chunk holding the target
+	i32 c = pl.numChunks - 1;
+	while ((i32) pl.chunkFirsts[c] > frame) {
+		c--;
+	}
+	if (c != pl.chunk || frame <= pl.frame) {
+		pl.chunk = c;
+		pl.frame = (i32) pl.chunkFirsts[c] - 1;
+		const u8* const chunk = pl.input.data + pl.chunkOffsets[c];
+		pl.pos = chunk + CHUNK_HEADER_BYTES;
+		pl.end = pl.pos + get32(chunk + 12);
+		pl.state[pl.cur].n = 0;
+	}
+	// playerOpen() only checked the chunk headers: a frame that runs past its chunk or doesn't fit
+	// the previous one is corrupt, and leaves the player where it was
+	while (pl.frame < frame) {
+		const Frame& prev = pl.state[pl.cur];
+		Frame& f = pl.state[pl.cur ^ 1];
+		const u8* p = pl.pos;
+		const u8* const end = pl.end;
+		u32 count;
+		// the flags follow, then at least a byte per particle and plane
+		if (!getVarint(p, end, count) || p == end || count > (u32) (end - p) / NUM_PLANES)
+			return 0;
+		const i32 n = (i32) count;
+		if (!f.reserve(n))
+			return 0;
+		f.n = n;
+		if (*p++ & FRAME_IDS) {
+			u32 last = ~0u;
+			for (i32 k = 0; k < n; k++) {
+				u32 gap;
+				if (!getVarint(p, end, gap))
+					return 0;
+				last += gap + 1;
+				f.ids[k] = last;
+			}
+			f.link(prev);
+		} else {
+			// the particles of the previous frame
+			if (n != prev.n)
+				return 0;
+			for (i32 k = 0; k < n; k++) {
+				f.ids[k] = prev.ids[k];
+				f.from[k] = k;
+			}
+		}
+		for (i32 q = 0; q < NUM_PLANES; q++) {
+			u16* dst = f.planes[q];
+			const u16* src = prev.planes[q];
+			for (i32 k = 0; k < n; k++) {
+				u32 z;
+				if (!getVarint(p, end, z))
+					return 0;
+				const u16 base = f.from[k] < 0 ? 0 : src[f.from[k]];
+				dst[k] = (u16) (base + unzigzag((u16) z));
+			}
+		}
+		pl.pos = p;
+		pl.cur ^= 1;
+		pl.frame++;
+	}
+
+	// the same vertices as renderVertices()
+	const Frame& f = pl.state[pl.cur];
+	if (f.n > pl.vertexCap) {
+		if (!pl.vertexArena.init(Arena::footprint<f32>(4 * f.n)))
+			return 0;
+		pl.vertices = pl.vertexArena.take<f32>(4 * f.n);
+		pl.vertexCap = f.n;
+	}
+	const f32 posScale = pl.posStep * scale;
+	const f32 densityStep = DENSITY_RANGE / QMAX; // in units of the rest density
+	const f32 sizeScale = scale * PDELTA * 0.85f * 2 * pixelScale;
+	f32* v = pl.vertices;
+	for (i32 k = 0; k < f.n; k++) {
+		const f32 d = f.planes[2][k] * densityStep + 0.5f;
+		v[0] = f.planes[0][k] * posScale;
+		v[1] = f.planes[1][k] * posScale;
+		v[2] = (d < 1.5f ? d : 1.5f) * sizeScale;
+		v[3] = f.planes[3][k] * (1 / QMAX);
+		v += 4;
+	}
+	return ptr(pl.vertices);
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+// 4-lane SIMD. on wasm this is just wasm_simd128.h; natively the subset of the
+// wasm_simd128 API used by the kernels is mapped onto SSE4.1 (VEX-encoded when
+// compiled with -mavx2), so the same kernel source builds for both targets.
+
+#ifdef __wasm_simd128__
+
+#include <wasm_simd128.h>
+
+#else
+
+#include <immintrin.h>
+#include <stdint.h>
+
+#ifndef __SSE4_1__
+#error "native build requires SSE4.1 (-msse4.1 or -mavx2)"
+#endif
+
+typedef __m128i v128_t;
+
+#define SIMD_INLINE static inline __attribute__((always_inline))
+
+SIMD_INLINE __m128 simd_ps(v128_t a) {
+	return _mm_castsi128_ps(a);
+}
+
+SIMD_INLINE v128_t simd_si(__m128 a) {
+	return _mm_castps_si128(a);
+}
+
+// construction
+
+SIMD_INLINE v128_t wasm_f32x4_make(float c0, float c1, float c2, float c3) {
+	return simd_si(_mm_setr_ps(c0, c1, c2, c3));
+}
+
+SIMD_INLINE v128_t wasm_i32x4_make(int32_t c0, int32_t c1, int32_t c2, int32_t c3) {
+	return _mm_setr_epi32(c0, c1, c2, c3);
+}
+
+SIMD_INLINE v128_t wasm_f32x4_splat(float a) {
+	return simd_si(_mm_set1_ps(a));
+}
+
+SIMD_INLINE v128_t wasm_i32x4_splat(int32_t a) {
+	return _mm_set1_epi32(a);
+}
+
+#define wasm_f32x4_const_splat(a) wasm_f32x4_splat(a)
+#define wasm_i32x4_const_splat(a) wasm_i32x4_splat(a)
+
+SIMD_INLINE v128_t wasm_v128_load(const void* mem) {
+	return _mm_loadu_si128((const __m128i*) mem);
+}
+
+SIMD_INLINE void wasm_v128_store(void* mem, v128_t a) {
+	_mm_storeu_si128((__m128i*) mem, a);
+}
+
+// lanes
+
+SIMD_INLINE float wasm_f32x4_extract_lane(v128_t a, int i) {
+	return ((__v4sf) a)[i];
+}
+
+SIMD_INLINE int32_t wasm_i32x4_extract_lane(v128_t a, int i) {
+	return ((__v4si) a)[i];
+}
+
+// lanes c0..c3 of the eight lanes of a and b, constants as in wasm_simd128.h
+#define wasm_i32x4_shuffle(a, b, c0, c1, c2, c3) \
+	((v128_t) __builtin_shufflevector((__v4si) (a), (__v4si) (b), c0, c1, c2, c3))
+
+// bytes of a picked by the bytes of s, which must be below 16 (wasm zeroes larger ones, SSE only
+// those with the top bit set)
+SIMD_INLINE v128_t wasm_i8x16_swizzle(v128_t a, v128_t s) {
+	return _mm_shuffle_epi8(a, s);
+}
+
+// the top bit of each lane, lane 0 in bit 0
+SIMD_INLINE uint32_t wasm_i32x4_bitmask(v128_t a) {
+	return (uint32_t) _mm_movemask_ps(simd_ps(a));
+}
+
+// f32x4 arithmetic
+
+SIMD_INLINE v128_t wasm_f32x4_add(v128_t a, v128_t b) {
+	return simd_si(_mm_add_ps(simd_ps(a), simd_ps(b)));
+}
+
+SIMD_INLINE v128_t wasm_f32x4_sub(v128_t a, v128_t b) {
+	return simd_si(_mm_sub_ps(simd_ps(a), simd_ps(b)));
+}
+
+SIMD_INLINE v128_t wasm_f32x4_mul(v128_t a, v128_t b) {
+	return simd_si(_mm_mul_ps(simd_ps(a), simd_ps(b)));
+}
+
+SIMD_INLINE v128_t wasm_f32x4_div(v128_t a, v128_t b) {
+	return simd_si(_mm_div_ps(simd_ps(a), simd_ps(b)));
+}
+
+SIMD_INLINE v128_t wasm_f32x4_sqrt(v128_t a) {
+	return simd_si(_mm_sqrt_ps(simd_ps(a)));
+}
+
+SIMD_INLINE v128_t wasm_f32x4_floor(v128_t a) {
+	return simd_si(_mm_floor_ps(simd_ps(a)));
+}
+
+SIMD_INLINE v128_t wasm_f32x4_abs(v128_t a) {
+	return simd_si(_mm_andnot_ps(_mm_set1_ps(-0.0f), simd_ps(a)));
+}
+
+SIMD_INLINE v128_t wasm_f32x4_min(v128_t a, v128_t b) {
+	return simd_si(_mm_min_ps(simd_ps(a), simd_ps(b)));
+}
+
+SIMD_INLINE v128_t wasm_f32x4_max(v128_t a, v128_t b) {
+	return simd_si(_mm_max_ps(simd_ps(a), simd_ps(b)));
+}
+
+// f32x4 comparison
+
+SIMD_INLINE v128_t wasm_f32x4_gt(v128_t a, v128_t b) {
+	return simd_si(_mm_cmpgt_ps(simd_ps(a), simd_ps(b)));
+}
+
+SIMD_INLINE v128_t wasm_f32x4_lt(v128_t a, v128_t b) {
+	return simd_si(_mm_cmplt_ps(simd_ps(a), simd_ps(b)));
+}
+
+SIMD_INLINE v128_t wasm_f32x4_eq(v128_t a, v128_t b) {
+	return simd_si(_mm_cmpeq_ps(simd_ps(a), simd_ps(b)));
+}
+
+SIMD_INLINE v128_t wasm_f32x4_ge(v128_t a, v128_t b) {
+	return simd_si(_mm_cmpge_ps(simd_ps(a), simd_ps(b)));
+}
+
+SIMD_INLINE v128_t wasm_f32x4_le(v128_t a, v128_t b) {
+	return simd_si(_mm_cmple_ps(simd_ps(a), simd_ps(b)));
+}
+
+// conversion
+
+SIMD_INLINE v128_t wasm_i32x4_trunc_sat_f32x4(v128_t a) {
+	return _mm_cvttps_epi32(simd_ps(a));
+}
+
+SIMD_INLINE v128_t wasm_f32x4_convert_i32x4(v128_t a) {
+	return simd_si(_mm_cvtepi32_ps(a));
+}
+
+// the i32 lanes of a then b saturated to u16
+SIMD_INLINE v128_t wasm_u16x8_narrow_i32x4(v128_t a, v128_t b) {
+	return _mm_packus_epi32(a, b);
+}
+
+// i32x4 arithmetic
+
+SIMD_INLINE v128_t wasm_i32x4_add(v128_t a, v128_t b) {
+	return _mm_add_epi32(a, b);
+}
+
+SIMD_INLINE v128_t wasm_i32x4_sub(v128_t a, v128_t b) {
+	return _mm_sub_epi32(a, b);
+}
+
+SIMD_INLINE v128_t wasm_i32x4_mul(v128_t a, v128_t b) {
+	return _mm_mullo_epi32(a, b);
+}
+
+SIMD_INLINE v128_t wasm_i32x4_min(v128_t a, v128_t b) {
+	return _mm_min_epi32(a, b);
+}
+
+SIMD_INLINE v128_t wasm_i32x4_max(v128_t a, v128_t b) {
+	return _mm_max_epi32(a, b);
+}
+
+// shifts
+
+SIMD_INLINE v128_t wasm_i32x4_shl(v128_t a, uint32_t b) {
+	return _mm_sll_epi32(a, _mm_cvtsi32_si128(b));
+}
+
+SIMD_INLINE v128_t wasm_i32x4_shr(v128_t a, uint32_t b) {
+	return _mm_sra_epi32(a, _mm_cvtsi32_si128(b));
+}
+
+SIMD_INLINE v128_t wasm_u32x4_shr(v128_t a, uint32_t b) {
+	return _mm_srl_epi32(a, _mm_cvtsi32_si128(b));
+}
+
+// bitwise
+
+SIMD_INLINE v128_t wasm_v128_and(v128_t a, v128_t b) {
+	return _mm_and_si128(a, b);
+}
+
+SIMD_INLINE v128_t wasm_v128_or(v128_t a, v128_t b) {
+	return _mm_or_si128(a, b);
+}
+
+SIMD_INLINE v128_t wasm_v128_xor(v128_t a, v128_t b) {
+	return _mm_xor_si128(a, b);
+}
+
+SIMD_INLINE v128_t wasm_v128_andnot(v128_t a, v128_t b) {
+	return _mm_andnot_si128(b, a);
+}
+
+// mask ? a : b, bitwise
+SIMD_INLINE v128_t wasm_v128_bitselect(v128_t a, v128_t b, v128_t mask) {
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+#undef SIMD_INLINE
+
+#endif
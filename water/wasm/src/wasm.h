@@ -1,9 +1,19 @@
-#include <emscripten.h>
+#pragma once
+
+#include <stddef.h>
 #include <stdint.h>
-#include <wasm_simd128.h>
+#include "simd.h"
 
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
 #define WASM_EXPORT extern "C" EMSCRIPTEN_KEEPALIVE
+#else
+#define WASM_EXPORT extern "C"
+#endif
 
+using u8 = uint8_t;
+using i16 = int16_t;
+using u16 = uint16_t;
 using i32 = int32_t;
 using u32 = uint32_t;
 using i64 = int64_t;
@@ -11,7 +21,8 @@ using u64 = uint64_t;
 using f32 = float;
 using f64 = double;
 using v128 = v128_t;
+using iptr = intptr_t; // i32 on wasm32, native pointer width elsewhere
 
-inline i32 ptr(void* p) {
-	return (i32) (size_t) p;
+inline iptr ptr(void* p) {
+	return (iptr) p;
 }
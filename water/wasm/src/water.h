@@ -0,0 +1,380 @@
+#pragma once
+#include "wasm.h"
+
+// native entry points of the engine (the same symbols the wasm module exports)
+
+// particle fields, one plane of particleCapacity() floats each (see particlePlane).
+// the order matches ParticleField in Main.hx
+enum ParticleField : i32 {
+	P_AERATION,
+	P_POS_X,
+	P_POS_Y,
+	P_VEL_X,
+	P_VEL_Y,
+	P_GVEL_00,
+	P_GVEL_01,
+	P_GVEL_10,
+	P_GVEL_11,
+	P_DENSITY,
+	P_NUM_FIELDS
+};
+
+// grid fields, one plane of cellCapacity() floats each (see cellPlane). cell (x, y) is at
+// y * cellStride() + x. transferMass fills mass, aeration and momentum (velocity after
+// updateGrid), applyPressure the momentum change. the order matches CellField in Main.hx
+enum GridField : i32 {
+	G_MASS,
+	G_AERATION,
+	G_VEL_X,
+	G_VEL_Y,
+	G_DVEL_X,
+	G_DVEL_Y,
+	G_NUM_FIELDS
+};
+
+// independent simulations. the other exports act on the current simulation of the calling thread,
+// which starts out as the one every process has (simulation() 0). simulationCreate() returns 0 if
+// out of memory; destroying the current simulation selects the initial one, which is never destroyed
+WASM_EXPORT iptr simulationCreate();
+WASM_EXPORT void simulationDestroy(iptr simulation);
+WASM_EXPORT void simulationSelect(iptr simulation);
+WASM_EXPORT iptr simulation();
+
+// particles [0, particleCount()) are simulated; new ones are written past them into the planes
+// and then counted in
+WASM_EXPORT i32 particleCount();
+WASM_EXPORT void setParticleCount(i32 n);
+
+// storage grows with reserve() (and setGrid() for cells); both move the buffers
+WASM_EXPORT i32 reserve(i32 particles, i32 cells);
+WASM_EXPORT i32 particleCapacity();
+WASM_EXPORT i32 cellCapacity();
+// bytes of all the buffers the simulation holds: those of reserve() and those sized by them for
+// the threads, colliders, solver, texture and trace. natively only touched pages take memory
+WASM_EXPORT f64 storageBytes();
+WASM_EXPORT iptr particlePlane(i32 field);
+WASM_EXPORT iptr cellPlane(i32 field);
+// cells per row of the planes, the grid width padded to whole cache lines
+WASM_EXPORT i32 cellStride();
+WASM_EXPORT void setThreads(i32 n);
+WASM_EXPORT i32 threads();
+WASM_EXPORT void setGrid(i32 gw, i32 gh);
+
+// the top and bottom walls (rows 0 and gridH - 1); the sides are always walls
+enum GridWall : i32 {
+	WALL_TOP = 1,
+	WALL_BOTTOM = 2,
+	WALL_ALL = 3 // the default
+};
+
+// makes the grid the rows [originY, originY + gridH) of a taller tank, for the strips of
+// domain.h. colliders, emitters and the pointer of updateGrid stay in the coordinates of the tank;
+// particle positions (and emitBox, emitDisc) are the grid's. an edge left out of walls is open:
+// nothing mirrors or stops there, though particles still keep a cell off it as off any edge, so
+// that their stencils stay on the grid. the projection of PRESSURE_PROJECT needs all walls
+WASM_EXPORT void setGridWindow(i32 originY, i32 walls);
+// only 8x8 blocks of cells near particles are cleared and updated; clearGrid() makes the next
+// step clear all of them, e.g. after writing cellPlane() from outside
+WASM_EXPORT void clearGrid();
+// fraction of the blocks active in the last step
+WASM_EXPORT f32 gridActivity();
+// 1 if cell (x, y) is in a block active in this step. only those are cleared by transferMass and
+// visited by updateGrid, so values added to the grid between the phases of a step belong there
+WASM_EXPORT i32 cellActive(i32 x, i32 y);
+// nonzero to recompute the per-quad stencils in each pass instead of caching them
+WASM_EXPORT void setFusedStencil(i32 fused);
+// how transferMass and applyPressure move particle data to the grid. scatter adds every particle
+// to its 3x3 cells, into a grid per thread that are summed up afterwards. gather bins the
+// particles by cell each step and has every cell of the active blocks pull from the bins around
+// it, so each cell is written once by one thread. fixed scatters into one shared grid of 32.32
+// fixed point (with atomic adds when threaded), whose sums are exact and so the same for any
+// thread count or particle order. gather and fixed always run the 4-lane kernels (fixed the whole
+// step) and round differently from scatter
+enum TransferMode : i32 {
+	TRANSFER_SCATTER,
+	TRANSFER_GATHER,
+	TRANSFER_FIXED
+};
+
+// 0 if out of memory for the mode, which leaves the previous one
+WASM_EXPORT i32 setTransferMode(i32 mode);
+// the mode in effect. a step after reserve() falls back to TRANSFER_SCATTER when the mode's
+// buffers no longer fit
+WASM_EXPORT i32 transferMode();
+
+// optional parts of the step, each compiled into its own kernels so that a disabled one costs
+// nothing. without aeration the kernels carry no aeration channel through p2g, the pressure pass
+// and g2p, and the particles render as plain water
+enum StepFeature : i32 {
+	FEATURE_AERATION = 1,
+	FEATURE_ALL = 1 // the default
+};
+
+// turning aeration off zeroes the aeration of the particles
+WASM_EXPORT void setFeatures(i32 features);
+WASM_EXPORT i32 features();
+// material constants. stiffness scales the pressure of compressed water (5 by default).
+// particles under aerationThreshold (0.7) of the rest density gain aeration with their
+// acceleration, scaled by aerationCoeff (20); every base step it blends aerationBlur (0.01) of the
+// cells around in and keeps aerationDamp (0.992) of itself
+WASM_EXPORT void setFluidParams(
+	f32 stiffness, f32 aerationThreshold, f32 aerationCoeff, f32 aerationBlur, f32 aerationDamp);
+
+// how compressed water pushes back. the equation of state is explicit, so its stiffness bounds
+// the stable substep; the projection solves for the pressure that undoes the compression instead
+enum PressureSolver : i32 {
+	PRESSURE_EOS, // applyPressure scatters the pressure of each particle's density (the default)
+	PRESSURE_PROJECT // projectPressure solves a Poisson equation on the grid, see there
+};
+// the solve stops after maxIterations conjugate gradient iterations (40 by default) or once the
+// residual is under tolerance (0.02) of the right-hand side, both scaled by the diagonal. Domain
+// only runs the equation of state. resets Stats::unconvergedSolves
+WASM_EXPORT void setPressureSolver(i32 solver, i32 maxIterations, f32 tolerance);
+WASM_EXPORT i32 pressureSolver();
+
+// solid obstacles inside the grid, in cells. static colliders are baked into a distance field,
+// moving ones are evaluated every step; both push fluid velocities and particles out of them
+enum ColliderShape : i32 {
+	COLLIDER_CIRCLE, // radius sizeX
+	COLLIDER_BOX // half extents sizeX, sizeY
+};
+
+enum ColliderFlags : i32 {
+	COLLIDER_MOVING = 1,
+	COLLIDER_NO_SLIP = 2
+};
+
+// the id of the new collider, -1 if all slots are taken
+WASM_EXPORT i32 addCollider(i32 shape, f32 x, f32 y, f32 sizeX, f32 sizeY, i32 flags);
+// cells per step, moving colliders only
+WASM_EXPORT void setColliderVelocity(i32 id, f32 vx, f32 vy);
+WASM_EXPORT void removeCollider(i32 id);
+WASM_EXPORT void clearColliders();
+
+// particles added and removed in bulk. the new ones start out at rest density spacing cells apart
+// (0.5 in the scenes of Main.hx), moving at (vx, vy) cells per base step. adding may grow the
+// storage as reserve() does; the returned count is less than asked for if out of memory
+// a lattice filling the box of half extents halfW, halfH around (x, y)
+WASM_EXPORT i32 emitBox(f32 x, f32 y, f32 halfW, f32 halfH, f32 spacing, f32 vx, f32 vy);
+// a lattice filling the disc of the given radius around (x, y)
+WASM_EXPORT i32 emitDisc(f32 x, f32 y, f32 radius, f32 spacing, f32 vx, f32 vy);
+
+// continuous inflows and drains, shaped like colliders (ColliderShape, in cells). a source adds
+// rate particles per base step at random points of its shape, a sink removes every particle
+// inside its shape. removal packs the remaining particles to the front in their order, moving
+// their ids along and leaving the old index of each in permutation()
+enum EmitterKind : i32 {
+	EMITTER_SOURCE,
+	EMITTER_SINK
+};
+
+// the id of the new emitter, -1 if all slots are taken. vx, vy and rate are ignored for sinks
+WASM_EXPORT i32 addEmitter(
+	i32 kind, i32 shape, f32 x, f32 y, f32 sizeX, f32 sizeY, f32 rate, f32 vx, f32 vy);
+WASM_EXPORT void moveEmitter(i32 id, f32 x, f32 y);
+WASM_EXPORT void removeEmitter(i32 id);
+WASM_EXPORT void clearEmitters();
+// the emitters added and not removed
+WASM_EXPORT i32 emitterCount();
+// runs the sources for duration base steps and then the sinks. step() calls it with its substeps
+// after beginFrame(); hosts running the phases themselves call it there too. returns the change in
+// particleCount()
+WASM_EXPORT i32 updateEmitters(f32 duration);
+// removes the particles whose byte in keep is zero (one per particle, in particle order) as the
+// sinks do. returns the number removed
+WASM_EXPORT i32 removeParticles(const u8* keep);
+
+// kernel instruction sets. the 4-lane SIMD128 kernels (SSE4.1 natively) run everywhere; native
+// builds also carry 8-lane AVX2 and 16-lane AVX-512 ones and start with the widest the CPU has
+enum KernelIsa : i32 {
+	ISA_SIMD128,
+	ISA_AVX2,
+	ISA_AVX512
+};
+
+// returns the instruction set in effect, which falls back to the widest supported one
+WASM_EXPORT i32 setKernelIsa(i32 isa);
+WASM_EXPORT i32 kernelIsa();
+
+// spatial sorting of the particles. permutation() holds the index before the last sort (or
+// removal) of every particle
+WASM_EXPORT iptr particleIds();
+WASM_EXPORT iptr permutation();
+WASM_EXPORT void resetIds();
+WASM_EXPORT void setSortPolicy(i32 interval, f32 threshold);
+WASM_EXPORT void sortParticles();
+WASM_EXPORT f32 disorder();
+
+WASM_EXPORT void p2g();
+// the phases of p2g, in order
+WASM_EXPORT void transferMass();
+WASM_EXPORT void mirrorMass();
+WASM_EXPORT void applyPressure();
+WASM_EXPORT void mirrorPressure();
+WASM_EXPORT void updateGrid(
+	f32 gravityX, f32 gravityY, f32 mouseX, f32 mouseY, f32 dmouseX, f32 dmouseY, f32 radius);
+// with PRESSURE_PROJECT, makes the velocities of updateGrid undo the compression of the cells: a
+// matrix-free conjugate gradient solve of the pressure Poisson equation over the cells with mass
+// (zero pressure in empty cells, none through the walls or static colliders), warm-started from
+// the last one. divergence and gradient are both taken across the faces between the cells, so a
+// converged solve zeroes the divergence it measures; solves that stop at maxIterations above the
+// tolerance are counted in Stats::unconvergedSolves. does nothing with
+// PRESSURE_EOS, under which applyPressure has already pushed
+WASM_EXPORT void projectPressure();
+WASM_EXPORT void g2p();
+
+// particleCount() vertices of (x, y, point size, aeration) for the point renderer, valid until the next
+// reserve(). scale is pixels per cell, pixelScale device pixels per pixel
+WASM_EXPORT iptr renderVertices(f32 scale, f32 pixelScale);
+
+enum TextureFormat : i32 {
+	TEXTURE_U8, // bytes: the density halved (128 at rest) and the aeration, each clamped to [0, 1]
+	TEXTURE_F16 // half floats: the density and the aeration
+};
+
+// the fluid as a width x height texture for surface renderers, two channels per texel (density
+// over the rest density, then aeration) in rows of tightly packed texels from y = 0, covering the
+// whole grid. resampled from the grid mass and aeration of the last step with a tent filter at
+// least a cell wide, so it is smooth at any size. the buffer is kept for the next call of the same
+// size and format; 0 if out of memory
+WASM_EXPORT iptr densityTexture(i32 width, i32 height, i32 format);
+
+// stepping on a thread of its own (inline without WATER_THREADS, then asyncStart() returns 0; -1
+// if out of memory). between asyncStart() and asyncStop() the current simulation belongs to that
+// thread: the host only queues inputs and reads snapshots. the other async calls act on the current
+// simulation, so several can step asynchronously at once; stop one before destroying it
+WASM_EXPORT i32 asyncStart();
+// returns after the step in progress, dropping queued inputs
+WASM_EXPORT void asyncStop();
+// queues step(substeps, ...) on a grid of gridW x gridH followed by renderVertices(scale,
+// pixelScale). returns the inputs waiting, -1 if the queue is full or not running
+WASM_EXPORT i32 asyncInput(i32 gridW, i32 gridH, i32 substeps, f32 gravityX, f32 gravityY, f32 mouseX,
+	f32 mouseY, f32 dmouseX, f32 dmouseY, f32 radius, f32 jitter, f32 scale, f32 pixelScale);
+// vertices of the newest finished frame, never blocking. valid until the next call; asyncNumP()
+// and asyncFrame() (counted from 1, 0 before the first) describe them
+WASM_EXPORT iptr asyncVertices();
+WASM_EXPORT i32 asyncNumP();
+WASM_EXPORT i32 asyncFrame();
+
+// recordings of positions, density and aeration for replay, 16 bits per value and delta-coded
+// against the previous frame. width and height bound the positions (in cells); every chunkFrames
+// frames start a new chunk with a key frame, which is where a player can seek to
+WASM_EXPORT i32 recordStart(f32 width, f32 height, i32 chunkFrames);
+// appends the current particles, after a step (new particles need their ids). returns the bytes
+// ready in recordData(), which only holds finished chunks; -1 if out of memory
+WASM_EXPORT i32 recordFrame();
+// finishes the open chunk
+WASM_EXPORT void recordStop();
+WASM_EXPORT iptr recordData();
+WASM_EXPORT i32 recordSize();
+// empties recordData(), once its bytes have been written out
+WASM_EXPORT void recordDrain();
+
+// replay of a recording, copied into playerBuffer(bytes) before playerOpen()
+WASM_EXPORT iptr playerBuffer(i32 bytes);
+// returns the number of frames, -1 if the data is not a recording
+WASM_EXPORT i32 playerOpen();
+WASM_EXPORT i32 playerFrames();
+// decodes a frame into playerNumP() vertices laid out as by renderVertices(), ordered by particle
+// id. stepping forward decodes one frame, other jumps restart from the key frame of the chunk. 0
+// if out of memory or the frames up to it are corrupt
+WASM_EXPORT iptr playerFrame(i32 frame, f32 scale, f32 pixelScale);
+WASM_EXPORT i32 playerNumP();
+
+// anti-clustering noise, deterministic for a given seed
+WASM_EXPORT void setJitterSeed(u32 seed);
+WASM_EXPORT void jitter(f32 amount);
+// adaptive substeps. a frame of duration base steps (one base step is a substep of the fixed
+// stepping) is split into as many substeps as keep the fastest particle or cell of the last one
+// under maxCfl cells per substep, between minCount and maxCount. with a frameBudgetMs, the count
+// is also capped by the average wall time of a substep, so that overloads cost accuracy rather
+// than frames; capped frames that would break the CFL condition twice over advance less time.
+// under PRESSURE_EOS substeps are also no longer than its stiffness allows (one base step at the
+// default), which caps don't stretch: capped frames advance less time instead.
+// maxCfl 0 (the default) takes round(duration) substeps of one base step
+WASM_EXPORT void setAdaptiveSteps(f32 maxCfl, i32 minCount, i32 maxCount, f32 frameBudgetMs);
+// the maxCfl in effect, 0 for fixed substeps
+WASM_EXPORT f32 adaptiveCfl();
+// picks the substeps of a frame and converts the particle velocities to their length. callers
+// stepping the phases themselves scale gravity by substepDt()^2 and velocities by substepDt()
+WASM_EXPORT i32 beginFrame(f32 duration);
+// times the substeps since beginFrame() for the budget
+WASM_EXPORT void endFrame();
+// base steps per substep
+WASM_EXPORT f32 substepDt();
+// fastest particle or grid velocity of the last substep, in cells per base step
+WASM_EXPORT f32 maxSpeed();
+// instrumentation, compiled in with WATER_STATS (the native default). phases are timed from
+// entry to return of their exports; transferMass includes the sort it may run
+enum StatPhase : i32 {
+	STAT_SORT,
+	STAT_TRANSFER,
+	STAT_MIRROR_MASS,
+	STAT_PRESSURE,
+	STAT_MIRROR_PRESSURE,
+	STAT_UPDATE_GRID,
+	STAT_PROJECT,
+	STAT_G2P,
+	STAT_JITTER,
+	STAT_EMIT,
+	STAT_NUM_PHASES
+};
+
+constexpr i32 STAT_HISTOGRAM_BINS = 16;
+
+// 4-byte fields only, so that JS can read it through one Int32Array and one Float32Array
+struct Stats {
+	f32 phaseMs[STAT_NUM_PHASES]; // wall time of each phase in the last frame
+	f32 frameMs; // beginFrame() to endFrame()
+	i32 frames;
+	i32 substeps; // of the last frame
+	i32 particles;
+	i32 activeBlocks;
+	i32 activeCells; // cells with mass
+	f32 minDensity; // of the particles
+	f32 maxDensity;
+	// cells of the active blocks by the number of particles in them, the last bin counting
+	// STAT_HISTOGRAM_BINS - 1 or more
+	i32 histogram[STAT_HISTOGRAM_BINS];
+	i32 solverIterations; // of the pressure solves of the last frame
+	f32 solverResidual; // relative, of the last solve
+	// solves since setPressureSolver that stopped at maxIterations with the residual above the tolerance
+	i32 unconvergedSolves;
+};
+
+// counts the particles, cells and densities and returns the stats, 0 without WATER_STATS. the
+// timings are those of the last endFrame()
+WASM_EXPORT iptr stats();
+// records the phases, substeps and frames of up to maxEvents events, 0 if not compiled in or out
+// of memory
+WASM_EXPORT i32 traceStart(i32 maxEvents);
+WASM_EXPORT void traceStop();
+// the recorded events as Chrome trace JSON (chrome://tracing, Perfetto), traceJsonSize() bytes
+WASM_EXPORT iptr traceJson();
+WASM_EXPORT i32 traceJsonSize();
+
+// a frame of substeps base steps, each substep doing p2g, updateGrid, projectPressure, g2p and
+// jitter. gravity, dmouse and jitter are per base step
+WASM_EXPORT void step(i32 substeps, f32 gravityX, f32 gravityY, f32 mouseX, f32 mouseY, f32 dmouseX,
+	f32 dmouseY, f32 radius, f32 jitterAmount);
+
+// a frame of step() for one simulation (0 for the initial one), 4-byte fields on wasm32
+struct BatchStep {
+	iptr simulation;
+	i32 substeps;
+	f32 gravityX;
+	f32 gravityY;
+	f32 mouseX;
+	f32 mouseY;
+	f32 dmouseX;
+	f32 dmouseY;
+	f32 radius;
+	f32 jitter;
+};
+
+// threads of stepBatch(), each stepping whole simulations on top of their own setThreads()
+WASM_EXPORT void setBatchThreads(i32 n);
+WASM_EXPORT i32 batchThreads();
+// steps count distinct simulations by a frame each, in parallel. threads take the next simulation
+// as they finish one, so scenes of different sizes balance
+WASM_EXPORT void stepBatch(const BatchStep* steps, i32 count);
@@ -0,0 +1,376 @@
+#pragma once
+#include "kernels.h"
+
+// width-generic p2g, pressure, g2p and updateGrid kernels, instantiated by avx2.cpp and
+// avx512.cpp with their lane type V and for every set of StepFeature bits. the arithmetic follows
+// the 4-lane kernels in main.cpp operation for operation; only the order of the scatter sums is
+// up to V::Scatter.
+//
+// V provides the float, int and mask vectors F, I and M with LANES lanes, the operations
+// used below, and Scatter<N>, which adds to N consecutive grid planes at the nine stencil
+// offsets of a group, resolving lanes that share cells
+
+// quadratic B-spline weights of a group, w[3 * row + column], and its top-left cell
+template <class V>
+struct Stencil {
+	typename V::F dx;
+	typename V::F dy;
+	typename V::F w[9];
+	typename V::I c00;
+};
+
+template <class V>
+inline i32 wideMin(i32 a, i32 b) {
+	return a < b ? a : b;
+}
+
+template <class V>
+inline i32 wideMax(i32 a, i32 b) {
+	return a > b ? a : b;
+}
+
+template <class V>
+inline typename V::F widePow2(typename V::F x) {
+	return V::mul(x, x);
+}
+
+// the largest lane of a
+template <class V>
+inline f32 wideMaxLane(typename V::F a) {
+	f32 lanes[V::LANES];
+	V::store(lanes, a);
+	f32 m = lanes[0];
+	for (i32 k = 1; k < V::LANES; k++) {
+		m = lanes[k] > m ? lanes[k] : m;
+	}
+	return m;
+}
+
+// cell index offsets of the stencil from its top-left cell
+template <class V>
+inline void stencilOffsets(i32* offsets, i32 gridStride) {
+	for (i32 k = 0; k < 9; k++) {
+		offsets[k] = k / 3 * gridStride + k % 3;
+	}
+}
+
+// same as computeStencil in main.cpp
+template <class V>
+inline void wideStencil(Stencil<V>& st, const KernelState& s, i32 i) {
+	using F = typename V::F;
+	const F f05s = V::splat(0.5);
+	const F f75s = V::splat(0.75);
+	const typename V::I i1s = V::splati(1);
+
+	const typename V::M wmask = V::ilt(V::iadd(V::iota(), V::splati(i)), V::splati(s.numP));
+	const F posx = V::load(s.planes[P_POS_X] + i);
+	const F posy = V::load(s.planes[P_POS_Y] + i);
+	const F gx = V::floor(posx);
+	const F gy = V::floor(posy);
+	const typename V::I igx = V::trunc(gx);
+	const typename V::I igy = V::trunc(gy);
+
+	st.dx = V::sub(V::add(gx, f05s), posx);
+	st.dy = V::sub(V::add(gy, f05s), posy);
+	F wx[3];
+	F wy[3];
+	wx[0] = V::select(V::mul(widePow2<V>(V::add(st.dx, f05s)), f05s), wmask);
+	wx[1] = V::select(V::sub(f75s, widePow2<V>(st.dx)), wmask);
+	wx[2] = V::select(V::mul(widePow2<V>(V::sub(st.dx, f05s)), f05s), wmask);
+	wy[0] = V::mul(widePow2<V>(V::add(st.dy, f05s)), f05s);
+	wy[1] = V::sub(f75s, widePow2<V>(st.dy));
+	wy[2] = V::mul(widePow2<V>(V::sub(st.dy, f05s)), f05s);
+	for (i32 k = 0; k < 9; k++) {
+		st.w[k] = V::mul(wy[k / 3], wx[k % 3]);
+	}
+	st.c00 = V::iadd(V::imul(V::isub(igy, i1s), V::splati(s.gridStride)), V::isub(igx, i1s));
+}
+
+template <class V, i32 FEATURES>
+i32 wideTransfer(const KernelState& s, f32* const* grid, i32 begin, i32 end) {
+	using F = typename V::F;
+	constexpr bool AERATED = (FEATURES & FEATURE_AERATION) != 0;
+	f32* const* p = s.planes;
+	i32 offsets[9];
+	stencilOffsets<V>(offsets, s.gridStride);
+	i32 disordered = 0;
+
+	// mass, aeration and momentum are consecutive planes
+	f32* const plain[3] = {grid[G_MASS], grid[G_VEL_X], grid[G_VEL_Y]};
+	f32* const* planes = AERATED ? grid + G_MASS : plain;
+
+	for (i32 i = begin; i < end; i += V::LANES) {
+		Stencil<V> st;
+		wideStencil<V>(st, s, i);
+		const F aeration = AERATED ? V::load(p[P_AERATION] + i) : V::splat(0);
+		const F velx = V::load(p[P_VEL_X] + i);
+		const F vely = V::load(p[P_VEL_Y] + i);
+		const F gvel00 = V::load(p[P_GVEL_00] + i);
+		const F gvel01 = V::load(p[P_GVEL_01] + i);
+		const F gvel10 = V::load(p[P_GVEL_10] + i);
+		const F gvel11 = V::load(p[P_GVEL_11] + i);
+
+		// counted per quad of real particles, as the 4-lane kernels do
+		{
+			alignas(64) i32 c00[V::LANES];
+			V::storei(c00, st.c00);
+			for (i32 q = 0; q < V::LANES && i + q < s.numP; q += 4) {
+				const i32 lo = wideMin<V>(wideMin<V>(c00[q], c00[q + 1]), wideMin<V>(c00[q + 2], c00[q + 3]));
+				const i32 hi = wideMax<V>(wideMax<V>(c00[q], c00[q + 1]), wideMax<V>(c00[q + 2], c00[q + 3]));
+				disordered += hi - lo > 2 * s.gridStride;
+			}
+		}
+
+		const F cvx = V::add(velx, V::add(V::mul(gvel00, st.dx), V::mul(gvel01, st.dy)));
+		const F cvy = V::add(vely, V::add(V::mul(gvel10, st.dx), V::mul(gvel11, st.dy)));
+
+		typename V::template Scatter<AERATED ? 4 : 3> scatter(planes, st.c00, offsets);
+		for (i32 k = 0; k < 9; k++) {
+			F tx = cvx;
+			F ty = cvy;
+			if (k % 3 == 0) {
+				tx = V::sub(tx, gvel00);
+				ty = V::sub(ty, gvel10);
+			} else if (k % 3 == 2) {
+				tx = V::add(tx, gvel00);
+				ty = V::add(ty, gvel10);
+			}
+			if (k / 3 == 0) {
+				tx = V::sub(tx, gvel01);
+				ty = V::sub(ty, gvel11);
+			} else if (k / 3 == 2) {
+				tx = V::add(tx, gvel01);
+				ty = V::add(ty, gvel11);
+			}
+			const F w = st.w[k];
+			if (AERATED) {
+				const F fields[4] = {w, V::mul(w, aeration), V::mul(w, tx), V::mul(w, ty)};
+				scatter.add(k, fields);
+			} else {
+				const F fields[3] = {w, V::mul(w, tx), V::mul(w, ty)};
+				scatter.add(k, fields);
+			}
+		}
+		scatter.flush();
+	}
+	return disordered;
+}
+
+template <class V, i32 FEATURES>
+void widePressure(const KernelState& s, f32* const* grid, i32 begin, i32 end) {
+	using F = typename V::F;
+	using I = typename V::I;
+	constexpr bool AERATED = (FEATURES & FEATURE_AERATION) != 0;
+	f32* const* p = s.planes;
+	const f32* mass = s.grid[G_MASS];
+	const f32* cellAeration = s.grid[G_AERATION];
+	i32 offsets[9];
+	stencilOffsets<V>(offsets, s.gridStride);
+
+	for (i32 i = begin; i < end; i += V::LANES) {
+		Stencil<V> st;
+		wideStencil<V>(st, s, i);
+		I ci[9];
+		for (i32 k = 0; k < 9; k++) {
+			ci[k] = V::iadd(st.c00, V::splati(offsets[k]));
+		}
+
+		F density = V::splat(0);
+		for (i32 k = 0; k < 9; k++) {
+			density = V::add(density, V::mul(st.w[k], V::gather(mass, ci[k])));
+		}
+		V::store(p[P_DENSITY] + i, density);
+
+		if (AERATED) {
+			const F paer = V::load(p[P_AERATION] + i);
+			F aeration = V::splat(0);
+			for (i32 k = 0; k < 9; k++) {
+				aeration = V::add(aeration, V::mul(st.w[k], V::gather(cellAeration, ci[k])));
+			}
+			const F newAeration = V::mul(V::splat(s.scales.aerationDamp),
+				V::add(paer, V::mul(V::sub(aeration, paer), V::splat(s.scales.aerationBlur))));
+			V::store(p[P_AERATION] + i, newAeration);
+		}
+
+		if (s.scales.pressure == 0)
+			continue; // projectPressure() pushes instead
+
+		F pressure = V::mul(
+			V::sub(V::mul(density, V::splat(INV_DENSITY)), V::splat(1)), V::splat(s.scales.stiffness));
+		pressure = V::max(V::splat(0), pressure);
+
+		F volume = V::div(V::splat(1), density);
+		volume = V::select(volume, V::gt(density, V::splat(0)));
+		const F coeff = V::mul(volume, V::mul(V::splat(s.scales.pressure), pressure));
+		const F coeffx = V::mul(coeff, st.dx);
+		const F coeffy = V::mul(coeff, st.dy);
+		const F cx[3] = {V::sub(coeffx, coeff), coeffx, V::add(coeffx, coeff)};
+		const F cy[3] = {V::sub(coeffy, coeff), coeffy, V::add(coeffy, coeff)};
+
+		// the 4-lane kernel subtracts, adding the negation rounds the same
+		typename V::template Scatter<2> scatter(grid + G_DVEL_X, st.c00, offsets);
+		for (i32 k = 0; k < 9; k++) {
+			const F fields[2] = {
+				V::neg(V::mul(st.w[k], cx[k % 3])), V::neg(V::mul(st.w[k], cy[k / 3]))};
+			scatter.add(k, fields);
+		}
+		scatter.flush();
+	}
+}
+
+template <class V, i32 FEATURES>
+f32 wideG2p(const KernelState& s, i32 begin, i32 end) {
+	using F = typename V::F;
+	constexpr bool AERATED = (FEATURES & FEATURE_AERATION) != 0;
+	f32* const* p = s.planes;
+	const f32* cellVelx = s.grid[G_VEL_X];
+	const f32* cellVely = s.grid[G_VEL_Y];
+	i32 offsets[9];
+	stencilOffsets<V>(offsets, s.gridStride);
+
+	const f32 ONE = 1 + 1e-3;
+	const F minPosX = V::splat(ONE);
+	const F maxPosX = V::splat(s.gridW - ONE);
+	const F minPosY = V::splat(ONE);
+	const F maxPosY = V::splat(s.gridH - ONE);
+	F speed2 = V::splat(0);
+
+	for (i32 i = begin; i < end; i += V::LANES) {
+		Stencil<V> st;
+		wideStencil<V>(st, s, i);
+		const F posx = V::load(p[P_POS_X] + i);
+		const F posy = V::load(p[P_POS_Y] + i);
+
+		F vx = V::splat(0);
+		F vy = V::splat(0);
+		F gv00 = V::splat(0);
+		F gv01 = V::splat(0);
+		F gv10 = V::splat(0);
+		F gv11 = V::splat(0);
+
+		for (i32 k = 0; k < 9; k++) {
+			const typename V::I ci = V::iadd(st.c00, V::splati(offsets[k]));
+			const F wvx = V::mul(st.w[k], V::gather(cellVelx, ci));
+			const F wvy = V::mul(st.w[k], V::gather(cellVely, ci));
+			vx = V::add(vx, wvx);
+			vy = V::add(vy, wvy);
+			if (k % 3 == 0) {
+				gv00 = V::sub(gv00, wvx);
+				gv10 = V::sub(gv10, wvy);
+			} else if (k % 3 == 2) {
+				gv00 = V::add(gv00, wvx);
+				gv10 = V::add(gv10, wvy);
+			}
+			if (k / 3 == 0) {
+				gv01 = V::sub(gv01, wvx);
+				gv11 = V::sub(gv11, wvy);
+			} else if (k / 3 == 2) {
+				gv01 = V::add(gv01, wvx);
+				gv11 = V::add(gv11, wvy);
+			}
+		}
+
+		gv00 = V::mul(V::splat(4), V::add(gv00, V::mul(vx, st.dx)));
+		gv01 = V::mul(V::splat(4), V::add(gv01, V::mul(vx, st.dy)));
+		gv10 = V::mul(V::splat(4), V::add(gv10, V::mul(vy, st.dx)));
+		gv11 = V::mul(V::splat(4), V::add(gv11, V::mul(vy, st.dy)));
+
+		speed2 = V::max(speed2, V::add(widePow2<V>(vx), widePow2<V>(vy)));
+		const F nposx = V::min(V::max(V::add(posx, vx), minPosX), maxPosX);
+		const F nposy = V::min(V::max(V::add(posy, vy), minPosY), maxPosY);
+		const F nvelx = V::sub(nposx, posx);
+		const F nvely = V::sub(nposy, posy);
+
+		if (AERATED) {
+			const F accx = V::sub(nvelx, V::load(p[P_VEL_X] + i));
+			const F accy = V::sub(nvely, V::load(p[P_VEL_Y] + i));
+			const F densityRatio = V::mul(V::load(p[P_DENSITY] + i), V::splat(INV_DENSITY));
+			const F accLen = V::sqrt(V::add(widePow2<V>(accx), widePow2<V>(accy)));
+			const F aerationScale =
+				V::mul(V::sub(V::splat(1), V::mul(densityRatio, V::splat(s.scales.invAerationThreshold))),
+					V::splat(s.scales.aerationCoeff));
+			const F aerationDelta = V::max(V::splat(0), V::mul(accLen, aerationScale));
+			const F newAeration = V::min(V::splat(1), V::add(V::load(p[P_AERATION] + i), aerationDelta));
+			V::store(p[P_AERATION] + i, newAeration);
+		}
+		V::store(p[P_POS_X] + i, nposx);
+		V::store(p[P_POS_Y] + i, nposy);
+		V::store(p[P_VEL_X] + i, nvelx);
+		V::store(p[P_VEL_Y] + i, nvely);
+		V::store(p[P_GVEL_00] + i, gv00);
+		V::store(p[P_GVEL_01] + i, gv01);
+		V::store(p[P_GVEL_10] + i, gv10);
+		V::store(p[P_GVEL_11] + i, gv11);
+	}
+	return wideMaxLane<V>(speed2);
+}
+
+// a group covers LANES / BLOCK_SIZE whole rows of a block, padding cells included
+template <class V>
+f32 wideVelocity(
+	const KernelState& s, const i32* blocks, i32 begin, i32 end, i32 blocksW, const GridForces& f) {
+	using F = typename V::F;
+	using I = typename V::I;
+	constexpr i32 ROWS = V::LANES / BLOCK_SIZE;
+	f32* const* g = s.grid;
+
+	const F gravityXs = V::splat(f.gravityX);
+	const F gravityYs = V::splat(f.gravityY);
+	const F mouseXs = V::splat(f.mouseX);
+	const F mouseYs = V::splat(f.mouseY);
+	const F dmouseXs = V::splat(f.dmouseX);
+	const F dmouseYs = V::splat(f.dmouseY);
+	const F rad2s = V::splat(f.radius * f.radius);
+	const F invRs = V::splat(1 / f.radius);
+	const I lx = V::iand(V::iota(), V::splati(BLOCK_SIZE - 1));
+	const I ly = V::ishr(V::iota(), BLOCK_SHIFT);
+	F speed2 = V::splat(0);
+
+	for (i32 b = begin; b < end; b++) {
+		const i32 x0 = (blocks[b] % blocksW) << BLOCK_SHIFT;
+		const i32 y0 = (blocks[b] / blocksW) << BLOCK_SHIFT;
+		const i32 y1 = wideMin<V>(y0 + BLOCK_SIZE, s.gridH);
+		const I xs = V::iadd(lx, V::splati(x0));
+		const F cx = V::add(V::convert(xs), V::splat(0.5));
+		for (i32 y = y0; y < y1; y += ROWS) {
+			const I ys = V::iadd(ly, V::splati(y));
+			const i32 rows = wideMin<V>(ROWS, y1 - y);
+			const i32 c = y * s.gridStride + x0;
+
+			const F mass = V::loadRows(g[G_MASS] + c, s.gridStride, rows);
+			const typename V::M mask = V::gt(mass, V::splat(0));
+			const F invM = V::div(V::splat(1), mass);
+			const F mx = V::add(V::loadRows(g[G_VEL_X] + c, s.gridStride, rows),
+				V::loadRows(g[G_DVEL_X] + c, s.gridStride, rows));
+			const F my = V::add(V::loadRows(g[G_VEL_Y] + c, s.gridStride, rows),
+				V::loadRows(g[G_DVEL_Y] + c, s.gridStride, rows));
+			F vx = V::add(V::mul(mx, invM), gravityXs);
+			F vy = V::add(V::mul(my, invM), gravityYs);
+
+			// mouse interaction
+			const F dx = V::sub(mouseXs, cx);
+			const F dy = V::sub(mouseYs, V::add(V::convert(ys), V::splat(0.5)));
+			const F r2 = V::add(widePow2<V>(dx), widePow2<V>(dy));
+			const typename V::M mask2 = V::lt(r2, rad2s);
+			const F r = V::sqrt(r2);
+			F coeff = V::min(V::splat(1), V::sub(V::splat(2), V::mul(r, invRs)));
+			coeff = V::select(coeff, mask2);
+			vx = V::add(vx, V::mul(coeff, V::sub(dmouseXs, vx)));
+			vy = V::add(vy, V::mul(coeff, V::sub(dmouseYs, vy)));
+
+			vx = V::select(vx, mask);
+			vy = V::select(vy, mask);
+			speed2 = V::max(speed2, V::add(widePow2<V>(vx), widePow2<V>(vy)));
+			V::storeRows(g[G_VEL_X] + c, s.gridStride, rows, vx);
+			V::storeRows(g[G_VEL_Y] + c, s.gridStride, rows, vy);
+		}
+	}
+	return wideMaxLane<V>(speed2);
+}
+
+// the kernel table of V for a feature set
+template <class V, i32 FEATURES>
+constexpr WideKernels wideKernels() {
+	return {V::LANES, wideTransfer<V, FEATURES>, widePressure<V, FEATURES>, wideG2p<V, FEATURES>,
+		wideVelocity<V>};
+}